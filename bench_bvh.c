@@ -0,0 +1,209 @@
+// BVH traversal benchmark -=:LogicMonkey:=-
+//
+// Builds a hierarchy over a soup of random triangles and fires the same
+// incoherent rays through each form of it:
+//
+//   the malloc'd pointer tree                     lm_bvh_intersect
+//   the flattened depth first node array          lm_bvh_flat_intersect
+//   the wide tree                                 lm_bvhw_intersect
+//   the wide tree as any hit shadow queries       lm_bvhw_occluded
+//   the wide tree with byte quantised boxes       lm_bvhq_intersect
+//   the parallel Morton code build, flattened     lm_lbvh_build
+//
+// The shadow queries cull on the Plücker and slab child tests together, and
+// should run at least as fast as the closest hit walk. The Morton build runs
+// on every core and its build time is reported to weigh against its trace
+// speed. Reports the mean leaf size of the SAH and Morton trees, rays and
+// nodes visited per second, plus hit counts as a check they agree.
+//
+//   gcc -O2 bench_bvh.c -o bench_bvh -lm -pthread
+//   ./bench_bvh [triangles] [rays]
+//
+#include <time.h>
+#define LM_BVH_STATS
+#include "lm_bvhq.h"
+#include "lm_lbvh.h"
+
+float frand( float lo, float hi ) {
+  return lo + (hi - lo) * ((float) rand() / (float) RAND_MAX);
+}
+
+double now() {
+  struct timespec ts;
+  clock_gettime( CLOCK_MONOTONIC, &ts );
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// mean triangles a leaf of a flattened tree
+double leaf_size( const lm_bvh_flat *f ) {
+  int i, leaves = 0;
+
+  for( i=0; i<f->nodes; i++ ) {
+    if( f->node[i].count > 0 ) {
+      leaves++;
+    }
+  }
+  return (leaves > 0) ? (double) f->ntri / leaves : 0.0;
+}
+
+int main( int argc, char *argv[] ) {
+  int ntri  = (argc > 1) ? atoi( argv[1] ) : 1000000;
+  int nrays = (argc > 2) ? atoi( argv[2] ) : 1000000;
+  int i, j;
+  long hits;
+  double start, secs;
+  vec3 ro, rd;
+  lm_hit hit;
+  lm_bvh bvh;
+  lm_bvh_flat flat;
+  lm_bvhw wide;
+  lm_bvhq quant;
+  lm_bvh_flat lbvh;
+
+  vec3 *v = (vec3 *) malloc( 3 * ntri * sizeof(vec3) );
+  lm_ray *ray = (lm_ray *) malloc( nrays * sizeof(lm_ray) );
+
+  if( v == NULL || ray == NULL ) {
+    fprintf( stderr, "Could not allocate scene\n" );
+    return 1;
+  }
+
+  srand( 1 );
+
+  // small triangles scattered through a 100 unit cube
+  for( i=0; i<ntri; i++ ) {
+    v[3*i].x = frand( -50.0f, 50.0f );
+    v[3*i].y = frand( -50.0f, 50.0f );
+    v[3*i].z = frand( -50.0f, 50.0f );
+    for( j=1; j<3; j++ ) {
+      v[3*i+j].x = v[3*i].x + frand( -1.0f, 1.0f );
+      v[3*i+j].y = v[3*i].y + frand( -1.0f, 1.0f );
+      v[3*i+j].z = v[3*i].z + frand( -1.0f, 1.0f );
+    }
+  }
+
+  // incoherent rays - random origins inside the cube, random directions
+  for( i=0; i<nrays; i++ ) {
+    ro.x = frand( -50.0f, 50.0f );
+    ro.y = frand( -50.0f, 50.0f );
+    ro.z = frand( -50.0f, 50.0f );
+    rd.x = frand( -1.0f, 1.0f );
+    rd.y = frand( -1.0f, 1.0f );
+    rd.z = frand( -1.0f, 1.0f );
+    lm_ray_init( &ray[i], ro, rd );
+  }
+
+  start = now();
+  if( !lm_bvh_build( &bvh, v, ntri )) {
+    fprintf( stderr, "Could not build BVH\n" );
+    return 1;
+  }
+  secs = now() - start;
+  printf( "%d triangles, %d nodes, %.1f triangles a leaf, built in %.3fs\n", ntri, bvh.nodes,
+          (bvh.leaves > 0) ? (double) ntri / bvh.leaves : 0.0, secs );
+
+  start = now();
+  if( !lm_bvh_flatten( &flat, &bvh )) {
+    fprintf( stderr, "Could not flatten BVH\n" );
+    return 1;
+  }
+  secs = now() - start;
+  printf( "flattened to %zu byte nodes in %.3fs\n", sizeof(lm_bvh_flat_node), secs );
+
+  start = now();
+  if( !lm_bvhw_collapse( &wide, &bvh )) {
+    fprintf( stderr, "Could not collapse BVH\n" );
+    return 1;
+  }
+  secs = now() - start;
+  printf( "collapsed to %d wide %zu byte nodes in %.3fs, %.1fMB of nodes\n", LM_BVHW, sizeof(lm_bvhw_node), secs,
+          wide.nodes * sizeof(lm_bvhw_node) / 1048576.0 );
+
+  start = now();
+  if( !lm_bvhq_build( &quant, &wide )) {
+    fprintf( stderr, "Could not quantise BVH\n" );
+    return 1;
+  }
+  secs = now() - start;
+  printf( "quantised to %zu byte nodes in %.3fs, %.1fMB of nodes\n", sizeof(lm_bvhq_node), secs,
+          quant.nodes * sizeof(lm_bvhq_node) / 1048576.0 );
+
+  hits = 0;
+  lm_bvh_visits = 0;
+  start = now();
+  for( i=0; i<nrays; i++ ) {
+    hits += lm_bvh_intersect( &bvh, &ray[i], INFINITY, &hit );
+  }
+  secs = now() - start;
+  printf( "pointer tree  %7.3f Mrays/s %8.2f Mnodes/s  %ld hits\n",
+          nrays / secs * 1e-6, lm_bvh_visits / secs * 1e-6, hits );
+
+  hits = 0;
+  lm_bvh_visits = 0;
+  start = now();
+  for( i=0; i<nrays; i++ ) {
+    hits += lm_bvh_flat_intersect( &flat, &ray[i], INFINITY, &hit );
+  }
+  secs = now() - start;
+  printf( "flat array    %7.3f Mrays/s %8.2f Mnodes/s  %ld hits\n",
+          nrays / secs * 1e-6, lm_bvh_visits / secs * 1e-6, hits );
+
+  hits = 0;
+  lm_bvh_visits = 0;
+  start = now();
+  for( i=0; i<nrays; i++ ) {
+    hits += lm_bvhw_intersect( &wide, &ray[i], INFINITY, &hit );
+  }
+  secs = now() - start;
+  printf( "wide          %7.3f Mrays/s %8.2f Mnodes/s  %ld hits\n",
+          nrays / secs * 1e-6, lm_bvh_visits / secs * 1e-6, hits );
+
+  hits = 0;
+  lm_bvh_visits = 0;
+  start = now();
+  for( i=0; i<nrays; i++ ) {
+    hits += lm_bvhw_occluded( &wide, &ray[i], INFINITY );
+  }
+  secs = now() - start;
+  printf( "wide any hit  %7.3f Mrays/s %8.2f Mnodes/s  %ld hits\n",
+          nrays / secs * 1e-6, lm_bvh_visits / secs * 1e-6, hits );
+
+  hits = 0;
+  lm_bvh_visits = 0;
+  start = now();
+  for( i=0; i<nrays; i++ ) {
+    hits += lm_bvhq_intersect( &quant, &ray[i], INFINITY, &hit );
+  }
+  secs = now() - start;
+  printf( "quantised     %7.3f Mrays/s %8.2f Mnodes/s  %ld hits\n",
+          nrays / secs * 1e-6, lm_bvh_visits / secs * 1e-6, hits );
+
+  start = now();
+  if( !lm_lbvh_build( &lbvh, v, ntri, 0 )) {
+    fprintf( stderr, "Could not build LBVH\n" );
+    return 1;
+  }
+  secs = now() - start;
+  printf( "LBVH %d nodes, %.1f triangles a leaf, built on %d threads in %.3fs\n", lbvh.nodes, leaf_size( &lbvh ),
+          lm_par_threads(), secs );
+
+  hits = 0;
+  lm_bvh_visits = 0;
+  start = now();
+  for( i=0; i<nrays; i++ ) {
+    hits += lm_bvh_flat_intersect( &lbvh, &ray[i], INFINITY, &hit );
+  }
+  secs = now() - start;
+  printf( "LBVH flat     %7.3f Mrays/s %8.2f Mnodes/s  %ld hits\n",
+          nrays / secs * 1e-6, lm_bvh_visits / secs * 1e-6, hits );
+
+  lm_bvh_flat_free( &lbvh );
+  lm_bvhq_free( &quant );
+  lm_bvhw_free( &wide );
+  lm_bvh_flat_free( &flat );
+  lm_bvh_free( &bvh );
+  free( ray );
+  free( v );
+
+  return 0;
+}
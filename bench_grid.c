@@ -0,0 +1,115 @@
+// Grid versus BVH over spheres -=:LogicMonkey:=-
+//
+// Scatters similar sized spheres through a 100 unit cube, builds a uniform
+// grid (lm_grid_build) and a binned SAH BVH (lm_sbvh_build) over them, and
+// fires the same incoherent rays through both with the closest hit interface
+// they share. Reports the build times, then rays and cells or nodes visited
+// per second, plus hit counts as a check they agree.
+//
+//   gcc -O2 bench_grid.c -o bench_grid -lm
+//   ./bench_grid [spheres] [rays]
+//
+#include <time.h>
+#define LM_BVH_STATS
+#include "lm_grid.h"
+
+float frand( float lo, float hi ) {
+  return lo + (hi - lo) * ((float) rand() / (float) RAND_MAX);
+}
+
+double now() {
+  struct timespec ts;
+  clock_gettime( CLOCK_MONOTONIC, &ts );
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+int main( int argc, char *argv[] ) {
+  int n     = (argc > 1) ? atoi( argv[1] ) : 1000000;
+  int nrays = (argc > 2) ? atoi( argv[2] ) : 1000000;
+  int i, agree = 0;
+  long hits;
+  double start, secs;
+  vec3 p, ro, rd;
+  lm_hit hit, hit_bvh;
+  lm_spheres s;
+  lm_grid grid;
+  lm_sbvh bvh;
+
+  lm_ray *ray = (lm_ray *) malloc( nrays * sizeof(lm_ray) );
+
+  if( ray == NULL || !lm_spheres_alloc( &s, n )) {
+    fprintf( stderr, "Could not allocate scene\n" );
+    return 1;
+  }
+
+  srand( 1 );
+
+  for( i=0; i<n; i++ ) {
+    p.x = frand( -50.0f, 50.0f );
+    p.y = frand( -50.0f, 50.0f );
+    p.z = frand( -50.0f, 50.0f );
+    lm_spheres_set( &s, i, p, frand( 0.2f, 0.4f ));
+  }
+
+  // incoherent rays - random origins inside the cube, random directions
+  for( i=0; i<nrays; i++ ) {
+    ro.x = frand( -50.0f, 50.0f );
+    ro.y = frand( -50.0f, 50.0f );
+    ro.z = frand( -50.0f, 50.0f );
+    rd.x = frand( -1.0f, 1.0f );
+    rd.y = frand( -1.0f, 1.0f );
+    rd.z = frand( -1.0f, 1.0f );
+    lm_ray_init( &ray[i], ro, rd );
+  }
+
+  start = now();
+  if( !lm_grid_build( &grid, &s )) {
+    fprintf( stderr, "Could not build grid\n" );
+    return 1;
+  }
+  secs = now() - start;
+  printf( "%d spheres, %dx%dx%d grid, %.2f cells per sphere, built in %.3fs\n",
+          n, grid.res[0], grid.res[1], grid.res[2], (float) grid.refs / MAX( n, 1 ), secs );
+
+  start = now();
+  if( !lm_sbvh_build( &bvh, &s )) {
+    fprintf( stderr, "Could not build BVH\n" );
+    return 1;
+  }
+  secs = now() - start;
+  printf( "%d node BVH built in %.3fs\n", bvh.flat.nodes, secs );
+
+  hits = 0;
+  lm_bvh_visits = 0;
+  start = now();
+  for( i=0; i<nrays; i++ ) {
+    hits += lm_grid_intersect( &grid, &ray[i], INFINITY, &hit );
+  }
+  secs = now() - start;
+  printf( "grid  %7.3f Mrays/s %8.2f Mcells/s  %ld hits\n",
+          nrays / secs * 1e-6, lm_bvh_visits / secs * 1e-6, hits );
+
+  hits = 0;
+  lm_bvh_visits = 0;
+  start = now();
+  for( i=0; i<nrays; i++ ) {
+    hits += lm_sbvh_intersect( &bvh, &ray[i], INFINITY, &hit );
+  }
+  secs = now() - start;
+  printf( "BVH   %7.3f Mrays/s %8.2f Mnodes/s  %ld hits\n",
+          nrays / secs * 1e-6, lm_bvh_visits / secs * 1e-6, hits );
+
+  for( i=0; i<nrays; i++ ) {
+    lm_grid_intersect( &grid, &ray[i], INFINITY, &hit );
+    lm_sbvh_intersect( &bvh, &ray[i], INFINITY, &hit_bvh );
+    agree += (hit.t == hit_bvh.t);
+  }
+  printf( "%d of %d closest hits agree\n", agree, nrays );
+
+  lm_sbvh_free( &bvh );
+  lm_grid_free( &grid );
+  lm_spheres_free( &s );
+  free( ray );
+
+  return 0;
+}
@@ -0,0 +1,185 @@
+// Tile order benchmark -=:LogicMonkey:=-
+//
+// Scatters small triangles through a slab in front of a pinhole camera and
+// renders primary rays through the flat BVH with lm_render_order, once for
+// each tile order - raster, Morton and Hilbert. The hardware cache counters
+// (perf_event_open) are read round each render and reported as L1D and last
+// level cache read misses per ray, next to rays per second. Each image is
+// checked against the raster one, as only the order of the work may change.
+//
+// The counters need perf_event_paranoid <= 2 and a PMU the kernel exposes -
+// in a VM or container they often read n/a, the timings still stand.
+//
+//   gcc -O2 bench_order.c -o bench_order -lm -pthread
+//   ./bench_order [triangles] [image size] [threads]
+//
+#include <time.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#include "lm_bvh.h"
+#include "lm_render.h"
+
+typedef struct {
+  const lm_bvh_flat *bvh;
+  float *buffer;
+  int size;
+} lm_order_scene;
+
+float frand( float lo, float hi ) {
+  return lo + (hi - lo) * ((float) rand() / (float) RAND_MAX);
+}
+
+double now() {
+  struct timespec ts;
+  clock_gettime( CLOCK_MONOTONIC, &ts );
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// a read miss counter for one cache, following threads made after it opens.
+// -1 when the kernel won't give us one
+int lm_perf_open( int cache ) {
+  struct perf_event_attr pe;
+
+  memset( &pe, 0, sizeof(pe) );
+  pe.type     = PERF_TYPE_HW_CACHE;
+  pe.size     = sizeof(pe);
+  pe.config   = cache | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+  pe.disabled = 1;
+  pe.inherit  = 1;
+  pe.exclude_kernel = 1;
+  pe.exclude_hv     = 1;
+
+  return (int) syscall( SYS_perf_event_open, &pe, 0, -1, -1, 0 );
+}
+
+void lm_perf_start( int fd ) {
+  if( fd >= 0 ) {
+    ioctl( fd, PERF_EVENT_IOC_RESET, 0 );
+    ioctl( fd, PERF_EVENT_IOC_ENABLE, 0 );
+  }
+}
+
+// count since lm_perf_start, -1 if there is no counter
+long long lm_perf_stop( int fd ) {
+  long long count;
+
+  if( fd < 0 ) {
+    return -1;
+  }
+  ioctl( fd, PERF_EVENT_IOC_DISABLE, 0 );
+  return (read( fd, &count, sizeof(count) ) == sizeof(count)) ? count : -1;
+}
+
+void lm_order_tile( void *arg, int x0, int y0, int x1, int y1 ) {
+  const lm_order_scene *scene = (const lm_order_scene *) arg;
+  int x, y;
+  vec3 ro, rd;
+  lm_ray ray;
+  lm_hit hit;
+
+  ro.x = 0.0f;
+  ro.y = 0.0f;
+  ro.z = 0.0f;
+
+  for( y=y0; y<y1; y++ ) {
+    for( x=x0; x<x1; x++ ) {
+      rd.x = (float) (x - scene->size / 2);
+      rd.y = (float) (y - scene->size / 2);
+      rd.z = (float) scene->size;
+
+      lm_ray_init( &ray, ro, rd );
+      scene->buffer[ y * scene->size + x ] = lm_bvh_flat_intersect( scene->bvh, &ray, INFINITY, &hit ) ? hit.t : 0.0f;
+    }
+  }
+}
+
+void lm_order_print( long long misses, long rays ) {
+  if( misses < 0 ) {
+    printf( "      n/a" );
+  } else {
+    printf( " %8.3f", (double) misses / rays );
+  }
+}
+
+int main( int argc, char *argv[] ) {
+  int ntri     = (argc > 1) ? atoi( argv[1] ) : 1000000;
+  int size     = (argc > 2) ? atoi( argv[2] ) : 1024;
+  int nthreads = (argc > 3) ? atoi( argv[3] ) : 1;
+  const char *name[3] = { "raster", "morton", "hilbert" };
+  int i, j, order, steals, l1, ll;
+  long rays = (long) size * size;
+  long long l1_miss, ll_miss;
+  double start, secs;
+  lm_bvh bvh;
+  lm_bvh_flat flat;
+  lm_order_scene scene;
+
+  vec3 *v = (vec3 *) malloc( 3 * ntri * sizeof(vec3) );
+  float *raster = (float *) malloc( rays * sizeof(float) );
+  float *buffer = (float *) malloc( rays * sizeof(float) );
+
+  if( v == NULL || raster == NULL || buffer == NULL ) {
+    fprintf( stderr, "Could not allocate scene\n" );
+    return 1;
+  }
+
+  srand( 1 );
+
+  // small triangles in a slab filling the view, deep enough that most rays
+  // hit one and the tree is far bigger than the caches
+  for( i=0; i<ntri; i++ ) {
+    v[3*i].x = frand( -50.0f, 50.0f );
+    v[3*i].y = frand( -50.0f, 50.0f );
+    v[3*i].z = frand( 100.0f, 200.0f );
+    for( j=1; j<3; j++ ) {
+      v[3*i+j].x = v[3*i].x + frand( -0.5f, 0.5f );
+      v[3*i+j].y = v[3*i].y + frand( -0.5f, 0.5f );
+      v[3*i+j].z = v[3*i].z + frand( -0.5f, 0.5f );
+    }
+  }
+
+  if( !lm_bvh_build( &bvh, v, ntri ) || !lm_bvh_flatten( &flat, &bvh )) {
+    fprintf( stderr, "Could not build BVH\n" );
+    return 1;
+  }
+  lm_bvh_free( &bvh );
+  printf( "%d triangles, %d nodes, %.1fMB of nodes, %dx%d rays in 16 pixel tiles\n", ntri, flat.nodes,
+          flat.nodes * sizeof(lm_bvh_flat_node) / 1048576.0, size, size );
+
+  l1 = lm_perf_open( PERF_COUNT_HW_CACHE_L1D );
+  ll = lm_perf_open( PERF_COUNT_HW_CACHE_LL );
+
+  scene.bvh  = &flat;
+  scene.size = size;
+
+  printf( "order      Mrays/s  L1D/ray   LL/ray  steals\n" );
+  for( order=LM_ORDER_RASTER; order<=LM_ORDER_HILBERT; order++ ) {
+    scene.buffer = (order == LM_ORDER_RASTER) ? raster : buffer;
+
+    lm_perf_start( l1 );
+    lm_perf_start( ll );
+    start = now();
+    steals = lm_render_order( 0, 0, size, size, 16, order, lm_order_tile, &scene, nthreads );
+    secs = now() - start;
+    l1_miss = lm_perf_stop( l1 );
+    ll_miss = lm_perf_stop( ll );
+
+    printf( "%-8s %9.3f", name[order], rays / secs * 1e-6 );
+    lm_order_print( l1_miss, rays );
+    lm_order_print( ll_miss, rays );
+    printf( " %7d%s\n", steals,
+            (order != LM_ORDER_RASTER && memcmp( buffer, raster, rays * sizeof(float) )) ? "  IMAGE DIFFERS" : "" );
+  }
+
+  if( l1 >= 0 ) close( l1 );
+  if( ll >= 0 ) close( ll );
+  lm_bvh_flat_free( &flat );
+  free( v );
+  free( raster );
+  free( buffer );
+
+  return 0;
+}
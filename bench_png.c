@@ -0,0 +1,174 @@
+// PNG writer benchmark -=:LogicMonkey:=-
+//
+// Makes a rendered looking RGB image - smooth ramps with hard edged shapes,
+// coloured by the drivers' lm_tonemap ramp - and writes it once with
+// libpng a row at a time, then with lm_png_write for each filter at a few
+// zlib levels. Reports megapixels per second and file size for each, and
+// reads every file back through libpng to the end to check the pixels and
+// every chunk CRC.
+//
+//   gcc -O2 bench_png.c -o bench_png -lpng -lz -pthread
+//   ./bench_png [size] [threads]
+//
+#include <time.h>
+#include <png.h>
+#include <sys/stat.h>
+#include "lm_png.h"
+#include "lm_tonemap.h"
+
+typedef struct {
+  int size;
+  unsigned char *rgb;
+} lm_bench_image;
+
+double now() {
+  struct timespec ts;
+  clock_gettime( CLOCK_MONOTONIC, &ts );
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+void lm_bench_row( void *arg, int y, unsigned char *rgb ) {
+  const lm_bench_image *im = (const lm_bench_image *) arg;
+  memcpy( rgb, im->rgb + (long) y * 3 * im->size, 3 * im->size );
+}
+
+long lm_bench_file_size( const char *filename ) {
+  struct stat st;
+  return (stat( filename, &st ) == 0) ? (long) st.st_size : -1;
+}
+
+// write with libpng on one thread - its own default filter choice and level
+int lm_bench_libpng( const char *filename, const lm_bench_image *im ) {
+  FILE *fp = fopen( filename, "wb" );
+  png_structp png_ptr;
+  png_infop info_ptr;
+  int y;
+
+  if( fp == NULL ) {
+    return 1;
+  }
+  png_ptr  = png_create_write_struct( PNG_LIBPNG_VER_STRING, NULL, NULL, NULL );
+  info_ptr = png_create_info_struct( png_ptr );
+  if( setjmp( png_jmpbuf( png_ptr ))) {
+    fclose( fp );
+    return 1;
+  }
+  png_init_io( png_ptr, fp );
+  png_set_IHDR( png_ptr, info_ptr, im->size, im->size, 8, PNG_COLOR_TYPE_RGB, PNG_INTERLACE_NONE,
+                PNG_COMPRESSION_TYPE_BASE, PNG_FILTER_TYPE_BASE );
+  png_write_info( png_ptr, info_ptr );
+  for( y=0; y<im->size; y++ ) {
+    png_write_row( png_ptr, im->rgb + (long) y * 3 * im->size );
+  }
+  png_write_end( png_ptr, NULL );
+  png_destroy_write_struct( &png_ptr, &info_ptr );
+  fclose( fp );
+  return 0;
+}
+
+// read filename back to the end - every chunk and CRC up to IEND - and
+// compare with the image, 1 if it matches
+int lm_bench_check( const char *filename, const lm_bench_image *im ) {
+  FILE *fp = fopen( filename, "rb" );
+  png_structp png_ptr;
+  png_infop info_ptr;
+  unsigned char *row = NULL;
+  int same = 1, y;
+
+  if( fp == NULL ) {
+    return 0;
+  }
+  png_ptr  = png_create_read_struct( PNG_LIBPNG_VER_STRING, NULL, NULL, NULL );
+  info_ptr = png_create_info_struct( png_ptr );
+  if( setjmp( png_jmpbuf( png_ptr ))) {
+    png_destroy_read_struct( &png_ptr, &info_ptr, NULL );
+    free( row );
+    fclose( fp );
+    return 0;
+  }
+  png_init_io( png_ptr, fp );
+  png_read_info( png_ptr, info_ptr );
+  if( png_get_image_width( png_ptr, info_ptr ) != (unsigned) im->size
+   || png_get_image_height( png_ptr, info_ptr ) != (unsigned) im->size
+   || png_get_color_type( png_ptr, info_ptr ) != PNG_COLOR_TYPE_RGB
+   || png_get_bit_depth( png_ptr, info_ptr ) != 8 ) {
+    same = 0;
+  } else {
+    row = (unsigned char *) malloc( 3L * im->size );
+    if( row == NULL ) {
+      png_error( png_ptr, "out of memory" );
+    }
+    for( y=0; y<im->size; y++ ) {
+      png_read_row( png_ptr, row, NULL );
+      same &= (memcmp( row, im->rgb + 3L * y * im->size, 3L * im->size ) == 0);
+    }
+    png_read_end( png_ptr, NULL );
+  }
+  png_destroy_read_struct( &png_ptr, &info_ptr, NULL );
+  free( row );
+  fclose( fp );
+  return same;
+}
+
+void lm_bench_report( const char *name, int level, double secs, const char *filename, const lm_bench_image *im ) {
+  printf( "%-9s %2d %9.2f %10ld  %s\n", name, level, (double) im->size * im->size / secs * 1e-6,
+          lm_bench_file_size( filename ), lm_bench_check( filename, im ) ? "ok" : "MISMATCH" );
+}
+
+int main( int argc, char *argv[] ) {
+  int size     = (argc > 1) ? atoi( argv[1] ) : 4096;
+  int nthreads = (argc > 2) ? atoi( argv[2] ) : 0;
+  const char *name[6] = { "none", "sub", "up", "avg", "paeth", "adaptive" };
+  const int level[3] = { 1, 6, 9 };
+  const char *filename = "bench_png.png";
+  int x, y, f, l;
+  float cx, cy, *val;
+  double start;
+  lm_bench_image im;
+  lm_tonemap_lut lut;
+
+  im.size = size;
+  im.rgb  = (unsigned char *) malloc( 3L * size * size );
+  val    = (float *) malloc( size * sizeof(float) );
+  if( im.rgb == NULL || val == NULL ) {
+    fprintf( stderr, "Could not allocate image\n" );
+    return 1;
+  }
+
+  // a ramp with a disc and a box cut out of it
+  lm_tonemap_init( &lut );
+  for( y=0; y<size; y++ ) {
+    for( x=0; x<size; x++ ) {
+      cx     = (float) x / size - 0.5f;
+      cy     = (float) y / size - 0.5f;
+      val[x] = (cx * cx + cy * cy < 0.1f) ? 0.5f + cx * cy : (float) (x + y) / (2 * size);
+      val[x] = (x > size / 8 && x < size / 3 && y > size / 2) ? 0.0f : val[x];
+    }
+    lm_tonemap_rgb888( &lut, im.rgb + 3L * y * size, val, size );
+  }
+
+  printf( "%dx%d RGB, %d stripes of %d rows\n", size, size, (size + LM_PNG_STRIPE - 1) / LM_PNG_STRIPE, LM_PNG_STRIPE );
+  printf( "filter level   Mpix/s      bytes\n" );
+
+  start = now();
+  if( lm_bench_libpng( filename, &im )) {
+    fprintf( stderr, "libpng could not write %s\n", filename );
+    return 1;
+  }
+  lm_bench_report( "libpng", 6, now() - start, filename, &im );
+
+  for( f=LM_PNG_FILTER_NONE; f<=LM_PNG_FILTER_ADAPTIVE; f++ ) {
+    for( l=0; l<3; l++ ) {
+      start = now();
+      if( lm_png_write( filename, size, size, lm_bench_row, &im, NULL, f, level[l], nthreads )) {
+        return 1;
+      }
+      lm_bench_report( name[f], level[l], now() - start, filename, &im );
+    }
+  }
+
+  remove( filename );
+  free( im.rgb );
+  free( val );
+  return 0;
+}
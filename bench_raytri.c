@@ -0,0 +1,132 @@
+// Ray/triangle benchmark -=:LogicMonkey:=-
+//
+// Fires a set of rays at a soup of random triangles, every ray against every
+// triangle, three ways:
+//
+//   lm_rt_raytriint   vec3 ray, vertices          (the original kernel)
+//   lm_ray_triint     lm_ray record, vertices
+//   lm_ray_tri        lm_ray record, lm_tri record
+//   lm_ray_tri_early  records, volume tests before any division
+//
+// and reports million tests per second. Hit counts are printed as a check
+// that they agree - the early test also culls hits behind the ray origin, so
+// it can report fewer.
+//
+//   gcc -O2 bench_raytri.c -o bench_raytri -lm
+//   ./bench_raytri [triangles] [rays]
+//
+#include <time.h>
+#include "lm_rt.h"
+
+float frand( float lo, float hi ) {
+  return lo + (hi - lo) * ((float) rand() / (float) RAND_MAX);
+}
+
+double now() {
+  struct timespec ts;
+  clock_gettime( CLOCK_MONOTONIC, &ts );
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+int main( int argc, char *argv[] ) {
+  int ntri  = (argc > 1) ? atoi( argv[1] ) : 4096;
+  int nrays = (argc > 2) ? atoi( argv[2] ) : 1024;
+  int i, j;
+  long hits;
+  double start, secs, tests;
+  float beta, gamma, t;
+
+  vec3 *v    = (vec3 *) malloc( 3 * ntri * sizeof(vec3) );
+  vec3 *ro   = (vec3 *) malloc( nrays * sizeof(vec3) );
+  vec3 *rd   = (vec3 *) malloc( nrays * sizeof(vec3) );
+  lm_ray *ray = (lm_ray *) malloc( nrays * sizeof(lm_ray) );
+  lm_tri *tri;
+
+  if( v == NULL || ro == NULL || rd == NULL || ray == NULL ) {
+    fprintf( stderr, "Could not allocate scene\n" );
+    return 1;
+  }
+
+  srand( 1 );
+
+  // small triangles scattered through a 100 unit cube
+  for( i=0; i<ntri; i++ ) {
+    v[3*i].x = frand( -50.0f, 50.0f );
+    v[3*i].y = frand( -50.0f, 50.0f );
+    v[3*i].z = frand( -50.0f, 50.0f );
+    for( j=1; j<3; j++ ) {
+      v[3*i+j].x = v[3*i].x + frand( -8.0f, 8.0f );
+      v[3*i+j].y = v[3*i].y + frand( -8.0f, 8.0f );
+      v[3*i+j].z = v[3*i].z + frand( -8.0f, 8.0f );
+    }
+  }
+
+  // rays from outside the cube towards a random point inside it
+  for( i=0; i<nrays; i++ ) {
+    ro[i].x = frand( -100.0f, 100.0f );
+    ro[i].y = frand( -100.0f, 100.0f );
+    ro[i].z = -200.0f;
+    rd[i].x = frand( -50.0f, 50.0f ) - ro[i].x;
+    rd[i].y = frand( -50.0f, 50.0f ) - ro[i].y;
+    rd[i].z = frand( -50.0f, 50.0f ) - ro[i].z;
+  }
+
+  tests = (double) ntri * nrays;
+  printf( "%d triangles x %d rays\n", ntri, nrays );
+
+  hits = 0;
+  start = now();
+  for( i=0; i<nrays; i++ ) {
+    for( j=0; j<ntri; j++ ) {
+      hits += lm_rt_raytriint( ro[i], rd[i], v[3*j], v[3*j+1], v[3*j+2], &beta, &gamma, &t );
+    }
+  }
+  secs = now() - start;
+  printf( "lm_rt_raytriint  %8.2f Mtests/s  %ld hits\n", tests / secs * 1e-6, hits );
+
+  hits = 0;
+  start = now();
+  for( i=0; i<nrays; i++ ) {
+    lm_ray_init( &ray[i], ro[i], rd[i] );
+    for( j=0; j<ntri; j++ ) {
+      hits += lm_ray_triint( &ray[i], v[3*j], v[3*j+1], v[3*j+2], &beta, &gamma, &t );
+    }
+  }
+  secs = now() - start;
+  printf( "lm_ray_triint    %8.2f Mtests/s  %ld hits\n", tests / secs * 1e-6, hits );
+
+  // the record build is scene load work, so it's outside the timed loop
+  tri = lm_tri_soup( v, ntri );
+  if( tri == NULL ) {
+    fprintf( stderr, "Could not allocate triangle records\n" );
+    return 1;
+  }
+
+  hits = 0;
+  start = now();
+  for( i=0; i<nrays; i++ ) {
+    for( j=0; j<ntri; j++ ) {
+      hits += lm_ray_tri( &ray[i], &tri[j], &beta, &gamma, &t );
+    }
+  }
+  secs = now() - start;
+  printf( "lm_ray_tri       %8.2f Mtests/s  %ld hits\n", tests / secs * 1e-6, hits );
+
+  hits = 0;
+  start = now();
+  for( i=0; i<nrays; i++ ) {
+    for( j=0; j<ntri; j++ ) {
+      hits += lm_ray_tri_early( &ray[i], &tri[j], INFINITY, NULL, NULL, &t );
+    }
+  }
+  secs = now() - start;
+  printf( "lm_ray_tri_early %8.2f Mtests/s  %ld hits\n", tests / secs * 1e-6, hits );
+
+  free( tri );
+  free( ray );
+  free( rd );
+  free( ro );
+  free( v );
+
+  return 0;
+}
@@ -0,0 +1,133 @@
+// BVH refit benchmark -=:LogicMonkey:=-
+//
+// Random triangles drift through a 100 unit cube, each at its own velocity,
+// bouncing off the walls. Every frame the hierarchy is brought up to date with
+// lm_bvh_update - a refit, or a rebuild once the SAH cost has grown past
+// LM_BVH_DRIFT - and the same incoherent rays are traced. For comparison the
+// frame is also rebuilt from scratch with lm_lbvh_build and traced again, so
+// the refitted tree's extra trace time can be weighed against the build time
+// it saves.
+//
+//   gcc -O2 bench_refit.c -o bench_refit -lm -pthread
+//   ./bench_refit [triangles] [frames] [rays]
+//
+#include <time.h>
+#define LM_BVH_STATS
+#include "lm_refit.h"
+
+float frand( float lo, float hi ) {
+  return lo + (hi - lo) * ((float) rand() / (float) RAND_MAX);
+}
+
+double now() {
+  struct timespec ts;
+  clock_gettime( CLOCK_MONOTONIC, &ts );
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+double trace( const lm_bvh_flat *bvh, const lm_ray *ray, int nrays, long *hits ) {
+  double start = now();
+  lm_hit hit;
+  int i;
+
+  *hits = 0;
+  for( i=0; i<nrays; i++ ) {
+    *hits += lm_bvh_flat_intersect( bvh, &ray[i], INFINITY, &hit );
+  }
+  return now() - start;
+}
+
+int main( int argc, char *argv[] ) {
+  int ntri   = (argc > 1) ? atoi( argv[1] ) : 1000000;
+  int frames = (argc > 2) ? atoi( argv[2] ) : 20;
+  int nrays  = (argc > 3) ? atoi( argv[3] ) : 100000;
+  int i, j, f, rebuilt;
+  long hits, hits_fresh;
+  float sah0, sah;
+  double start, t_update, t_build, t_trace, t_trace_fresh;
+  vec3 ro, rd;
+  lm_bvh_flat bvh, fresh;
+
+  vec3 *v   = (vec3 *) malloc( 3 * ntri * sizeof(vec3) );
+  vec3 *vel = (vec3 *) malloc( ntri * sizeof(vec3) );
+  lm_ray *ray = (lm_ray *) malloc( nrays * sizeof(lm_ray) );
+
+  if( v == NULL || vel == NULL || ray == NULL ) {
+    fprintf( stderr, "Could not allocate scene\n" );
+    return 1;
+  }
+
+  srand( 1 );
+
+  for( i=0; i<ntri; i++ ) {
+    v[3*i].x = frand( -50.0f, 50.0f );
+    v[3*i].y = frand( -50.0f, 50.0f );
+    v[3*i].z = frand( -50.0f, 50.0f );
+    for( j=1; j<3; j++ ) {
+      v[3*i+j].x = v[3*i].x + frand( -1.0f, 1.0f );
+      v[3*i+j].y = v[3*i].y + frand( -1.0f, 1.0f );
+      v[3*i+j].z = v[3*i].z + frand( -1.0f, 1.0f );
+    }
+    vel[i].x = frand( -0.05f, 0.05f );
+    vel[i].y = frand( -0.05f, 0.05f );
+    vel[i].z = frand( -0.05f, 0.05f );
+  }
+
+  for( i=0; i<nrays; i++ ) {
+    ro.x = frand( -50.0f, 50.0f );
+    ro.y = frand( -50.0f, 50.0f );
+    ro.z = frand( -50.0f, 50.0f );
+    rd.x = frand( -1.0f, 1.0f );
+    rd.y = frand( -1.0f, 1.0f );
+    rd.z = frand( -1.0f, 1.0f );
+    lm_ray_init( &ray[i], ro, rd );
+  }
+
+  start = now();
+  if( !lm_lbvh_build( &bvh, v, ntri, 0 )) {
+    fprintf( stderr, "Could not build BVH\n" );
+    return 1;
+  }
+  sah0 = lm_bvh_flat_sah( &bvh );
+  printf( "%d triangles, %d nodes, built in %.3fs, SAH cost %.1f\n", ntri, bvh.nodes, now() - start, sah0 );
+  printf( "frame   update     SAH  trace Mrays/s | rebuild  trace Mrays/s\n" );
+
+  for( f=1; f<=frames; f++ ) {
+    for( i=0; i<ntri; i++ ) {
+      if( v[3*i].x < -50.0f || v[3*i].x > 50.0f ) vel[i].x = -vel[i].x;
+      if( v[3*i].y < -50.0f || v[3*i].y > 50.0f ) vel[i].y = -vel[i].y;
+      if( v[3*i].z < -50.0f || v[3*i].z > 50.0f ) vel[i].z = -vel[i].z;
+      for( j=0; j<3; j++ ) {
+        lm_vec3_add( &v[3*i+j], v[3*i+j], vel[i] );
+      }
+    }
+
+    start = now();
+    rebuilt = lm_bvh_update( &bvh, v, &sah0, LM_BVH_DRIFT, 0 );
+    t_update = now() - start;
+    sah = lm_bvh_flat_sah( &bvh );
+    t_trace = trace( &bvh, ray, nrays, &hits );
+
+    start = now();
+    if( !lm_lbvh_build( &fresh, v, ntri, 0 )) {
+      fprintf( stderr, "Could not build BVH\n" );
+      return 1;
+    }
+    t_build = now() - start;
+    t_trace_fresh = trace( &fresh, ray, nrays, &hits_fresh );
+    lm_bvh_flat_free( &fresh );
+
+    printf( "%5d %7.1fms%c %6.1f %13.3f | %5.1fms %13.3f%s\n",
+            f, t_update * 1e3, rebuilt ? '*' : ' ', sah, nrays / t_trace * 1e-6,
+            t_build * 1e3, nrays / t_trace_fresh * 1e-6,
+            (hits == hits_fresh) ? "" : "  hit counts differ!" );
+  }
+  printf( "* rebuilt, SAH cost over %.1fx the last build\n", LM_BVH_DRIFT );
+
+  lm_bvh_flat_free( &bvh );
+  free( ray );
+  free( vel );
+  free( v );
+
+  return 0;
+}
@@ -0,0 +1,561 @@
+// Bounding volume hierarchy over a triangle soup -=:LogicMonkey:=-
+//
+// Built top down with a binned surface area heuristic (Wald [2007]):
+// centroids are dropped into LM_BVH_BINS bins along each axis and the split
+// plane between two bins with the lowest
+//
+//   SAH = Ctrav + Cisect.(A_left.N_left + A_right.N_right)/A_node
+//
+// is taken, unless Cisect.N for a leaf is cheaper. Traversal uses the
+// lm_ray_slab box test at the nodes (nearer child first, boxes beyond the
+// closest hit dropped) and lm_ray_tri_early at the leaves.
+//
+// Note lm_ray_tri_early, like lm_rt_raytriint, only accepts triangles whose
+// E1 X E0 normal points along the ray - wind meshes to suit.
+//
+#ifndef LM_BVH_H
+#define LM_BVH_H
+
+#include <string.h>
+#include "lm_rt.h"
+
+#define LM_BVH_BINS    16
+#define LM_BVH_MAXLEAF 8       // target leaf size - only the LM_BVH_DEPTH cap makes bigger leaves
+#define LM_BVH_DEPTH   60      // deeper than this and the node is made a leaf
+#define LM_BVH_STACK   64
+
+// SAH costs in units of one lm_ray_tri_early. A visit is two lm_ray_slab
+// calls - about one triangle test's worth with the node in cache - plus the
+// fetch of a node that usually is not; fitted to bench_bvh's visit and test
+// counts against its trace times a visit comes out near three tests.
+#ifndef LM_BVH_CTRAV
+#define LM_BVH_CTRAV   3.0f    // cost of visiting a node...
+#endif
+#ifndef LM_BVH_CISECT
+#define LM_BVH_CISECT  1.0f    // ...and of a triangle test
+#endif
+
+typedef struct {
+  vec3 lo, hi;
+} lm_aabb;
+
+typedef struct lm_bvh_node {
+  lm_aabb box;
+  struct lm_bvh_node *left, *right;   // both NULL for a leaf
+  int first, count;                   // a leaf's range of bvh->tri
+} lm_bvh_node;
+
+typedef struct {
+  lm_bvh_node *root;
+  lm_tri *tri;        // triangle records in leaf order
+  int *index;         // soup index of each record
+  int ntri;
+  int nodes;
+  int leaves;
+} lm_bvh;
+
+// closest hit
+typedef struct {
+  float t, beta, gamma;
+  int tri;            // soup index, -1 for a miss
+  int rec;            // record in bvh->tri
+} lm_hit;
+
+#ifdef LM_BVH_STATS
+long lm_bvh_visits = 0;   // nodes popped by the intersect loops
+#define LM_BVH_VISIT() lm_bvh_visits++
+#else
+#define LM_BVH_VISIT()
+#endif
+
+void lm_aabb_empty( lm_aabb *b ) {
+  b->lo.x = b->lo.y = b->lo.z =  INFINITY;
+  b->hi.x = b->hi.y = b->hi.z = -INFINITY;
+}
+
+void lm_aabb_grow( lm_aabb *b, vec3 p ) {
+  b->lo.x = MIN( b->lo.x, p.x );
+  b->lo.y = MIN( b->lo.y, p.y );
+  b->lo.z = MIN( b->lo.z, p.z );
+  b->hi.x = MAX( b->hi.x, p.x );
+  b->hi.y = MAX( b->hi.y, p.y );
+  b->hi.z = MAX( b->hi.z, p.z );
+}
+
+// lo and hi taken separately, so an empty a (lo +inf, hi -inf) leaves b as it
+// was rather than growing it to infinity
+void lm_aabb_union( lm_aabb *b, const lm_aabb *a ) {
+  b->lo.x = MIN( b->lo.x, a->lo.x );
+  b->lo.y = MIN( b->lo.y, a->lo.y );
+  b->lo.z = MIN( b->lo.z, a->lo.z );
+  b->hi.x = MAX( b->hi.x, a->hi.x );
+  b->hi.y = MAX( b->hi.y, a->hi.y );
+  b->hi.z = MAX( b->hi.z, a->hi.z );
+}
+
+// half the surface area - the SAH only needs the ratio
+float lm_aabb_area( const lm_aabb *b ) {
+  float dx = b->hi.x - b->lo.x;
+  float dy = b->hi.y - b->lo.y;
+  float dz = b->hi.z - b->lo.z;
+
+  if( dx < 0.0f || dy < 0.0f || dz < 0.0f ) {
+    return 0.0f;
+  }
+  return dx*dy + dy*dz + dz*dx;
+}
+
+float lm_vec3_axis( vec3 a, int axis ) {
+  return (axis == 0) ? a.x : (axis == 1) ? a.y : a.z;
+}
+
+// per triangle bounds and centroids, only needed while building
+typedef struct {
+  lm_aabb *box;
+  vec3 *centre;
+  int *index;
+  int nodes, leaves;
+} lm_bvh_build_ctx;
+
+void lm_bvh_free_node( lm_bvh_node *node ) {
+  if( node == NULL ) {
+    return;
+  }
+  lm_bvh_free_node( node->left );
+  lm_bvh_free_node( node->right );
+  free( node );
+}
+
+lm_bvh_node *lm_bvh_build_node( lm_bvh_build_ctx *ctx, int first, int count, int depth ) {
+  int i, axis, b;
+  int best_axis = -1, best_split = 0;
+  float best_cost, leaf_cost, extent, k;
+  lm_aabb cbox;
+
+  lm_bvh_node *node = (lm_bvh_node *) malloc( sizeof(lm_bvh_node) );
+  if( node == NULL ) {
+    return NULL;
+  }
+  ctx->nodes++;
+
+  node->left  = NULL;
+  node->right = NULL;
+  node->first = first;
+  node->count = count;
+
+  // node bounds and centroid bounds
+  lm_aabb_empty( &node->box );
+  lm_aabb_empty( &cbox );
+  for( i=first; i<first+count; i++ ) {
+    lm_aabb_union( &node->box, &ctx->box[ctx->index[i]] );
+    lm_aabb_grow( &cbox, ctx->centre[ctx->index[i]] );
+  }
+
+  leaf_cost = LM_BVH_CISECT * count;
+  best_cost = INFINITY;
+
+  if( count > 1 && depth < LM_BVH_DEPTH ) {
+    for( axis=0; axis<3; axis++ ) {
+      int     bin_n[LM_BVH_BINS];
+      lm_aabb bin_box[LM_BVH_BINS];
+      float   right_area[LM_BVH_BINS];
+      int     right_n[LM_BVH_BINS];
+      lm_aabb acc;
+      int     acc_n;
+
+      extent = lm_vec3_axis( cbox.hi, axis ) - lm_vec3_axis( cbox.lo, axis );
+      if( extent <= 0.0f ) {
+        continue;
+      }
+      k = LM_BVH_BINS / extent;
+
+      for( b=0; b<LM_BVH_BINS; b++ ) {
+        bin_n[b] = 0;
+        lm_aabb_empty( &bin_box[b] );
+      }
+
+      for( i=first; i<first+count; i++ ) {
+        b = (int) (k * (lm_vec3_axis( ctx->centre[ctx->index[i]], axis ) - lm_vec3_axis( cbox.lo, axis )));
+        b = MIN( b, LM_BVH_BINS - 1 );
+        bin_n[b]++;
+        lm_aabb_union( &bin_box[b], &ctx->box[ctx->index[i]] );
+      }
+
+      // sweep from the right, then from the left evaluating each plane
+      lm_aabb_empty( &acc );
+      acc_n = 0;
+      for( b=LM_BVH_BINS-1; b>0; b-- ) {
+        lm_aabb_union( &acc, &bin_box[b] );
+        acc_n += bin_n[b];
+        right_area[b] = lm_aabb_area( &acc );
+        right_n[b]    = acc_n;
+      }
+
+      lm_aabb_empty( &acc );
+      acc_n = 0;
+      for( b=1; b<LM_BVH_BINS; b++ ) {
+        float cost;
+        lm_aabb_union( &acc, &bin_box[b-1] );
+        acc_n += bin_n[b-1];
+        if( acc_n == 0 || right_n[b] == 0 ) {
+          continue;
+        }
+        cost = lm_aabb_area( &acc ) * acc_n + right_area[b] * right_n[b];
+        if( cost < best_cost ) {
+          best_cost  = cost;
+          best_axis  = axis;
+          best_split = b;
+        }
+      }
+    }
+
+    best_cost = LM_BVH_CTRAV + LM_BVH_CISECT * best_cost / lm_aabb_area( &node->box );
+  }
+
+  if( count == 1 || depth >= LM_BVH_DEPTH || (best_cost >= leaf_cost && count <= LM_BVH_MAXLEAF )) {
+    ctx->leaves++;
+    return node;
+  }
+
+  int mid = first;
+
+  if( best_axis >= 0 ) {
+    // partition the index range on the chosen bin boundary
+    int j = first + count - 1;
+    float lo = lm_vec3_axis( cbox.lo, best_axis );
+
+    extent = lm_vec3_axis( cbox.hi, best_axis ) - lo;
+    k = LM_BVH_BINS / extent;
+
+    while( mid <= j ) {
+      b = (int) (k * (lm_vec3_axis( ctx->centre[ctx->index[mid]], best_axis ) - lo));
+      b = MIN( b, LM_BVH_BINS - 1 );
+      if( b < best_split ) {
+        mid++;
+      } else {
+        int swap = ctx->index[mid];
+        ctx->index[mid] = ctx->index[j];
+        ctx->index[j] = swap;
+        j--;
+      }
+    }
+  }
+
+  // all centroids together - too many for a leaf, so just halve the range
+  if( mid == first || mid == first + count ) {
+    mid = first + count / 2;
+  }
+
+  node->left  = lm_bvh_build_node( ctx, first, mid - first, depth + 1 );
+  node->right = lm_bvh_build_node( ctx, mid, first + count - mid, depth + 1 );
+  node->count = 0;
+
+  if( node->left == NULL || node->right == NULL ) {
+    lm_bvh_free_node( node );
+    return NULL;
+  }
+  return node;
+}
+
+void lm_bvh_free( lm_bvh *bvh ) {
+  lm_bvh_free_node( bvh->root );
+  free( bvh->tri );
+  free( bvh->index );
+  bvh->root  = NULL;
+  bvh->tri   = NULL;
+  bvh->index = NULL;
+}
+
+// build over n boxes, leaving bvh->index as the leaf order of the boxes and
+// bvh->tri NULL - for hierarchies over things other than triangles. Returns 0
+// on allocation failure.
+int lm_bvh_build_boxes( lm_bvh *bvh, const lm_aabb *box, int n ) {
+  int i;
+  lm_bvh_build_ctx ctx;
+
+  bvh->root  = NULL;
+  bvh->tri   = NULL;
+  bvh->ntri  = n;
+  bvh->index = (int *) malloc( (n > 0 ? n : 1) * sizeof(int) );
+
+  ctx.box    = (lm_aabb *) box;
+  ctx.centre = (vec3 *) malloc( (n > 0 ? n : 1) * sizeof(vec3) );
+  ctx.index  = bvh->index;
+  ctx.nodes  = 0;
+  ctx.leaves = 0;
+
+  if( bvh->index == NULL || ctx.centre == NULL ) {
+    free( ctx.centre );
+    lm_bvh_free( bvh );
+    return 0;
+  }
+
+  for( i=0; i<n; i++ ) {
+    ctx.centre[i].x = (box[i].lo.x + box[i].hi.x) * 0.5f;
+    ctx.centre[i].y = (box[i].lo.y + box[i].hi.y) * 0.5f;
+    ctx.centre[i].z = (box[i].lo.z + box[i].hi.z) * 0.5f;
+    bvh->index[i] = i;
+  }
+
+  bvh->root   = lm_bvh_build_node( &ctx, 0, n, 0 );
+  bvh->nodes  = ctx.nodes;
+  bvh->leaves = ctx.leaves;
+
+  free( ctx.centre );
+
+  if( bvh->root == NULL ) {
+    lm_bvh_free( bvh );
+    return 0;
+  }
+  return 1;
+}
+
+// build over a soup of ntri triangles held as 3*ntri vertices, returns 0 on
+// allocation failure
+int lm_bvh_build( lm_bvh *bvh, const vec3 *v, int ntri ) {
+  int i, ok = 0;
+  lm_aabb *box = NULL;
+
+  bvh->root  = NULL;
+  bvh->tri   = NULL;
+  bvh->index = NULL;
+
+  // every box is filled in before the build reads any of them
+  if( ntri > 0 ) {
+    box = (lm_aabb *) malloc( ntri * sizeof(lm_aabb) );
+  }
+  if( box != NULL || ntri <= 0 ) {
+    for( i=0; i<ntri; i++ ) {
+      lm_aabb_empty( &box[i] );
+      lm_aabb_grow( &box[i], v[3*i] );
+      lm_aabb_grow( &box[i], v[3*i+1] );
+      lm_aabb_grow( &box[i], v[3*i+2] );
+    }
+    ok = lm_bvh_build_boxes( bvh, box, ntri );
+    free( box );
+  }
+
+  // triangle records in leaf order so a leaf is one contiguous run
+  if( ok ) {
+    bvh->tri = (lm_tri *) aligned_alloc( 64, (ntri > 0 ? ntri : 1) * sizeof(lm_tri) );
+    ok = (bvh->tri != NULL);
+  }
+  if( !ok ) {
+    lm_bvh_free( bvh );
+    return 0;
+  }
+
+  for( i=0; i<ntri; i++ ) {
+    int j = bvh->index[i];
+    lm_tri_build( &bvh->tri[i], v[3*j], v[3*j+1], v[3*j+2] );
+  }
+  return 1;
+}
+
+// closest hit along r in [0, tmax), returns 1 and fills hit on a hit
+int lm_bvh_intersect( const lm_bvh *bvh, const lm_ray *r, float tmax, lm_hit *hit ) {
+  const lm_bvh_node *stack[LM_BVH_STACK];
+  float stack_t[LM_BVH_STACK];
+  int sp = 0, i;
+  float tn, tf, tn1, tf1, t, beta, gamma;
+
+  hit->t   = tmax;
+  hit->tri = -1;
+
+  if( bvh->root == NULL || !lm_ray_slab( r, bvh->root->box.lo, bvh->root->box.hi, tmax, &tn, &tf )) {
+    return 0;
+  }
+
+  stack[sp] = bvh->root;
+  stack_t[sp++] = tn;
+
+  while( sp > 0 ) {
+    const lm_bvh_node *node = stack[--sp];
+    LM_BVH_VISIT();
+
+    // a closer hit may have been found since this node was pushed
+    if( stack_t[sp] >= hit->t ) {
+      continue;
+    }
+
+    if( node->left == NULL ) {
+      for( i=node->first; i<node->first+node->count; i++ ) {
+        if( lm_ray_tri_early( r, &bvh->tri[i], hit->t, &beta, &gamma, &t )) {
+          hit->t     = t;
+          hit->beta  = beta;
+          hit->gamma = gamma;
+          hit->tri   = bvh->index[i];
+          hit->rec   = i;
+        }
+      }
+      continue;
+    }
+
+    int hl = lm_ray_slab( r, node->left->box.lo, node->left->box.hi, hit->t, &tn, &tf );
+    int hr = lm_ray_slab( r, node->right->box.lo, node->right->box.hi, hit->t, &tn1, &tf1 );
+
+    // push the far child first so the near one is popped next
+    if( hl && hr ) {
+      if( tn <= tn1 ) {
+        stack[sp] = node->right; stack_t[sp++] = tn1;
+        stack[sp] = node->left;  stack_t[sp++] = tn;
+      } else {
+        stack[sp] = node->left;  stack_t[sp++] = tn;
+        stack[sp] = node->right; stack_t[sp++] = tn1;
+      }
+    } else if( hl ) {
+      stack[sp] = node->left;  stack_t[sp++] = tn;
+    } else if( hr ) {
+      stack[sp] = node->right; stack_t[sp++] = tn1;
+    }
+  }
+
+  return (hit->tri >= 0) ? 1 : 0;
+}
+
+//
+// Flattened hierarchy -=:LogicMonkey:=-
+//
+// The pointer tree above is easy to build but traversal chases a pointer per
+// node. Flattened, the nodes sit in one 64 byte aligned array in depth first
+// order, so a node's left child is always the next node and only the right
+// child needs storing. Each node is 32 bytes - two to a cache line:
+//
+//   lo, hi    bounds               24 bytes
+//   offset    right child index     4 bytes  (first triangle for a leaf)
+//   count     leaf triangles        4 bytes  (0 for an interior node)
+//
+typedef struct {
+  vec3 lo, hi;
+  int offset;
+  int count;
+} lm_bvh_flat_node;
+
+typedef struct {
+  lm_bvh_flat_node *node;
+  lm_tri *tri;        // triangle records in leaf order
+  int *index;         // soup index of each record
+  int nodes;
+  int ntri;
+} lm_bvh_flat;
+
+int lm_bvh_flatten_node( lm_bvh_flat *flat, const lm_bvh_node *node, int *next ) {
+  int i = (*next)++;
+
+  flat->node[i].lo = node->box.lo;
+  flat->node[i].hi = node->box.hi;
+
+  if( node->left == NULL ) {
+    flat->node[i].offset = node->first;
+    flat->node[i].count  = node->count;
+  } else {
+    lm_bvh_flatten_node( flat, node->left, next );   // lands at i + 1
+    flat->node[i].offset = lm_bvh_flatten_node( flat, node->right, next );
+    flat->node[i].count  = 0;
+  }
+  return i;
+}
+
+void lm_bvh_flat_free( lm_bvh_flat *flat ) {
+  free( flat->node );
+  free( flat->tri );
+  free( flat->index );
+  flat->node  = NULL;
+  flat->tri   = NULL;
+  flat->index = NULL;
+}
+
+// flatten a built tree - the triangle records are copied so the pointer tree
+// can be freed afterwards. Returns 0 on allocation failure.
+int lm_bvh_flatten( lm_bvh_flat *flat, const lm_bvh *bvh ) {
+  int next = 0;
+  int n = (bvh->ntri > 0) ? bvh->ntri : 1;
+
+  flat->nodes = bvh->nodes;
+  flat->ntri  = bvh->ntri;
+  flat->node  = (lm_bvh_flat_node *) aligned_alloc( 64, ((bvh->nodes * sizeof(lm_bvh_flat_node) + 63) & ~63) );
+  flat->tri   = NULL;
+  flat->index = (int *) malloc( n * sizeof(int) );
+
+  // a box only hierarchy has no triangle records to copy
+  if( bvh->tri != NULL ) {
+    flat->tri = (lm_tri *) aligned_alloc( 64, n * sizeof(lm_tri) );
+  }
+
+  if( flat->node == NULL || flat->index == NULL || (bvh->tri != NULL && flat->tri == NULL) ) {
+    lm_bvh_flat_free( flat );
+    return 0;
+  }
+
+  if( bvh->tri != NULL ) {
+    memcpy( flat->tri, bvh->tri, bvh->ntri * sizeof(lm_tri) );
+  }
+  memcpy( flat->index, bvh->index, bvh->ntri * sizeof(int) );
+  lm_bvh_flatten_node( flat, bvh->root, &next );
+  return 1;
+}
+
+// closest hit along r in [0, tmax) - lm_bvh_intersect over the flat array
+int lm_bvh_flat_intersect( const lm_bvh_flat *flat, const lm_ray *r, float tmax, lm_hit *hit ) {
+  int   stack[LM_BVH_STACK];
+  float stack_t[LM_BVH_STACK];
+  int sp = 0, i, n, left, right;
+  float tn, tf, tn1, tf1, t, beta, gamma;
+  const lm_bvh_flat_node *node = flat->node;
+
+  hit->t   = tmax;
+  hit->tri = -1;
+
+  if( flat->ntri == 0 || !lm_ray_slab( r, node[0].lo, node[0].hi, tmax, &tn, &tf )) {
+    return 0;
+  }
+
+  stack[sp] = 0;
+  stack_t[sp++] = tn;
+
+  while( sp > 0 ) {
+    n = stack[--sp];
+    LM_BVH_VISIT();
+
+    if( stack_t[sp] >= hit->t ) {
+      continue;
+    }
+
+    if( node[n].count > 0 ) {
+      for( i=node[n].offset; i<node[n].offset+node[n].count; i++ ) {
+        if( lm_ray_tri_early( r, &flat->tri[i], hit->t, &beta, &gamma, &t )) {
+          hit->t     = t;
+          hit->beta  = beta;
+          hit->gamma = gamma;
+          hit->tri   = flat->index[i];
+          hit->rec   = i;
+        }
+      }
+      continue;
+    }
+
+    left  = n + 1;
+    right = node[n].offset;
+
+    int hl = lm_ray_slab( r, node[left].lo, node[left].hi, hit->t, &tn, &tf );
+    int hr = lm_ray_slab( r, node[right].lo, node[right].hi, hit->t, &tn1, &tf1 );
+
+    if( hl && hr ) {
+      if( tn <= tn1 ) {
+        stack[sp] = right; stack_t[sp++] = tn1;
+        stack[sp] = left;  stack_t[sp++] = tn;
+      } else {
+        stack[sp] = left;  stack_t[sp++] = tn;
+        stack[sp] = right; stack_t[sp++] = tn1;
+      }
+    } else if( hl ) {
+      stack[sp] = left;  stack_t[sp++] = tn;
+    } else if( hr ) {
+      stack[sp] = right; stack_t[sp++] = tn1;
+    }
+  }
+
+  return (hit->tri >= 0) ? 1 : 0;
+}
+
+#endif
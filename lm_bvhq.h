@@ -0,0 +1,302 @@
+// Quantised wide BVH -=:LogicMonkey:=-
+//
+// A big scene's lm_bvhw_node array outgrows the caches and traversal ends up
+// waiting on memory, most of which is child bounds - 24 bytes of float per
+// child. Here each child box is 6 bytes, offsets on a per node grid:
+//
+//   lo = origin + q_lo.2^ex     hi = origin + q_hi.2^ex     (per axis)
+//
+// origin is the node's lower corner and ex the smallest exponent that spans
+// the node in 255 steps. Scales are powers of two so q.2^ex is exact, and the
+// builder rounds q_lo down and q_hi up until the decoded box - worked out with
+// the same float sums the traversal uses - encloses the child. A decoded box
+// is never smaller than the real one, so no hit is lost, it can only let a few
+// extra rays through to the children.
+//
+// The children of a node are laid out together, and so are the triangles of
+// its leaves, so one base index of each plus a byte offset per child replaces
+// the 4 byte child and count fields. Nodes decode to float rows in SIMD and go
+// through lm_bvhw_slab_rows, the lm_ray_slab test used by lm_bvhw.
+//
+//   LM_BVHW 4   lm_bvhw_node 128 bytes    lm_bvhq_node 64 bytes
+//   LM_BVHW 8   lm_bvhw_node 256 bytes    lm_bvhq_node 96 bytes
+//
+#ifndef LM_BVHQ_H
+#define LM_BVHQ_H
+
+#include "lm_bvhw.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#define LM_BVHQ_EMPTY 255
+
+typedef struct {
+  float origin[3];
+  signed char ex[3];                // child grid step 2^ex on each axis
+  unsigned char pad;
+  int child;                        // first interior child, the rest follow
+  int tri;                          // first triangle of the node's leaves
+  unsigned char count[LM_BVHW];     // leaf triangles, 0 interior, LM_BVHQ_EMPTY unused
+  unsigned char off[LM_BVHW];       // offset from child (interior) or tri (leaf)
+  unsigned char q[6][LM_BVHW];      // lo x,y,z, hi x,y,z grid steps
+} __attribute__((aligned(16))) lm_bvhq_node;
+
+typedef struct {
+  lm_bvhq_node *node;
+  lm_tri *tri;        // triangle records, each node's leaves together
+  int *index;         // soup index of each record
+  int nodes;
+  int ntri;
+} lm_bvhq;
+
+float lm_bvhq_pow2( int ex ) {
+  flong s;
+  s.l = (long) (ex + 127) << 23;
+  return s.f;
+}
+
+// quantise the used children of a wide node onto out's grid
+void lm_bvhq_quantise( lm_bvhq_node *out, const lm_bvhw_node *in, int used ) {
+  int a, i, e, ok;
+  float lo, hi, step, clo, chi;
+  int ql, qh;
+
+  for( a=0; a<3; a++ ) {
+    lo =  INFINITY;
+    hi = -INFINITY;
+    for( i=0; i<used; i++ ) {
+      lo = MIN( lo, in->b[a][i] );
+      hi = MAX( hi, in->b[a+3][i] );
+    }
+
+    // 255 steps of 2^e cover the node, then widen if rounding says not
+    frexpf( (hi - lo) / 255.0f, &e );
+    e = MAX( e, -126 );
+    do {
+      ok = 1;
+      step = lm_bvhq_pow2( e );
+      for( i=0; i<used && ok; i++ ) {
+        clo = in->b[a][i];
+        chi = in->b[a+3][i];
+
+        ql = (int) floorf( (clo - lo) / step );
+        ql = MIN( MAX( ql, 0 ), 255 );
+        while( ql > 0 && lo + ql * step > clo ) {
+          ql--;
+        }
+
+        qh = (int) ceilf( (chi - lo) / step );
+        qh = MIN( MAX( qh, 0 ), 256 );
+        while( qh < 256 && lo + qh * step < chi ) {
+          qh++;
+        }
+
+        if( qh > 255 ) {
+          ok = 0;
+        } else {
+          out->q[a][i]   = ql;
+          out->q[a+3][i] = qh;
+        }
+      }
+      e += !ok;
+    } while( !ok && e < 127 );
+
+    out->origin[a] = lo;
+    out->ex[a] = e;
+  }
+
+  for( i=used; i<LM_BVHW; i++ ) {
+    for( a=0; a<6; a++ ) {
+      out->q[a][i] = 0;
+    }
+  }
+}
+
+typedef struct {
+  const lm_bvhw *w;
+  lm_bvhq *q;
+  int next_node, next_tri;
+} lm_bvhq_ctx;
+
+int lm_bvhq_emit( lm_bvhq_ctx *ctx, int wn, int qn ) {
+  const lm_bvhw_node *in = &ctx->w->node[wn];
+  lm_bvhq_node *out = &ctx->q->node[qn];
+  int i, k = 0, used = 0, count;
+
+  out->pad = 0;
+  out->child = ctx->next_node;
+  out->tri   = ctx->next_tri;
+
+  // slots are filled from the front, interior children get consecutive nodes
+  // and leaf triangles are copied next to each other
+  for( i=0; i<LM_BVHW; i++ ) {
+    count = in->count[i];
+    if( count == LM_BVHW_EMPTY ) {
+      out->count[i] = LM_BVHQ_EMPTY;
+      out->off[i] = 0;
+    } else if( count == 0 ) {
+      out->count[i] = 0;
+      out->off[i] = k++;
+      used = i + 1;
+    } else {
+      if( count >= LM_BVHQ_EMPTY || ctx->next_tri - out->tri > 255 ) {
+        return 0;
+      }
+      out->count[i] = count;
+      out->off[i] = ctx->next_tri - out->tri;
+      memcpy( &ctx->q->tri[ctx->next_tri], &ctx->w->tri[in->child[i]], count * sizeof(lm_tri) );
+      memcpy( &ctx->q->index[ctx->next_tri], &ctx->w->index[in->child[i]], count * sizeof(int) );
+      ctx->next_tri += count;
+      used = i + 1;
+    }
+  }
+  ctx->next_node += k;
+
+  lm_bvhq_quantise( out, in, used );
+
+  for( i=0; i<LM_BVHW; i++ ) {
+    if( in->count[i] == 0 && !lm_bvhq_emit( ctx, in->child[i], out->child + out->off[i] )) {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+void lm_bvhq_free( lm_bvhq *q ) {
+  free( q->node );
+  free( q->tri );
+  free( q->index );
+  q->node  = NULL;
+  q->tri   = NULL;
+  q->index = NULL;
+}
+
+// quantise a wide tree, which can be freed afterwards. Returns 0 on allocation
+// failure, or if a leaf run is too long for a byte offset - only possible
+// where the SAH build hit LM_BVH_DEPTH.
+int lm_bvhq_build( lm_bvhq *q, const lm_bvhw *w ) {
+  lm_bvhq_ctx ctx;
+  int n = (w->ntri > 0) ? w->ntri : 1;
+
+  q->nodes = w->nodes;
+  q->ntri  = w->ntri;
+  q->node  = (lm_bvhq_node *) aligned_alloc( 64, ((w->nodes * sizeof(lm_bvhq_node) + 63) & ~63) );
+  q->tri   = (lm_tri *) aligned_alloc( 64, n * sizeof(lm_tri) );
+  q->index = (int *) malloc( n * sizeof(int) );
+
+  if( q->node == NULL || q->tri == NULL || q->index == NULL ) {
+    lm_bvhq_free( q );
+    return 0;
+  }
+
+  ctx.w = w;
+  ctx.q = q;
+  ctx.next_node = 1;
+  ctx.next_tri  = 0;
+  if( w->ntri > 0 && !lm_bvhq_emit( &ctx, 0, 0 )) {
+    lm_bvhq_free( q );
+    return 0;
+  }
+  return 1;
+}
+
+// decode a node's child boxes to float rows
+void lm_bvhq_decode( const lm_bvhq_node *n, float (*b)[LM_BVHW] ) {
+  int row, a;
+#if defined(LM_BVHW_VF) && defined(__SSE2__)
+  __m128i zero = _mm_setzero_si128();
+  for( row=0; row<6; row++ ) {
+    a = (row < 3) ? row : row - 3;
+#if LM_BVHW == 8
+    __m128i w = _mm_unpacklo_epi8( _mm_loadl_epi64( (const __m128i *) n->q[row] ), zero );
+    LM_BVHW_VF f = _mm256_insertf128_ps( _mm256_castps128_ps256( _mm_cvtepi32_ps( _mm_unpacklo_epi16( w, zero ))),
+                                         _mm_cvtepi32_ps( _mm_unpackhi_epi16( w, zero )), 1 );
+#else
+    int bytes;
+    memcpy( &bytes, n->q[row], 4 );
+    LM_BVHW_VF f = _mm_cvtepi32_ps( _mm_unpacklo_epi16( _mm_unpacklo_epi8( _mm_cvtsi32_si128( bytes ), zero ), zero ));
+#endif
+    f = LM_BVHW_VMUL( f, LM_BVHW_VSET1( lm_bvhq_pow2( n->ex[a] )));
+    LM_BVHW_VSTORE( b[row], LM_BVHW_VADD( LM_BVHW_VSET1( n->origin[a] ), f ));
+  }
+#else
+  int i;
+  for( row=0; row<6; row++ ) {
+    a = (row < 3) ? row : row - 3;
+    for( i=0; i<LM_BVHW; i++ ) {
+      b[row][i] = n->origin[a] + n->q[row][i] * lm_bvhq_pow2( n->ex[a] );
+    }
+  }
+#endif
+}
+
+// closest hit along r in [0, tmax)
+int lm_bvhq_intersect( const lm_bvhq *q, const lm_ray *r, float tmax, lm_hit *hit ) {
+  int   stack[LM_BVH_STACK * LM_BVHW];
+  float stack_t[LM_BVH_STACK * LM_BVHW];
+  float b[6][LM_BVHW] __attribute__((aligned(32)));
+  float tnear[LM_BVHW] __attribute__((aligned(32)));
+  int   near_i[LM_BVHW];
+  int sp = 0, mask, i, j, k, n, first;
+  float t, beta, gamma;
+
+  hit->t   = tmax;
+  hit->tri = -1;
+
+  if( q->ntri == 0 ) {
+    return 0;
+  }
+
+  stack[sp] = 0;
+  stack_t[sp++] = 0.0f;
+
+  while( sp > 0 ) {
+    n = stack[--sp];
+    LM_BVH_VISIT();
+
+    if( stack_t[sp] >= hit->t ) {
+      continue;
+    }
+
+    const lm_bvhq_node *node = &q->node[n];
+    lm_bvhq_decode( node, b );
+    mask = lm_bvhw_slab_rows( (const float (*)[LM_BVHW]) b, r, hit->t, tnear );
+
+    k = 0;
+    for( i=0; i<LM_BVHW; i++ ) {
+      if( !((mask >> i) & 1) || node->count[i] == LM_BVHQ_EMPTY ) {
+        continue;
+      }
+      if( node->count[i] > 0 ) {
+        first = node->tri + node->off[i];
+        for( j=first; j<first+node->count[i]; j++ ) {
+          if( lm_ray_tri_early( r, &q->tri[j], hit->t, &beta, &gamma, &t )) {
+            hit->t     = t;
+            hit->beta  = beta;
+            hit->gamma = gamma;
+            hit->tri   = q->index[j];
+            hit->rec   = j;
+          }
+        }
+      } else {
+        for( j=k++; j>0 && tnear[near_i[j-1]] < tnear[i]; j-- ) {
+          near_i[j] = near_i[j-1];
+        }
+        near_i[j] = i;
+      }
+    }
+
+    for( j=0; j<k; j++ ) {
+      if( tnear[near_i[j]] < hit->t ) {
+        stack[sp] = node->child + node->off[near_i[j]];
+        stack_t[sp++] = tnear[near_i[j]];
+      }
+    }
+  }
+
+  return (hit->tri >= 0) ? 1 : 0;
+}
+
+#endif
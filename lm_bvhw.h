@@ -0,0 +1,498 @@
+// Wide bounding volume hierarchy -=:LogicMonkey:=-
+//
+// A binary lm_bvh collapsed so that each node holds LM_BVHW children (4 with
+// SSE, 8 with AVX). Child bounds are stored structure-of-arrays, lo x,y,z
+// then hi x,y,z, each row LM_BVHW floats wide, so one SIMD pass classifies
+// every child of a node. That halves (or thirds) the tree depth and the
+// number of nodes fetched per ray, which is what matters for incoherent rays.
+//
+// Two child tests are provided:
+//
+//   lm_bvhw_slab     lm_ray_slab across all children, giving entry
+//                    distances for nearest first closest hit traversal
+//
+//   lm_bvhw_plucker  the six edge silhouette Plücker test across all
+//                    children. The octant is fixed per ray, so which six
+//                    edges and which of lo/hi they use is worked out once in
+//                    lm_bvhw_plk_init and reused for every node. It sees
+//                    only the line, so the any hit lm_bvhw_occluded ANDs it
+//                    with the slab mask to keep to [0, tmax).
+//
+#ifndef LM_BVHW_H
+#define LM_BVHW_H
+
+#include "lm_bvh.h"
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#elif defined(__SSE__)
+#include <xmmintrin.h>
+#endif
+
+#ifndef LM_BVHW
+#if defined(__AVX__)
+#define LM_BVHW 8
+#else
+#define LM_BVHW 4
+#endif
+#endif
+
+#define LM_BVHW_EMPTY -1
+
+typedef struct {
+  float b[6][LM_BVHW];      // lo x,y,z, hi x,y,z of each child
+  int   child[LM_BVHW];     // node index, or first triangle of a leaf
+  int   count[LM_BVHW];     // leaf triangles, 0 interior, LM_BVHW_EMPTY unused
+} __attribute__((aligned(64))) lm_bvhw_node;
+
+typedef struct {
+  lm_bvhw_node *node;
+  lm_tri *tri;        // triangle records in leaf order
+  int *index;         // soup index of each record
+  int nodes;
+  int ntri;
+} lm_bvhw;
+
+// six silhouette edges of a ray: edge k is
+//   a[k] * b[ia[k]] + c[k] * b[ic[k]] + d[k] < 0
+// over the node's bound rows
+typedef struct {
+  float a[6], c[6], d[6];
+  int ia[6], ic[6];
+} lm_bvhw_plk;
+
+// bounds rows
+#define LM_BVHW_LO_X 0
+#define LM_BVHW_LO_Y 1
+#define LM_BVHW_LO_Z 2
+#define LM_BVHW_HI_X 3
+#define LM_BVHW_HI_Y 4
+#define LM_BVHW_HI_Z 5
+
+void lm_bvhw_plk_edge( lm_bvhw_plk *p, int k, float a, int ia, float c, int ic, float d ) {
+  p->a[k] = a; p->ia[k] = ia;
+  p->c[k] = c; p->ic[k] = ic;
+  p->d[k] = d;
+}
+
+//
+// Pick the silhouette edges for the ray's octant. With v0 = hi and v7 = lo
+// the vertices of lm_plucker_silhouette are
+//
+//   v0 hx hy hz   v1 hx ly hz   v2 lx ly hz   v3 lx hy hz
+//   v4 hx ly lz   v5 hx hy lz   v6 lx hy lz   v7 lx ly lz
+//
+// and the cases below are its three pairs written out on the bound rows.
+//
+void lm_bvhw_plk_init( lm_bvhw_plk *p, const lm_ray *r ) {
+  float r0 = r->p[0], r1 = r->p[1], r2 = r->p[2];
+  float r3 = r->p[3], r4 = r->p[4], r5 = r->p[5];
+  int cx = r->sign & 1, cy = (r->sign >> 1) & 1, cz = (r->sign >> 2) & 1;
+
+  // x,y pair - z edges
+  if( cx && cy ) {
+    lm_bvhw_plk_edge( p, 0, -r2, LM_BVHW_LO_Y, -r5, LM_BVHW_HI_X,  r0 );    // t14
+    lm_bvhw_plk_edge( p, 1, -r2, LM_BVHW_HI_Y, -r5, LM_BVHW_LO_X,  r0 );    // t36
+  } else if( cx ) {
+    lm_bvhw_plk_edge( p, 0,  r2, LM_BVHW_HI_Y,  r5, LM_BVHW_HI_X, -r0 );    // t50
+    lm_bvhw_plk_edge( p, 1,  r2, LM_BVHW_LO_Y,  r5, LM_BVHW_LO_X, -r0 );    // t72
+  } else if( cy ) {
+    lm_bvhw_plk_edge( p, 0,  r2, LM_BVHW_LO_Y,  r5, LM_BVHW_LO_X, -r0 );    // t72
+    lm_bvhw_plk_edge( p, 1,  r2, LM_BVHW_HI_Y,  r5, LM_BVHW_HI_X, -r0 );    // t50
+  } else {
+    lm_bvhw_plk_edge( p, 0, -r2, LM_BVHW_HI_Y, -r5, LM_BVHW_LO_X,  r0 );    // t36
+    lm_bvhw_plk_edge( p, 1, -r2, LM_BVHW_LO_Y, -r5, LM_BVHW_HI_X,  r0 );    // t14
+  }
+
+  // x,z pair - y edges
+  if( cx && cz ) {
+    lm_bvhw_plk_edge( p, 2, -r2, LM_BVHW_LO_Z,  r4, LM_BVHW_HI_X,  r1 );    // t45
+    lm_bvhw_plk_edge( p, 3, -r2, LM_BVHW_HI_Z,  r4, LM_BVHW_LO_X,  r1 );    // t23
+  } else if( cx ) {
+    lm_bvhw_plk_edge( p, 2,  r2, LM_BVHW_HI_Z, -r4, LM_BVHW_HI_X, -r1 );    // t01
+    lm_bvhw_plk_edge( p, 3,  r2, LM_BVHW_LO_Z, -r4, LM_BVHW_LO_X, -r1 );    // t67
+  } else if( cz ) {
+    lm_bvhw_plk_edge( p, 2,  r2, LM_BVHW_LO_Z, -r4, LM_BVHW_LO_X, -r1 );    // t67
+    lm_bvhw_plk_edge( p, 3,  r2, LM_BVHW_HI_Z, -r4, LM_BVHW_HI_X, -r1 );    // t01
+  } else {
+    lm_bvhw_plk_edge( p, 2, -r2, LM_BVHW_HI_Z,  r4, LM_BVHW_LO_X,  r1 );    // t23
+    lm_bvhw_plk_edge( p, 3, -r2, LM_BVHW_LO_Z,  r4, LM_BVHW_HI_X,  r1 );    // t45
+  }
+
+  // y,z pair - x edges
+  if( cy && cz ) {
+    lm_bvhw_plk_edge( p, 4,  r5, LM_BVHW_LO_Z,  r4, LM_BVHW_HI_Y,  r3 );    // t56
+    lm_bvhw_plk_edge( p, 5,  r5, LM_BVHW_HI_Z,  r4, LM_BVHW_LO_Y,  r3 );    // t12
+  } else if( cy ) {
+    lm_bvhw_plk_edge( p, 4, -r5, LM_BVHW_HI_Z, -r4, LM_BVHW_HI_Y, -r3 );    // t30
+    lm_bvhw_plk_edge( p, 5, -r5, LM_BVHW_LO_Z, -r4, LM_BVHW_LO_Y, -r3 );    // t74
+  } else if( cz ) {
+    lm_bvhw_plk_edge( p, 4, -r5, LM_BVHW_LO_Z, -r4, LM_BVHW_LO_Y, -r3 );    // t74
+    lm_bvhw_plk_edge( p, 5, -r5, LM_BVHW_HI_Z, -r4, LM_BVHW_HI_Y, -r3 );    // t30
+  } else {
+    lm_bvhw_plk_edge( p, 4,  r5, LM_BVHW_HI_Z,  r4, LM_BVHW_LO_Y,  r3 );    // t12
+    lm_bvhw_plk_edge( p, 5,  r5, LM_BVHW_LO_Z,  r4, LM_BVHW_HI_Y,  r3 );    // t56
+  }
+
+  // axis parallel rays - borrow another pair as lm_plucker_silhouette does
+  if( r2 == 0.0f && r5 == 0.0f ) {
+    lm_bvhw_plk_edge( p, 0, p->a[2], p->ia[2], p->c[2], p->ic[2], p->d[2] );
+    lm_bvhw_plk_edge( p, 1, p->a[3], p->ia[3], p->c[3], p->ic[3], p->d[3] );
+  }
+  if( r2 == 0.0f && r4 == 0.0f ) {
+    lm_bvhw_plk_edge( p, 2, p->a[4], p->ia[4], p->c[4], p->ic[4], p->d[4] );
+    lm_bvhw_plk_edge( p, 3, p->a[5], p->ia[5], p->c[5], p->ic[5], p->d[5] );
+  }
+  if( r5 == 0.0f && r4 == 0.0f ) {
+    lm_bvhw_plk_edge( p, 4, p->a[0], p->ia[0], p->c[0], p->ic[0], p->d[0] );
+    lm_bvhw_plk_edge( p, 5, p->a[1], p->ia[1], p->c[1], p->ic[1], p->d[1] );
+  }
+}
+
+#if defined(__AVX__) && LM_BVHW == 8
+#define LM_BVHW_VF           __m256
+#define LM_BVHW_VLOAD        _mm256_load_ps
+#define LM_BVHW_VSTORE       _mm256_store_ps
+#define LM_BVHW_VSET1        _mm256_set1_ps
+#define LM_BVHW_VADD         _mm256_add_ps
+#define LM_BVHW_VSUB         _mm256_sub_ps
+#define LM_BVHW_VMUL         _mm256_mul_ps
+#define LM_BVHW_VMIN         _mm256_min_ps
+#define LM_BVHW_VMAX         _mm256_max_ps
+#define LM_BVHW_VAND         _mm256_and_ps
+#define LM_BVHW_VANDNOT      _mm256_andnot_ps
+#define LM_BVHW_VOR          _mm256_or_ps
+#define LM_BVHW_VLE(a,b)     _mm256_cmp_ps( a, b, _CMP_LE_OQ )
+#define LM_BVHW_VLT(a,b)     _mm256_cmp_ps( a, b, _CMP_LT_OQ )
+#define LM_BVHW_VMASK        _mm256_movemask_ps
+#elif defined(__SSE__) && LM_BVHW == 4
+#define LM_BVHW_VF           __m128
+#define LM_BVHW_VLOAD        _mm_load_ps
+#define LM_BVHW_VSTORE       _mm_store_ps
+#define LM_BVHW_VSET1        _mm_set1_ps
+#define LM_BVHW_VADD         _mm_add_ps
+#define LM_BVHW_VSUB         _mm_sub_ps
+#define LM_BVHW_VMUL         _mm_mul_ps
+#define LM_BVHW_VMIN         _mm_min_ps
+#define LM_BVHW_VMAX         _mm_max_ps
+#define LM_BVHW_VAND         _mm_and_ps
+#define LM_BVHW_VANDNOT      _mm_andnot_ps
+#define LM_BVHW_VOR          _mm_or_ps
+#define LM_BVHW_VLE(a,b)     _mm_cmple_ps( a, b )
+#define LM_BVHW_VLT(a,b)     _mm_cmplt_ps( a, b )
+#define LM_BVHW_VMASK        _mm_movemask_ps
+#endif
+
+// lm_ray_slab on LM_BVHW boxes held as bound rows, a mask of the boxes the ray
+// meets in [0, tmax) with their entry distances
+int lm_bvhw_slab_rows( const float (*b)[LM_BVHW], const lm_ray *r, float tmax, float *tnear ) {
+  int mask = 0;
+#ifdef LM_BVHW_VF
+  // same operand order as lm_ray_slab, the SSE/AVX min and max treat a NaN
+  // the same way the MIN and MAX macros do
+  LM_BVHW_VF ox = LM_BVHW_VSET1( r->o.x ), ix = LM_BVHW_VSET1( r->inv.x );
+  LM_BVHW_VF oy = LM_BVHW_VSET1( r->o.y ), iy = LM_BVHW_VSET1( r->inv.y );
+  LM_BVHW_VF oz = LM_BVHW_VSET1( r->o.z ), iz = LM_BVHW_VSET1( r->inv.z );
+  LM_BVHW_VF t0x = LM_BVHW_VMUL( LM_BVHW_VSUB( LM_BVHW_VLOAD( b[LM_BVHW_LO_X] ), ox ), ix );
+  LM_BVHW_VF t0y = LM_BVHW_VMUL( LM_BVHW_VSUB( LM_BVHW_VLOAD( b[LM_BVHW_LO_Y] ), oy ), iy );
+  LM_BVHW_VF t0z = LM_BVHW_VMUL( LM_BVHW_VSUB( LM_BVHW_VLOAD( b[LM_BVHW_LO_Z] ), oz ), iz );
+  LM_BVHW_VF t1x = LM_BVHW_VMUL( LM_BVHW_VSUB( LM_BVHW_VLOAD( b[LM_BVHW_HI_X] ), ox ), ix );
+  LM_BVHW_VF t1y = LM_BVHW_VMUL( LM_BVHW_VSUB( LM_BVHW_VLOAD( b[LM_BVHW_HI_Y] ), oy ), iy );
+  LM_BVHW_VF t1z = LM_BVHW_VMUL( LM_BVHW_VSUB( LM_BVHW_VLOAD( b[LM_BVHW_HI_Z] ), oz ), iz );
+
+  LM_BVHW_VF tn = LM_BVHW_VMAX( LM_BVHW_VMIN( t0x, t1x ),
+                                LM_BVHW_VMAX( LM_BVHW_VMIN( t0y, t1y ), LM_BVHW_VMIN( t0z, t1z )));
+  LM_BVHW_VF tf = LM_BVHW_VMIN( LM_BVHW_VMAX( t0x, t1x ),
+                                LM_BVHW_VMIN( LM_BVHW_VMAX( t0y, t1y ), LM_BVHW_VMAX( t0z, t1z )));
+
+  LM_BVHW_VSTORE( tnear, tn );
+  tn   = LM_BVHW_VMAX( tn, LM_BVHW_VSET1( 0.0f ));
+  tf   = LM_BVHW_VMIN( tf, LM_BVHW_VSET1( tmax ));
+  mask = LM_BVHW_VMASK( LM_BVHW_VLE( tn, tf ));
+#else
+  int i;
+  float tf;
+  vec3 lo, hi;
+  for( i=0; i<LM_BVHW; i++ ) {
+    lo.x = b[LM_BVHW_LO_X][i]; lo.y = b[LM_BVHW_LO_Y][i]; lo.z = b[LM_BVHW_LO_Z][i];
+    hi.x = b[LM_BVHW_HI_X][i]; hi.y = b[LM_BVHW_HI_Y][i]; hi.z = b[LM_BVHW_HI_Z][i];
+    mask |= lm_ray_slab( r, lo, hi, tmax, &tnear[i], &tf ) << i;
+  }
+#endif
+  return mask;
+}
+
+// mask of children whose box the ray meets in [0, tmax), with entry distances
+int lm_bvhw_slab( const lm_bvhw_node *n, const lm_ray *r, float tmax, float *tnear ) {
+  int mask = lm_bvhw_slab_rows( n->b, r, tmax, tnear ), i;
+
+  // drop the unused slots
+  for( i=0; i<LM_BVHW; i++ ) {
+    if( n->count[i] == LM_BVHW_EMPTY ) {
+      mask &= ~(1 << i);
+    }
+  }
+  return mask;
+}
+
+// mask of children whose box the ray's line passes through
+int lm_bvhw_plucker( const lm_bvhw_node *n, const lm_bvhw_plk *p ) {
+  int mask = 0, i;
+#ifdef LM_BVHW_VF
+  LM_BVHW_VF s[6];
+  LM_BVHW_VF zero = LM_BVHW_VSET1( 0.0f );
+  for( i=0; i<6; i++ ) {
+    s[i] = LM_BVHW_VADD( LM_BVHW_VMUL( LM_BVHW_VSET1( p->a[i] ), LM_BVHW_VLOAD( n->b[p->ia[i]] )),
+                         LM_BVHW_VMUL( LM_BVHW_VSET1( p->c[i] ), LM_BVHW_VLOAD( n->b[p->ic[i]] )));
+    s[i] = LM_BVHW_VLT( LM_BVHW_VADD( s[i], LM_BVHW_VSET1( p->d[i] )), zero );
+  }
+  // ~s0 & s1 & ~s2 & s3 & ~s4 & s5  |  s0 & ~s1 & s2 & ~s3 & s4 & ~s5
+  LM_BVHW_VF a = LM_BVHW_VAND( s[1], LM_BVHW_VAND( s[3], s[5] ));
+  LM_BVHW_VF b = LM_BVHW_VAND( s[0], LM_BVHW_VAND( s[2], s[4] ));
+  a = LM_BVHW_VANDNOT( s[0], LM_BVHW_VANDNOT( s[2], LM_BVHW_VANDNOT( s[4], a )));
+  b = LM_BVHW_VANDNOT( s[1], LM_BVHW_VANDNOT( s[3], LM_BVHW_VANDNOT( s[5], b )));
+  mask = LM_BVHW_VMASK( LM_BVHW_VOR( a, b ));
+#else
+  int k, s[6];
+  for( i=0; i<LM_BVHW; i++ ) {
+    for( k=0; k<6; k++ ) {
+      s[k] = ( p->a[k]*n->b[p->ia[k]][i] + p->c[k]*n->b[p->ic[k]][i] + p->d[k] ) < 0 ? 1 : 0;
+    }
+    mask |= ((( ~s[0] &  s[1] & ~s[2] &  s[3] & ~s[4] &  s[5] ) |
+              (  s[0] & ~s[1] &  s[2] & ~s[3] &  s[4] & ~s[5] )) & 1) << i;
+  }
+#endif
+  for( i=0; i<LM_BVHW; i++ ) {
+    if( n->count[i] == LM_BVHW_EMPTY ) {
+      mask &= ~(1 << i);
+    }
+  }
+  return mask;
+}
+
+float lm_bvh_node_area( const lm_bvh_node *n ) {
+  return lm_aabb_area( &n->box );
+}
+
+int lm_bvhw_collapse_node( lm_bvhw *w, const lm_bvh_node *bin, int *next ) {
+  const lm_bvh_node *slot[LM_BVHW];
+  int used, i, j, open;
+  int n = (*next)++;
+  lm_bvhw_node *node = &w->node[n];
+
+  // start with the two children and keep opening the biggest interior one
+  // until the node is full
+  if( bin->left == NULL ) {
+    slot[0] = bin;
+    used = 1;
+  } else {
+    slot[0] = bin->left;
+    slot[1] = bin->right;
+    used = 2;
+  }
+
+  while( used < LM_BVHW ) {
+    open = -1;
+    for( i=0; i<used; i++ ) {
+      if( slot[i]->left != NULL && (open < 0 || lm_bvh_node_area( slot[i] ) > lm_bvh_node_area( slot[open] ))) {
+        open = i;
+      }
+    }
+    if( open < 0 ) {
+      break;
+    }
+    slot[used++] = slot[open]->right;
+    slot[open]   = slot[open]->left;
+  }
+
+  for( i=0; i<LM_BVHW; i++ ) {
+    if( i < used ) {
+      node->b[LM_BVHW_LO_X][i] = slot[i]->box.lo.x;
+      node->b[LM_BVHW_LO_Y][i] = slot[i]->box.lo.y;
+      node->b[LM_BVHW_LO_Z][i] = slot[i]->box.lo.z;
+      node->b[LM_BVHW_HI_X][i] = slot[i]->box.hi.x;
+      node->b[LM_BVHW_HI_Y][i] = slot[i]->box.hi.y;
+      node->b[LM_BVHW_HI_Z][i] = slot[i]->box.hi.z;
+    } else {
+      for( j=0; j<6; j++ ) {
+        node->b[j][i] = 0.0f;
+      }
+      node->child[i] = 0;
+      node->count[i] = LM_BVHW_EMPTY;
+    }
+  }
+
+  for( i=0; i<used; i++ ) {
+    if( slot[i]->left == NULL ) {
+      node->child[i] = slot[i]->first;
+      node->count[i] = slot[i]->count;
+    } else {
+      node->child[i] = lm_bvhw_collapse_node( w, slot[i], next );
+      node->count[i] = 0;
+    }
+  }
+  return n;
+}
+
+void lm_bvhw_free( lm_bvhw *w ) {
+  free( w->node );
+  free( w->tri );
+  free( w->index );
+  w->node  = NULL;
+  w->tri   = NULL;
+  w->index = NULL;
+}
+
+// collapse a built binary tree, the triangle records are copied so the binary
+// tree can be freed afterwards. Returns 0 on allocation failure.
+int lm_bvhw_collapse( lm_bvhw *w, const lm_bvh *bvh ) {
+  int next = 0;
+  int n = (bvh->ntri > 0) ? bvh->ntri : 1;
+
+  // every wide node but the root swallows at least one binary interior node
+  w->ntri  = bvh->ntri;
+  w->node  = (lm_bvhw_node *) aligned_alloc( 64, (bvh->nodes / 2 + 1) * sizeof(lm_bvhw_node) );
+  w->tri   = (lm_tri *) aligned_alloc( 64, n * sizeof(lm_tri) );
+  w->index = (int *) malloc( n * sizeof(int) );
+
+  if( w->node == NULL || w->tri == NULL || w->index == NULL ) {
+    lm_bvhw_free( w );
+    return 0;
+  }
+
+  memcpy( w->tri, bvh->tri, bvh->ntri * sizeof(lm_tri) );
+  memcpy( w->index, bvh->index, bvh->ntri * sizeof(int) );
+  lm_bvhw_collapse_node( w, bvh->root, &next );
+  w->nodes = next;
+  return 1;
+}
+
+int lm_bvhw_leaf( const lm_bvhw *w, const lm_ray *r, int first, int count, lm_hit *hit ) {
+  int i, found = 0;
+  float t, beta, gamma;
+
+  for( i=first; i<first+count; i++ ) {
+    if( lm_ray_tri_early( r, &w->tri[i], hit->t, &beta, &gamma, &t )) {
+      hit->t     = t;
+      hit->beta  = beta;
+      hit->gamma = gamma;
+      hit->tri   = w->index[i];
+      hit->rec   = i;
+      found = 1;
+    }
+  }
+  return found;
+}
+
+// closest hit along r in [0, tmax)
+int lm_bvhw_intersect( const lm_bvhw *w, const lm_ray *r, float tmax, lm_hit *hit ) {
+  int   stack[LM_BVH_STACK * LM_BVHW];
+  float stack_t[LM_BVH_STACK * LM_BVHW];
+  float tnear[LM_BVHW] __attribute__((aligned(32)));
+  int   near_i[LM_BVHW];
+  int sp = 0, mask, i, j, k, n;
+
+  hit->t   = tmax;
+  hit->tri = -1;
+
+  if( w->ntri == 0 ) {
+    return 0;
+  }
+
+  stack[sp] = 0;
+  stack_t[sp++] = 0.0f;
+
+  while( sp > 0 ) {
+    n = stack[--sp];
+    LM_BVH_VISIT();
+
+    if( stack_t[sp] >= hit->t ) {
+      continue;
+    }
+
+    const lm_bvhw_node *node = &w->node[n];
+    mask = lm_bvhw_slab( node, r, hit->t, tnear );
+
+    // leaves straight away, interior children sorted far to near
+    k = 0;
+    for( i=0; i<LM_BVHW; i++ ) {
+      if( !((mask >> i) & 1) ) {
+        continue;
+      }
+      if( node->count[i] > 0 ) {
+        lm_bvhw_leaf( w, r, node->child[i], node->count[i], hit );
+      } else {
+        for( j=k++; j>0 && tnear[near_i[j-1]] < tnear[i]; j-- ) {
+          near_i[j] = near_i[j-1];
+        }
+        near_i[j] = i;
+      }
+    }
+
+    for( j=0; j<k; j++ ) {
+      if( tnear[near_i[j]] < hit->t ) {
+        stack[sp] = node->child[near_i[j]];
+        stack_t[sp++] = tnear[near_i[j]];
+      }
+    }
+  }
+
+  return (hit->tri >= 0) ? 1 : 0;
+}
+
+// any hit along r in [0, tmax) - for shadow rays. A child has to pass the
+// Plücker line test and meet the ray within [0, tmax) on the slab test, and
+// interior children are pushed so the nearest is opened first - an occluder
+// close to the origin ends the walk early.
+int lm_bvhw_occluded( const lm_bvhw *w, const lm_ray *r, float tmax ) {
+  int   stack[LM_BVH_STACK * LM_BVHW];
+  float tnear[LM_BVHW] __attribute__((aligned(32)));
+  int   near_i[LM_BVHW];
+  int sp = 0, mask, i, j, k, n;
+  lm_bvhw_plk p;
+  lm_hit hit;
+
+  if( w->ntri == 0 ) {
+    return 0;
+  }
+
+  lm_bvhw_plk_init( &p, r );
+  hit.t = tmax;
+
+  stack[sp++] = 0;
+
+  while( sp > 0 ) {
+    n = stack[--sp];
+    LM_BVH_VISIT();
+
+    const lm_bvhw_node *node = &w->node[n];
+    mask = lm_bvhw_slab( node, r, tmax, tnear ) & lm_bvhw_plucker( node, &p );
+
+    // leaves straight away, interior children sorted far to near so the
+    // nearest comes off the stack next
+    k = 0;
+    for( i=0; i<LM_BVHW; i++ ) {
+      if( !((mask >> i) & 1) ) {
+        continue;
+      }
+      if( node->count[i] > 0 ) {
+        if( lm_bvhw_leaf( w, r, node->child[i], node->count[i], &hit )) {
+          return 1;
+        }
+      } else {
+        for( j=k++; j>0 && tnear[near_i[j-1]] < tnear[i]; j-- ) {
+          near_i[j] = near_i[j-1];
+        }
+        near_i[j] = i;
+      }
+    }
+
+    for( j=0; j<k; j++ ) {
+      stack[sp++] = node->child[near_i[j]];
+    }
+  }
+
+  return 0;
+}
+
+#endif
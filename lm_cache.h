@@ -0,0 +1,309 @@
+// Memory mappable BVH cache -=:LogicMonkey:=-
+//
+// A flattened hierarchy has no pointers - children are node indices and
+// leaves index the triangle records - so it can be written out as is and
+// mapped straight back in. lm_bvh_cache_map hands back an lm_bvh_flat whose
+// arrays point into the mapping, so tracing starts with no parsing or copying
+// and pages come in from the file as the rays touch them.
+//
+// File layout, every section starting on a 64 byte boundary so the lm_tri
+// records keep their alignment in a page aligned mapping:
+//
+//   0      header     64 bytes - see lm_bvh_cache_header
+//   node   nodes x lm_bvh_flat_node
+//   tri    ntri  x lm_tri
+//   index  ntri  x int
+//
+// A cache is only used if its magic, version, record sizes and byte order all
+// match this build and its hash matches the one given - lm_bvh_hash of the
+// source soup - so a changed mesh, format or build rebuilds the cache.
+//
+#ifndef LM_CACHE_H
+#define LM_CACHE_H
+
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "lm_bvh.h"
+
+#define LM_CACHE_MAGIC   "LMBVHC\r\n"    // the \r\n catches text mode mangling
+#define LM_CACHE_VERSION 1
+#define LM_CACHE_ORDER   0x01020304u     // reads back differently on the wrong endian
+#define LM_CACHE_ALIGN   64
+
+typedef struct {
+  char     magic[8];
+  uint32_t version;
+  uint32_t order;
+  uint32_t node_size;       // sizeof(lm_bvh_flat_node)
+  uint32_t tri_size;        // sizeof(lm_tri)
+  uint64_t hash;            // of the source geometry
+  int32_t  ntri;
+  int32_t  nodes;
+  uint64_t node_off;
+  uint64_t tri_off;
+  uint64_t index_off;
+} lm_bvh_cache_header;
+
+typedef struct {
+  lm_bvh_flat flat;         // arrays point into the mapping
+  void *base;
+  size_t size;
+} lm_bvh_map;
+
+//
+// FNV-1a over 64 bit words, the triangle count mixed in first. Also mixes in
+// the build parameters so changing those invalidates old caches.
+//
+uint64_t lm_bvh_hash( const vec3 *v, int ntri ) {
+  const unsigned char *p = (const unsigned char *) v;
+  size_t n = 3 * (size_t) ntri * sizeof(vec3);
+  uint64_t h = 14695981039346656037ull;
+  uint64_t w;
+  float cost[2] = { LM_BVH_CTRAV, LM_BVH_CISECT };
+  size_t i;
+
+  h = (h ^ (uint64_t) ntri) * 1099511628211ull;
+  h = (h ^ (uint64_t) (LM_BVH_BINS << 16 | LM_BVH_MAXLEAF << 8 | LM_BVH_DEPTH)) * 1099511628211ull;
+  memcpy( &w, cost, 8 );
+  h = (h ^ w) * 1099511628211ull;
+
+  for( i=0; i+8<=n; i+=8 ) {
+    memcpy( &w, p + i, 8 );
+    h = (h ^ w) * 1099511628211ull;
+  }
+  for( ; i<n; i++ ) {
+    h = (h ^ p[i]) * 1099511628211ull;
+  }
+  return h;
+}
+
+uint64_t lm_cache_align( uint64_t off ) {
+  return (off + LM_CACHE_ALIGN - 1) & ~(uint64_t) (LM_CACHE_ALIGN - 1);
+}
+
+int lm_cache_put( FILE *fp, uint64_t off, const void *p, size_t n ) {
+  if( n == 0 ) {
+    return 1;
+  }
+  return fseek( fp, (long) off, SEEK_SET ) == 0 && fwrite( p, 1, n, fp ) == n;
+}
+
+//
+// Write flat to path. It goes to path.tmp first and is renamed into place, so
+// a reader never maps a half written file. Returns 0 on failure.
+//
+int lm_bvh_cache_write( const lm_bvh_flat *flat, const char *path, uint64_t hash ) {
+  lm_bvh_cache_header h;
+  char tmp[4096];
+  FILE *fp;
+  int ok;
+
+  if( snprintf( tmp, sizeof(tmp), "%s.tmp", path ) >= (int) sizeof(tmp) ) {
+    return 0;
+  }
+
+  memset( &h, 0, sizeof(h) );
+  memcpy( h.magic, LM_CACHE_MAGIC, 8 );
+  h.version   = LM_CACHE_VERSION;
+  h.order     = LM_CACHE_ORDER;
+  h.node_size = sizeof(lm_bvh_flat_node);
+  h.tri_size  = sizeof(lm_tri);
+  h.hash      = hash;
+  h.ntri      = flat->ntri;
+  h.nodes     = flat->nodes;
+  h.node_off  = lm_cache_align( sizeof(h) );
+  h.tri_off   = lm_cache_align( h.node_off + (uint64_t) flat->nodes * sizeof(lm_bvh_flat_node) );
+  h.index_off = lm_cache_align( h.tri_off + (uint64_t) flat->ntri * sizeof(lm_tri) );
+
+  fp = fopen( tmp, "wb" );
+  if( fp == NULL ) {
+    return 0;
+  }
+
+  ok = lm_cache_put( fp, 0, &h, sizeof(h) ) &&
+       lm_cache_put( fp, h.node_off, flat->node, flat->nodes * sizeof(lm_bvh_flat_node) ) &&
+       lm_cache_put( fp, h.tri_off, flat->tri, flat->ntri * sizeof(lm_tri) ) &&
+       lm_cache_put( fp, h.index_off, flat->index, flat->ntri * sizeof(int) );
+
+  if( fclose( fp ) != 0 ) {
+    ok = 0;
+  }
+  if( ok && rename( tmp, path ) != 0 ) {
+    ok = 0;
+  }
+  if( !ok ) {
+    remove( tmp );
+  }
+  return ok;
+}
+
+void lm_bvh_cache_unmap( lm_bvh_map *m ) {
+  if( m->base != NULL ) {
+    munmap( m->base, m->size );
+  }
+  m->base = NULL;
+  m->flat.node  = NULL;
+  m->flat.tri   = NULL;
+  m->flat.index = NULL;
+}
+
+// walk the mapped tree the way lm_bvh_flat_intersect will - children after
+// their parent and inside the node array, leaves inside the triangles, never
+// deeper than its stack, no more nodes reached than there are - and check
+// every soup index. A truncated or hostile file could otherwise send the
+// traversal out of bounds. Returns 1 if the tree is sound.
+int lm_bvh_cache_check( const lm_bvh_flat *f ) {
+  const lm_bvh_flat_node *n;
+  int stack[LM_BVH_STACK];
+  int sp = 0, i, seen = 0;
+
+  // an empty soup flattens to at most a bare root, and lm_bvh_flat_intersect
+  // returns before reading any node when there are no triangles
+  if( f->ntri == 0 && f->nodes <= 1 ) {
+    return 1;
+  }
+
+  for( i=0; i<f->ntri; i++ ) {
+    if( f->index[i] < 0 || f->index[i] >= f->ntri ) {
+      return 0;
+    }
+  }
+
+  stack[sp++] = 0;
+  while( sp > 0 ) {
+    i = stack[--sp];
+    n = &f->node[i];
+    if( ++seen > f->nodes || n->count < 0 ) {
+      return 0;
+    }
+    if( n->count > 0 ) {
+      if( n->offset < 0 || (int64_t) n->offset + n->count > f->ntri ) {
+        return 0;
+      }
+      continue;
+    }
+    if( n->offset <= i + 1 || n->offset >= f->nodes || sp + 2 > LM_BVH_STACK ) {
+      return 0;
+    }
+    stack[sp++] = n->offset;
+    stack[sp++] = i + 1;
+  }
+  return 1;
+}
+
+//
+// Map a cache read only. Returns 0 if it is missing, unreadable, from another
+// format or build, truncated, holds a tree that would index out of bounds, or
+// is for other geometry (hash differs). The mapping stays valid until
+// lm_bvh_cache_unmap - don't lm_bvh_flat_free it.
+//
+int lm_bvh_cache_map( lm_bvh_map *m, const char *path, uint64_t hash ) {
+  const lm_bvh_cache_header *h;
+  struct stat st;
+  int fd;
+
+  m->base = NULL;
+  m->size = 0;
+
+  fd = open( path, O_RDONLY );
+  if( fd < 0 ) {
+    return 0;
+  }
+  if( fstat( fd, &st ) != 0 || st.st_size < (off_t) sizeof(lm_bvh_cache_header) ) {
+    close( fd );
+    return 0;
+  }
+
+  m->size = st.st_size;
+  m->base = mmap( NULL, m->size, PROT_READ, MAP_PRIVATE, fd, 0 );
+  close( fd );
+  if( m->base == MAP_FAILED ) {
+    m->base = NULL;
+    return 0;
+  }
+
+  h = (const lm_bvh_cache_header *) m->base;
+  if( memcmp( h->magic, LM_CACHE_MAGIC, 8 ) != 0 ||
+      h->version   != LM_CACHE_VERSION ||
+      h->order     != LM_CACHE_ORDER ||
+      h->node_size != sizeof(lm_bvh_flat_node) ||
+      h->tri_size  != sizeof(lm_tri) ||
+      h->hash      != hash ||
+      h->ntri < 0 || h->nodes < 1 ||
+      (h->node_off | h->tri_off | h->index_off) % LM_CACHE_ALIGN != 0 ||
+      h->node_off  + (uint64_t) h->nodes * sizeof(lm_bvh_flat_node) > m->size ||
+      (h->ntri > 0 && h->tri_off   + (uint64_t) h->ntri * sizeof(lm_tri) > m->size) ||
+      (h->ntri > 0 && h->index_off + (uint64_t) h->ntri * sizeof(int) > m->size) ) {
+    lm_bvh_cache_unmap( m );
+    return 0;
+  }
+
+  m->flat.ntri  = h->ntri;
+  m->flat.nodes = h->nodes;
+  m->flat.node  = (lm_bvh_flat_node *) ((char *) m->base + h->node_off);
+  m->flat.tri   = (lm_tri *) ((char *) m->base + h->tri_off);
+  m->flat.index = (int *) ((char *) m->base + h->index_off);
+
+  if( !lm_bvh_cache_check( &m->flat )) {
+    lm_bvh_cache_unmap( m );
+    return 0;
+  }
+  return 1;
+}
+
+//
+// Map the cache at path if it is for this soup, otherwise build the hierarchy,
+// write the cache and map that. Returns 1 on a cache hit, 2 after a build and
+// 0 on failure. If the cache can't be written it returns 3 with the freshly
+// built tree copied into an anonymous mapping, so it is released the same way.
+//
+int lm_bvh_cache_load( lm_bvh_map *m, const char *path, const vec3 *v, int ntri ) {
+  uint64_t hash = lm_bvh_hash( v, ntri );
+  lm_bvh tree;
+  lm_bvh_flat flat;
+  int ok;
+
+  if( lm_bvh_cache_map( m, path, hash )) {
+    return 1;
+  }
+
+  if( !lm_bvh_build( &tree, v, ntri )) {
+    return 0;
+  }
+  ok = lm_bvh_flatten( &flat, &tree );
+  lm_bvh_free( &tree );
+  if( !ok ) {
+    return 0;
+  }
+
+  ok = lm_bvh_cache_write( &flat, path, hash ) && lm_bvh_cache_map( m, path, hash );
+  if( !ok ) {
+    // no cache, but keep the tree - same layout, anonymous memory
+    size_t node_off  = 0;
+    size_t tri_off   = lm_cache_align( flat.nodes * sizeof(lm_bvh_flat_node) );
+    size_t index_off = lm_cache_align( tri_off + flat.ntri * sizeof(lm_tri) );
+
+    m->size = index_off + flat.ntri * sizeof(int) + 1;
+    m->base = mmap( NULL, m->size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0 );
+    if( m->base == MAP_FAILED ) {
+      m->base = NULL;
+      lm_bvh_flat_free( &flat );
+      return 0;
+    }
+    m->flat = flat;
+    m->flat.node  = (lm_bvh_flat_node *) ((char *) m->base + node_off);
+    m->flat.tri   = (lm_tri *) ((char *) m->base + tri_off);
+    m->flat.index = (int *) ((char *) m->base + index_off);
+    memcpy( m->flat.node, flat.node, flat.nodes * sizeof(lm_bvh_flat_node) );
+    memcpy( m->flat.tri, flat.tri, flat.ntri * sizeof(lm_tri) );
+    memcpy( m->flat.index, flat.index, flat.ntri * sizeof(int) );
+  }
+
+  lm_bvh_flat_free( &flat );
+  return ok ? 2 : 3;
+}
+
+#endif
@@ -0,0 +1,289 @@
+// Double buffered frame buffer presenter -=:LogicMonkey:=-
+//
+// Writing pixels straight into the mapped /dev/fb0 shows every half drawn
+// frame, and each store is a scattered write to uncached video memory. Here
+// the renderer draws into an ordinary back buffer in the screen's own pixel
+// format - rows padded to a cache line - and lm_fb_present copies it to the
+// screen a whole scanline at a time (one copy for the lot when the pitches
+// agree).
+//
+// Where the driver lets yres_virtual be twice yres the screen has two pages.
+// The back buffer goes to the hidden page and FBIOPAN_DISPLAY flips yoffset
+// over to it, so the visible page is never written. Where FBIO_WAITFORVSYNC
+// works it is waited on before the flip - or before the copy with only one
+// page - so the change lands in the vertical blank. Either can be missing,
+// the presenter uses whatever the driver gives it.
+//
+// A device that is a regular file, or does not exist yet outside /dev, is a
+// fake frame buffer - the file is made two pages long, mapped and "panned"
+// just the same, with no ioctls. That runs the whole path on a headless box.
+// Fake frames are unpaced unless LM_FB_FAKE_HZ says otherwise.
+//
+// Every present is timed and lm_fb_report prints the frame time statistics.
+// Pixels are 16 bit RGB565 or 32 bit XRGB8888, filled by lm_fb_put from
+// floats through the lm_tonemap ramp.
+//
+#ifndef LM_FB_H
+#define LM_FB_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <linux/fb.h>
+#include "lm_tonemap.h"
+
+#ifndef LM_FB_ALIGN
+#define LM_FB_ALIGN 64                // back buffer row alignment in bytes
+#endif
+
+#ifndef LM_FB_FAKE_HZ
+#define LM_FB_FAKE_HZ 0               // fake vertical blanks a second, 0 unpaced
+#endif
+
+typedef struct {
+  int fd, fake, pages, page, vsync;
+  int width, height, bytes;           // visible pixels, bytes a pixel
+  long pitch;                         // back buffer bytes a row
+  struct fb_var_screeninfo vinfo, saved;
+  struct fb_fix_screeninfo finfo;
+  char *fbp;
+  long mapsize;
+  unsigned char *back;
+  long frames;                        // presents so far
+  double start, last;                 // open and previous present, seconds
+  double sum, sumsq, min, max;        // frame to frame times, seconds
+} lm_fb;
+
+double lm_fb_now() {
+  struct timespec ts;
+  clock_gettime( CLOCK_MONOTONIC, &ts );
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// the screen details of a fake device, two pages of width x height
+void lm_fb_fake_info( lm_fb *fb, int width, int height, int bpp ) {
+  memset( &fb->vinfo, 0, sizeof(fb->vinfo) );
+  memset( &fb->finfo, 0, sizeof(fb->finfo) );
+  fb->vinfo.xres           = width;
+  fb->vinfo.yres           = height;
+  fb->vinfo.xres_virtual   = width;
+  fb->vinfo.yres_virtual   = 2 * height;
+  fb->vinfo.bits_per_pixel = bpp;
+  fb->finfo.line_length    = width * (bpp / 8);
+  fb->finfo.smem_len       = fb->finfo.line_length * 2 * height;
+  fb->saved = fb->vinfo;
+}
+
+// a real device - ask for a second page if there isn't one, and see whether
+// the driver waits for vertical blank. 1 if the screen can't be read
+int lm_fb_real_info( lm_fb *fb ) {
+  struct fb_var_screeninfo want;
+  __u32 crtc = 0;
+
+  if( ioctl( fb->fd, FBIOGET_FSCREENINFO, &fb->finfo ) || ioctl( fb->fd, FBIOGET_VSCREENINFO, &fb->vinfo )) {
+    return 1;
+  }
+  fb->saved = fb->vinfo;
+
+  if( fb->vinfo.yres_virtual < 2 * fb->vinfo.yres ) {
+    want = fb->vinfo;
+    want.yres_virtual = 2 * want.yres;
+    want.yoffset      = 0;
+    if( ioctl( fb->fd, FBIOPUT_VSCREENINFO, &want ) == 0 ) {
+      ioctl( fb->fd, FBIOGET_FSCREENINFO, &fb->finfo );
+      ioctl( fb->fd, FBIOGET_VSCREENINFO, &fb->vinfo );
+    }
+  }
+
+  fb->vsync = (ioctl( fb->fd, FBIO_WAITFORVSYNC, &crtc ) == 0);
+  return 0;
+}
+
+//
+// Open device (a frame buffer, or a file to fake one width x height at bpp
+// bits) and make its back buffer. Returns 0 when it is ready to present, 1
+// with a message otherwise.
+//
+int lm_fb_open( lm_fb *fb, const char *device, int width, int height, int bpp ) {
+  struct stat st;
+  long page;
+
+  memset( fb, 0, sizeof(*fb) );
+  fb->fbp  = MAP_FAILED;
+  fb->fake = (stat( device, &st ) == 0) ? S_ISREG( st.st_mode ) : strncmp( device, "/dev/", 5 ) != 0;
+
+  fb->fd = open( device, fb->fake ? O_RDWR | O_CREAT : O_RDWR, 0644 );
+  if( fb->fd < 0 ) {
+    fprintf( stderr, "Could not open frame buffer %s\n", device );
+    return 1;
+  }
+
+  if( fb->fake ) {
+    lm_fb_fake_info( fb, width, height, bpp );
+    if( ftruncate( fb->fd, fb->finfo.smem_len )) {
+      fprintf( stderr, "Could not size fake frame buffer %s\n", device );
+      goto fail;
+    }
+  } else if( lm_fb_real_info( fb )) {
+    fprintf( stderr, "Could not read screen information - permissions on %s?\n", device );
+    goto fail;
+  }
+
+  fb->width  = fb->vinfo.xres;
+  fb->height = fb->vinfo.yres;
+  fb->bytes  = fb->vinfo.bits_per_pixel / 8;
+  if( fb->bytes != 2 && fb->bytes != 4 ) {
+    fprintf( stderr, "Frame buffer is %d bits a pixel, only 16 and 32 are drawn\n", fb->vinfo.bits_per_pixel );
+    goto fail;
+  }
+
+  // two pages only if the driver took the taller virtual screen and there
+  // is the memory behind it
+  page = (long) fb->finfo.line_length * fb->height;
+  fb->pages   = (fb->vinfo.yres_virtual >= 2 * fb->vinfo.yres && fb->finfo.smem_len >= 2 * page) ? 2 : 1;
+  fb->page    = (fb->pages == 2 && fb->vinfo.yoffset >= fb->vinfo.yres) ? 1 : 0;
+  fb->mapsize = (fb->pages == 2) ? 2 * page : (long) fb->finfo.line_length * (fb->vinfo.yoffset + fb->height);
+
+  fb->fbp = (char *) mmap( NULL, fb->mapsize, PROT_READ | PROT_WRITE, MAP_SHARED, fb->fd, 0 );
+  if( fb->fbp == MAP_FAILED ) {
+    fprintf( stderr, "Could not map frame buffer %s\n", device );
+    goto fail;
+  }
+
+  fb->pitch = ((long) fb->width * fb->bytes + LM_FB_ALIGN - 1) / LM_FB_ALIGN * LM_FB_ALIGN;
+  if( posix_memalign( (void **) &fb->back, LM_FB_ALIGN, fb->pitch * fb->height )) {
+    fb->back = NULL;
+    fprintf( stderr, "Could not allocate back buffer\n" );
+    goto fail;
+  }
+  memset( fb->back, 0, fb->pitch * fb->height );
+
+  fb->start = fb->last = lm_fb_now();
+  return 0;
+
+  fail:
+  if( fb->fbp != MAP_FAILED ) munmap( fb->fbp, fb->mapsize );
+  close( fb->fd );
+  return 1;
+}
+
+// start of back buffer row y
+unsigned char *lm_fb_row( const lm_fb *fb, int y ) {
+  return fb->back + y * fb->pitch;
+}
+
+// colour n shades into the back buffer from x, y onwards
+void lm_fb_put( const lm_fb *fb, const lm_tonemap_lut *lut, int x, int y, const float *val, int n ) {
+  if( fb->bytes == 4 ) {
+    lm_tonemap_xrgb8888( lut, (unsigned int *) lm_fb_row( fb, y ) + x, val, n );
+  } else {
+    lm_tonemap_rgb565( lut, (unsigned short *) lm_fb_row( fb, y ) + x, val, n );
+  }
+}
+
+// sleep to the next fake vertical blank, counted from open
+void lm_fb_fake_wait( const lm_fb *fb ) {
+  double period = 1.0 / (LM_FB_FAKE_HZ > 0 ? LM_FB_FAKE_HZ : 1);
+  double wait = period - fmod( lm_fb_now() - fb->start, period );
+  struct timespec ts;
+
+  ts.tv_sec  = (time_t) wait;
+  ts.tv_nsec = (long) ((wait - ts.tv_sec) * 1e9);
+  nanosleep( &ts, NULL );
+}
+
+void lm_fb_wait( lm_fb *fb ) {
+  __u32 crtc = 0;
+
+  if( fb->fake ) {
+    if( LM_FB_FAKE_HZ > 0 ) {
+      lm_fb_fake_wait( fb );
+    }
+  } else if( fb->vsync && ioctl( fb->fd, FBIO_WAITFORVSYNC, &crtc )) {
+    fb->vsync = 0;
+  }
+}
+
+//
+// Put the back buffer on screen. With two pages it is copied to the hidden
+// one which is then panned to, otherwise it is copied over the visible page
+// at the vertical blank. The back buffer is left as it was.
+//
+void lm_fb_present( lm_fb *fb ) {
+  int target = (fb->pages == 2) ? 1 - fb->page : fb->page;
+  long line  = fb->finfo.line_length;
+  long row   = (long) fb->width * fb->bytes;
+  long top   = (fb->pages == 2) ? (long) target * fb->height : fb->vinfo.yoffset;
+  char *dst  = fb->fbp + top * line + (long) fb->vinfo.xoffset * fb->bytes;
+  double now, dt;
+  int y;
+
+  if( fb->pages == 1 ) {
+    lm_fb_wait( fb );
+  }
+
+  if( line == fb->pitch && fb->vinfo.xoffset == 0 ) {
+    memcpy( dst, fb->back, line * fb->height );
+  } else {
+    for( y=0; y<fb->height; y++ ) {
+      memcpy( dst + y * line, fb->back + y * fb->pitch, row );
+    }
+  }
+
+  if( fb->pages == 2 ) {
+    lm_fb_wait( fb );
+    fb->vinfo.yoffset = target * fb->height;
+    if( !fb->fake && ioctl( fb->fd, FBIOPAN_DISPLAY, &fb->vinfo )) {
+      // no panning after all - carry on with the one page that is showing
+      fb->vinfo.yoffset = fb->page * fb->height;
+      fb->pages = 1;
+    } else {
+      fb->page = target;
+    }
+  }
+
+  now = lm_fb_now();
+  dt  = now - fb->last;
+  fb->last = now;
+  fb->sum   += dt;
+  fb->sumsq += dt * dt;
+  fb->min = (fb->frames == 0 || dt < fb->min) ? dt : fb->min;
+  fb->max = (fb->frames == 0 || dt > fb->max) ? dt : fb->max;
+  fb->frames++;
+}
+
+// frame count and frame to frame times in milliseconds - the first frame is
+// timed from open
+void lm_fb_report( const lm_fb *fb ) {
+  double mean, sd;
+
+  printf( "%dx%d %d bit %s, %d page%s, %s\n", fb->width, fb->height, 8 * fb->bytes,
+          fb->fake ? "fake" : "frame buffer", fb->pages, (fb->pages == 2) ? "s panned" : "",
+          fb->vsync ? "vsync" : "no vsync" );
+  if( fb->frames == 0 ) {
+    return;
+  }
+  mean = fb->sum / fb->frames;
+  sd   = sqrt( fabs( fb->sumsq / fb->frames - mean * mean ));
+  printf( "%ld frames, %.1f fps, frame ms mean %.3f sd %.3f min %.3f max %.3f\n", fb->frames,
+          fb->frames / fb->sum, mean * 1e3, sd * 1e3, fb->min * 1e3, fb->max * 1e3 );
+}
+
+// put the screen back the way it was found
+void lm_fb_close( lm_fb *fb ) {
+  if( !fb->fake && (fb->vinfo.yres_virtual != fb->saved.yres_virtual || fb->vinfo.yoffset != fb->saved.yoffset) ) {
+    ioctl( fb->fd, FBIOPUT_VSCREENINFO, &fb->saved );
+  }
+  munmap( fb->fbp, fb->mapsize );
+  close( fb->fd );
+  free( fb->back );
+}
+
+#endif
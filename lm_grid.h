@@ -0,0 +1,385 @@
+// Uniform grid over spheres -=:LogicMonkey:=-
+//
+// For lots of spheres of much the same size a uniform grid is quicker to
+// build than a BVH - one counting pass, a prefix sum and a fill pass - and the
+// walk through it is a 3D-DDA (Amanatides & Woo [1987]): step into whichever
+// neighbouring cell has the nearest boundary crossing, testing each cell's
+// spheres on the way, and stop once the closest hit so far lies inside the
+// cell just walked (any sphere not yet tested starts further on).
+//
+// A sphere is listed in every cell its bounding box touches, so a ray can meet
+// it again and again. Each ray keeps a small mailbox of the spheres it has
+// tested, hashed by index, and skips any it finds there. A collision just means
+// a sphere is tested twice, never that it is missed, and the mailbox lives on
+// the stack so one grid can be walked by many threads at once.
+//
+// The resolution is
+//
+//   cells per unit length = cbrt( LM_GRID_DENSITY.N / V )
+//
+// for N spheres in a box of volume V, with cells kept at least a sphere
+// diameter across so a typical sphere lands in no more than 8 of them.
+//
+// lm_grid_intersect has the same closest hit interface as
+// lm_bvh_flat_intersect. Its lm_hit tri and rec are the sphere index, beta and
+// gamma are 0. lm_sbvh wraps a BVH over the same spheres, built with
+// lm_bvh_build_boxes, to compare the two.
+//
+#ifndef LM_GRID_H
+#define LM_GRID_H
+
+#include "lm_bvh.h"
+
+#define LM_GRID_DENSITY  2.0f       // cells per sphere
+#define LM_GRID_MAXRES   1024       // on any one axis
+#define LM_GRID_MAXCELLS (1 << 24)
+#define LM_GRID_MAILBOX  32         // power of two
+
+typedef struct {
+  lm_aabb box;
+  int res[3];
+  float lo[3], cell[3], inv[3];   // corner, cell size and 1/size per axis
+  int *first;                     // cell c lists item[first[c]] to item[first[c+1]-1]
+  int *item;                      // sphere indices
+  int refs;
+  const lm_spheres *s;            // not copied, must outlive the grid
+} lm_grid;
+
+typedef struct {
+  lm_bvh_flat flat;
+  const lm_spheres *s;            // not copied, must outlive the tree
+} lm_sbvh;
+
+// sphere i's closest hit in [0, tmax) - same sums as lm_ray_spheres
+int lm_ray_spheres_one( const lm_ray *r, const lm_spheres *s, int i, float tmax, float *t ) {
+  float ocx, ocy, ocz, oc_sq, tc, hg_sq, th;
+
+  ocx = s->x[i] - r->o.x;
+  ocy = s->y[i] - r->o.y;
+  ocz = s->z[i] - r->o.z;
+
+  oc_sq = ocx*ocx + ocy*ocy + ocz*ocz;
+  tc    = ocx*r->d.x + ocy*r->d.y + ocz*r->d.z;
+  hg_sq = s->rad[i]*s->rad[i] - (oc_sq - tc*tc);
+
+  if( hg_sq < 0.0f ) {
+    return 0;
+  }
+
+  th = tc - sqrt( hg_sq );
+  th = (th < 0.0f) ? tc + sqrt( hg_sq ) : th;
+
+  if( th >= 0.0f && th < tmax ) {
+    *t = th;
+    return 1;
+  }
+  return 0;
+}
+
+void lm_spheres_box( const lm_spheres *s, int i, lm_aabb *b ) {
+  b->lo.x = s->x[i] - s->rad[i];
+  b->lo.y = s->y[i] - s->rad[i];
+  b->lo.z = s->z[i] - s->rad[i];
+  b->hi.x = s->x[i] + s->rad[i];
+  b->hi.y = s->y[i] + s->rad[i];
+  b->hi.z = s->z[i] + s->rad[i];
+}
+
+// range of cells touched by a box, padded by a sliver of a cell so a sphere
+// right on a boundary is listed on both sides
+void lm_grid_cells( const lm_grid *g, const lm_aabb *b, int *c0, int *c1 ) {
+  float lo[3] = { b->lo.x, b->lo.y, b->lo.z };
+  float hi[3] = { b->hi.x, b->hi.y, b->hi.z };
+  int a;
+
+  for( a=0; a<3; a++ ) {
+    c0[a] = (int) floorf( (lo[a] - g->lo[a]) * g->inv[a] - 1e-3f );
+    c1[a] = (int) floorf( (hi[a] - g->lo[a]) * g->inv[a] + 1e-3f );
+    c0[a] = MIN( MAX( c0[a], 0 ), g->res[a] - 1 );
+    c1[a] = MIN( MAX( c1[a], 0 ), g->res[a] - 1 );
+  }
+}
+
+void lm_grid_free( lm_grid *g ) {
+  free( g->first );
+  free( g->item );
+  g->first = NULL;
+  g->item  = NULL;
+}
+
+// Build over s, which is referenced rather than copied. Returns 0 on
+// allocation failure.
+int lm_grid_build( lm_grid *g, const lm_spheres *s ) {
+  lm_aabb b;
+  float ext[3], k, vol = 1.0f, rad = 0.0f;
+  int c0[3], c1[3], a, i, x, y, z, cells;
+  long refs = 0;
+
+  g->s     = s;
+  g->first = NULL;
+  g->item  = NULL;
+  g->refs  = 0;
+
+  lm_aabb_empty( &g->box );
+  for( i=0; i<s->n; i++ ) {
+    lm_spheres_box( s, i, &b );
+    lm_aabb_union( &g->box, &b );
+    rad += s->rad[i];
+  }
+  if( s->n == 0 ) {
+    g->box.lo.x = g->box.lo.y = g->box.lo.z = 0.0f;
+    g->box.hi = g->box.lo;
+  }
+  rad = (s->n > 0) ? rad / s->n : 0.0f;
+
+  g->lo[0] = g->box.lo.x;
+  g->lo[1] = g->box.lo.y;
+  g->lo[2] = g->box.lo.z;
+  ext[0] = g->box.hi.x - g->box.lo.x;
+  ext[1] = g->box.hi.y - g->box.lo.y;
+  ext[2] = g->box.hi.z - g->box.lo.z;
+  for( a=0; a<3; a++ ) {
+    ext[a] = MAX( ext[a], 1e-6f );
+    vol *= ext[a];
+  }
+
+  k = cbrtf( LM_GRID_DENSITY * MAX( s->n, 1 ) / vol );
+  if( rad > 0.0f ) {
+    k = MIN( k, 0.5f / rad );
+  }
+  do {
+    for( a=0; a<3; a++ ) {
+      g->res[a] = MIN( MAX( (int) (ext[a] * k + 0.5f), 1 ), LM_GRID_MAXRES );
+      g->cell[a] = ext[a] / g->res[a];
+      g->inv[a]  = 1.0f / g->cell[a];
+    }
+    k *= 0.9f;
+  } while( (long) g->res[0] * g->res[1] * g->res[2] > LM_GRID_MAXCELLS );
+  cells = g->res[0] * g->res[1] * g->res[2];
+
+  g->first = (int *) calloc( cells + 1, sizeof(int) );
+  if( g->first == NULL ) {
+    return 0;
+  }
+
+  // count into first[c+1], sum, then fill using first[c] as the cursor
+  for( i=0; i<s->n; i++ ) {
+    lm_spheres_box( s, i, &b );
+    lm_grid_cells( g, &b, c0, c1 );
+    for( z=c0[2]; z<=c1[2]; z++ ) {
+      for( y=c0[1]; y<=c1[1]; y++ ) {
+        for( x=c0[0]; x<=c1[0]; x++ ) {
+          g->first[(z * g->res[1] + y) * g->res[0] + x + 1]++;
+        }
+      }
+    }
+    refs += (long) (c1[0] - c0[0] + 1) * (c1[1] - c0[1] + 1) * (c1[2] - c0[2] + 1);
+  }
+  if( refs > 0x7fffffff ) {
+    lm_grid_free( g );
+    return 0;
+  }
+  for( i=0; i<cells; i++ ) {
+    g->first[i+1] += g->first[i];
+  }
+
+  g->refs = refs;
+  g->item = (int *) malloc( (refs > 0 ? refs : 1) * sizeof(int) );
+  if( g->item == NULL ) {
+    lm_grid_free( g );
+    return 0;
+  }
+
+  for( i=0; i<s->n; i++ ) {
+    lm_spheres_box( s, i, &b );
+    lm_grid_cells( g, &b, c0, c1 );
+    for( z=c0[2]; z<=c1[2]; z++ ) {
+      for( y=c0[1]; y<=c1[1]; y++ ) {
+        for( x=c0[0]; x<=c1[0]; x++ ) {
+          g->item[g->first[(z * g->res[1] + y) * g->res[0] + x]++] = i;
+        }
+      }
+    }
+  }
+  memmove( g->first + 1, g->first, cells * sizeof(int) );
+  g->first[0] = 0;
+
+  return 1;
+}
+
+// closest hit along r in [0, tmax)
+int lm_grid_intersect( const lm_grid *g, const lm_ray *r, float tmax, lm_hit *hit ) {
+  int mbox[LM_GRID_MAILBOX];
+  int c[3], step[3], out[3], a, i, k, cell;
+  float o[3] = { r->o.x, r->o.y, r->o.z };
+  float d[3] = { r->d.x, r->d.y, r->d.z };
+  float inv[3] = { r->inv.x, r->inv.y, r->inv.z };
+  float tnext[3], tdelta[3], tn, tf, t;
+
+  hit->t   = tmax;
+  hit->tri = -1;
+
+  if( g->s->n == 0 || !lm_ray_slab( r, g->box.lo, g->box.hi, tmax, &tn, &tf )) {
+    return 0;
+  }
+  tn = MAX( tn, 0.0f );
+
+  // entry cell, then the t of the next boundary and between boundaries
+  for( a=0; a<3; a++ ) {
+    c[a] = (int) floorf( (o[a] + d[a] * tn - g->lo[a]) * g->inv[a] );
+    c[a] = MIN( MAX( c[a], 0 ), g->res[a] - 1 );
+
+    if( d[a] > 0.0f ) {
+      step[a]   = 1;
+      out[a]    = g->res[a];
+      tnext[a]  = (g->lo[a] + (c[a] + 1) * g->cell[a] - o[a]) * inv[a];
+      tdelta[a] = g->cell[a] * inv[a];
+    } else if( d[a] < 0.0f ) {
+      step[a]   = -1;
+      out[a]    = -1;
+      tnext[a]  = (g->lo[a] + c[a] * g->cell[a] - o[a]) * inv[a];
+      tdelta[a] = -g->cell[a] * inv[a];
+    } else {
+      step[a]   = 0;
+      out[a]    = -1;
+      tnext[a]  = INFINITY;
+      tdelta[a] = 0.0f;
+    }
+  }
+
+  for( i=0; i<LM_GRID_MAILBOX; i++ ) {
+    mbox[i] = -1;
+  }
+
+  for( ;; ) {
+    LM_BVH_VISIT();
+    cell = (c[2] * g->res[1] + c[1]) * g->res[0] + c[0];
+
+    for( i=g->first[cell]; i<g->first[cell+1]; i++ ) {
+      k = g->item[i];
+      if( mbox[k & (LM_GRID_MAILBOX - 1)] == k ) {
+        continue;
+      }
+      mbox[k & (LM_GRID_MAILBOX - 1)] = k;
+
+      if( lm_ray_spheres_one( r, g->s, k, hit->t, &t )) {
+        hit->t     = t;
+        hit->beta  = 0.0f;
+        hit->gamma = 0.0f;
+        hit->tri   = k;
+        hit->rec   = k;
+      }
+    }
+
+    a = (tnext[0] < tnext[1]) ? ((tnext[0] < tnext[2]) ? 0 : 2) : ((tnext[1] < tnext[2]) ? 1 : 2);
+    if( hit->t <= tnext[a] ) {
+      break;
+    }
+    c[a] += step[a];
+    if( c[a] == out[a] ) {
+      break;
+    }
+    tnext[a] += tdelta[a];
+  }
+
+  return (hit->tri >= 0) ? 1 : 0;
+}
+
+void lm_sbvh_free( lm_sbvh *b ) {
+  lm_bvh_flat_free( &b->flat );
+}
+
+// binned SAH BVH over the spheres' boxes, s is referenced rather than copied
+int lm_sbvh_build( lm_sbvh *b, const lm_spheres *s ) {
+  lm_bvh tree;
+  lm_aabb *box = (lm_aabb *) malloc( (s->n > 0 ? s->n : 1) * sizeof(lm_aabb) );
+  int i, ok;
+
+  b->s = s;
+  b->flat.node  = NULL;
+  b->flat.tri   = NULL;
+  b->flat.index = NULL;
+
+  if( box == NULL ) {
+    return 0;
+  }
+  for( i=0; i<s->n; i++ ) {
+    lm_spheres_box( s, i, &box[i] );
+  }
+
+  ok = lm_bvh_build_boxes( &tree, box, s->n );
+  free( box );
+  if( !ok ) {
+    return 0;
+  }
+
+  ok = lm_bvh_flatten( &b->flat, &tree );
+  lm_bvh_free( &tree );
+  return ok;
+}
+
+// closest hit along r in [0, tmax) - lm_bvh_flat_intersect with sphere leaves
+int lm_sbvh_intersect( const lm_sbvh *b, const lm_ray *r, float tmax, lm_hit *hit ) {
+  int   stack[LM_BVH_STACK];
+  float stack_t[LM_BVH_STACK];
+  int sp = 0, i, k, n, left, right;
+  float tn, tf, tn1, tf1, t;
+  const lm_bvh_flat_node *node = b->flat.node;
+
+  hit->t   = tmax;
+  hit->tri = -1;
+
+  if( b->flat.ntri == 0 || !lm_ray_slab( r, node[0].lo, node[0].hi, tmax, &tn, &tf )) {
+    return 0;
+  }
+
+  stack[sp] = 0;
+  stack_t[sp++] = tn;
+
+  while( sp > 0 ) {
+    n = stack[--sp];
+    LM_BVH_VISIT();
+
+    if( stack_t[sp] >= hit->t ) {
+      continue;
+    }
+
+    if( node[n].count > 0 ) {
+      for( i=node[n].offset; i<node[n].offset+node[n].count; i++ ) {
+        k = b->flat.index[i];
+        if( lm_ray_spheres_one( r, b->s, k, hit->t, &t )) {
+          hit->t     = t;
+          hit->beta  = 0.0f;
+          hit->gamma = 0.0f;
+          hit->tri   = k;
+          hit->rec   = k;
+        }
+      }
+      continue;
+    }
+
+    left  = n + 1;
+    right = node[n].offset;
+
+    int hl = lm_ray_slab( r, node[left].lo, node[left].hi, hit->t, &tn, &tf );
+    int hr = lm_ray_slab( r, node[right].lo, node[right].hi, hit->t, &tn1, &tf1 );
+
+    if( hl && hr ) {
+      if( tn <= tn1 ) {
+        stack[sp] = right; stack_t[sp++] = tn1;
+        stack[sp] = left;  stack_t[sp++] = tn;
+      } else {
+        stack[sp] = left;  stack_t[sp++] = tn;
+        stack[sp] = right; stack_t[sp++] = tn1;
+      }
+    } else if( hl ) {
+      stack[sp] = left;  stack_t[sp++] = tn;
+    } else if( hr ) {
+      stack[sp] = right; stack_t[sp++] = tn1;
+    }
+  }
+
+  return (hit->tri >= 0) ? 1 : 0;
+}
+
+#endif
@@ -0,0 +1,333 @@
+// Two level instancing -=:LogicMonkey:=-
+//
+// A mesh is built once into a bottom level lm_bvh_flat (BLAS) in its own
+// object space. Each copy in the scene is an lm_inst - a pointer to a BLAS
+// plus an affine object to world transform - and a top level hierarchy (TLAS)
+// is built over the instances' world bounds with the same binned SAH code.
+//
+// At a TLAS leaf the world ray is taken into the instance's object space and
+// handed to lm_bvh_flat_intersect, so the mesh kernels never see a transform.
+// lm_ray_init normalises the object space direction, so with s the length of
+// the transformed unit direction
+//
+//   t_object = s.t_world
+//
+// which is used to carry the closest hit so far into the instance and bring
+// its hit back out.
+//
+// A transform is 3 rows of 4 - a 3x3 linear part and a translation column:
+//
+//   | m00 m01 m02 m03 |   world = M.object + T
+//   | m10 m11 m12 m13 |
+//   | m20 m21 m22 m23 |
+//
+#ifndef LM_INST_H
+#define LM_INST_H
+
+#include "lm_bvh.h"
+
+typedef struct {
+  float m[3][4];
+} lm_xform;
+
+typedef struct {
+  const lm_bvh_flat *blas;
+  lm_xform to_world;
+  lm_xform to_object;
+  lm_aabb box;              // world bounds
+} lm_inst;
+
+typedef struct {
+  lm_bvh_flat top;          // no triangle records, top.index is the instance
+  lm_inst *inst;            // instances in leaf order
+  int ninst;
+} lm_tlas;
+
+void lm_xform_identity( lm_xform *x ) {
+  int i, j;
+  for( i=0; i<3; i++ ) {
+    for( j=0; j<4; j++ ) {
+      x->m[i][j] = (i == j) ? 1.0f : 0.0f;
+    }
+  }
+}
+
+// r = a.b, b applied first - r may be a or b
+void lm_xform_mul( lm_xform *r, const lm_xform *a, const lm_xform *b ) {
+  lm_xform t;
+  int i, j;
+
+  for( i=0; i<3; i++ ) {
+    for( j=0; j<4; j++ ) {
+      t.m[i][j] = a->m[i][0]*b->m[0][j] + a->m[i][1]*b->m[1][j] + a->m[i][2]*b->m[2][j];
+    }
+    t.m[i][3] += a->m[i][3];
+  }
+  *r = t;
+}
+
+void lm_xform_translate( lm_xform *x, vec3 t ) {
+  lm_xform_identity( x );
+  x->m[0][3] = t.x;
+  x->m[1][3] = t.y;
+  x->m[2][3] = t.z;
+}
+
+void lm_xform_scale( lm_xform *x, float s ) {
+  lm_xform_identity( x );
+  x->m[0][0] = s;
+  x->m[1][1] = s;
+  x->m[2][2] = s;
+}
+
+// angle radians about axis, Rodrigues' formula
+void lm_xform_rotate( lm_xform *x, vec3 axis, float angle ) {
+  vec3 a;
+  float c = cos( angle ), s = sin( angle ), k = 1.0f - c;
+
+  lm_vec3_norm( &a, axis );
+  lm_xform_identity( x );
+  x->m[0][0] = c + a.x*a.x*k;
+  x->m[0][1] = a.x*a.y*k - a.z*s;
+  x->m[0][2] = a.x*a.z*k + a.y*s;
+  x->m[1][0] = a.y*a.x*k + a.z*s;
+  x->m[1][1] = c + a.y*a.y*k;
+  x->m[1][2] = a.y*a.z*k - a.x*s;
+  x->m[2][0] = a.z*a.x*k - a.y*s;
+  x->m[2][1] = a.z*a.y*k + a.x*s;
+  x->m[2][2] = c + a.z*a.z*k;
+}
+
+// returns 0, leaving r alone, if x is singular
+int lm_xform_invert( lm_xform *r, const lm_xform *x ) {
+  const float (*m)[4] = x->m;
+  float c00 = m[1][1]*m[2][2] - m[1][2]*m[2][1];
+  float c01 = m[1][2]*m[2][0] - m[1][0]*m[2][2];
+  float c02 = m[1][0]*m[2][1] - m[1][1]*m[2][0];
+  float det = m[0][0]*c00 + m[0][1]*c01 + m[0][2]*c02;
+  float id;
+  lm_xform t;
+  int i;
+
+  if( det == 0.0f ) {
+    return 0;
+  }
+  id = 1.0f / det;
+
+  // inverse of the linear part is the transposed cofactors over det
+  t.m[0][0] = c00 * id;
+  t.m[1][0] = c01 * id;
+  t.m[2][0] = c02 * id;
+  t.m[0][1] = (m[0][2]*m[2][1] - m[0][1]*m[2][2]) * id;
+  t.m[1][1] = (m[0][0]*m[2][2] - m[0][2]*m[2][0]) * id;
+  t.m[2][1] = (m[0][1]*m[2][0] - m[0][0]*m[2][1]) * id;
+  t.m[0][2] = (m[0][1]*m[1][2] - m[0][2]*m[1][1]) * id;
+  t.m[1][2] = (m[0][2]*m[1][0] - m[0][0]*m[1][2]) * id;
+  t.m[2][2] = (m[0][0]*m[1][1] - m[0][1]*m[1][0]) * id;
+
+  // and the translation is taken back through it
+  for( i=0; i<3; i++ ) {
+    t.m[i][3] = -(t.m[i][0]*m[0][3] + t.m[i][1]*m[1][3] + t.m[i][2]*m[2][3]);
+  }
+  *r = t;
+  return 1;
+}
+
+void lm_xform_point( vec3 *r, const lm_xform *x, vec3 p ) {
+  r->x = x->m[0][0]*p.x + x->m[0][1]*p.y + x->m[0][2]*p.z + x->m[0][3];
+  r->y = x->m[1][0]*p.x + x->m[1][1]*p.y + x->m[1][2]*p.z + x->m[1][3];
+  r->z = x->m[2][0]*p.x + x->m[2][1]*p.y + x->m[2][2]*p.z + x->m[2][3];
+}
+
+void lm_xform_vector( vec3 *r, const lm_xform *x, vec3 v ) {
+  r->x = x->m[0][0]*v.x + x->m[0][1]*v.y + x->m[0][2]*v.z;
+  r->y = x->m[1][0]*v.x + x->m[1][1]*v.y + x->m[1][2]*v.z;
+  r->z = x->m[2][0]*v.x + x->m[2][1]*v.y + x->m[2][2]*v.z;
+}
+
+// bounds of a transformed box, Arvo [1990] - each output extent is the sum of
+// the smaller and larger of every m.lo, m.hi product
+void lm_xform_box( lm_aabb *r, const lm_xform *x, const lm_aabb *b ) {
+  float lo[3], hi[3], a, c;
+  float blo[3] = { b->lo.x, b->lo.y, b->lo.z };
+  float bhi[3] = { b->hi.x, b->hi.y, b->hi.z };
+  int i, j;
+
+  for( i=0; i<3; i++ ) {
+    lo[i] = hi[i] = x->m[i][3];
+    for( j=0; j<3; j++ ) {
+      a = x->m[i][j] * blo[j];
+      c = x->m[i][j] * bhi[j];
+      lo[i] += MIN( a, c );
+      hi[i] += MAX( a, c );
+    }
+  }
+  r->lo.x = lo[0]; r->lo.y = lo[1]; r->lo.z = lo[2];
+  r->hi.x = hi[0]; r->hi.y = hi[1]; r->hi.z = hi[2];
+}
+
+// returns 0 if the transform can't be inverted
+int lm_inst_set( lm_inst *inst, const lm_bvh_flat *blas, const lm_xform *to_world ) {
+  lm_aabb b;
+
+  if( !lm_xform_invert( &inst->to_object, to_world )) {
+    return 0;
+  }
+  inst->blas     = blas;
+  inst->to_world = *to_world;
+
+  if( blas->ntri > 0 ) {
+    b.lo = blas->node[0].lo;
+    b.hi = blas->node[0].hi;
+    lm_xform_box( &inst->box, to_world, &b );
+  } else {
+    lm_aabb_empty( &inst->box );
+  }
+  return 1;
+}
+
+// world normal from an object space one - the inverse transpose
+void lm_inst_normal( vec3 *r, const lm_inst *inst, vec3 n ) {
+  const lm_xform *x = &inst->to_object;
+  r->x = x->m[0][0]*n.x + x->m[1][0]*n.y + x->m[2][0]*n.z;
+  r->y = x->m[0][1]*n.x + x->m[1][1]*n.y + x->m[2][1]*n.z;
+  r->z = x->m[0][2]*n.x + x->m[1][2]*n.y + x->m[2][2]*n.z;
+}
+
+void lm_tlas_free( lm_tlas *tlas ) {
+  lm_bvh_flat_free( &tlas->top );
+  free( tlas->inst );
+  tlas->inst = NULL;
+}
+
+// build over n instances, which are copied. Returns 0 on allocation failure.
+int lm_tlas_build( lm_tlas *tlas, const lm_inst *inst, int n ) {
+  lm_bvh tree;
+  lm_aabb *box = (lm_aabb *) malloc( (n > 0 ? n : 1) * sizeof(lm_aabb) );
+  int i, ok;
+
+  tlas->inst  = NULL;
+  tlas->ninst = n;
+  tlas->top.node  = NULL;
+  tlas->top.tri   = NULL;
+  tlas->top.index = NULL;
+
+  if( box == NULL ) {
+    return 0;
+  }
+  for( i=0; i<n; i++ ) {
+    box[i] = inst[i].box;
+  }
+
+  ok = lm_bvh_build_boxes( &tree, box, n );
+  free( box );
+  if( !ok ) {
+    return 0;
+  }
+
+  ok = lm_bvh_flatten( &tlas->top, &tree );
+  lm_bvh_free( &tree );
+  if( !ok ) {
+    return 0;
+  }
+
+  tlas->inst = (lm_inst *) malloc( (n > 0 ? n : 1) * sizeof(lm_inst) );
+  if( tlas->inst == NULL ) {
+    lm_tlas_free( tlas );
+    return 0;
+  }
+  for( i=0; i<n; i++ ) {
+    tlas->inst[i] = inst[tlas->top.index[i]];
+  }
+  return 1;
+}
+
+// trace r through one instance, updating hit if it is closer
+int lm_inst_intersect( const lm_inst *inst, const lm_ray *r, lm_hit *hit ) {
+  vec3 o, d;
+  float s;
+  lm_ray obj;
+  lm_hit h;
+
+  lm_xform_point( &o, &inst->to_object, r->o );
+  lm_xform_vector( &d, &inst->to_object, r->d );
+  s = sqrt( d.x*d.x + d.y*d.y + d.z*d.z );
+  lm_ray_init( &obj, o, d );
+
+  if( lm_bvh_flat_intersect( inst->blas, &obj, hit->t * s, &h ) && h.t / s < hit->t ) {
+    hit->t     = h.t / s;
+    hit->beta  = h.beta;
+    hit->gamma = h.gamma;
+    hit->tri   = h.tri;
+    hit->rec   = h.rec;
+    return 1;
+  }
+  return 0;
+}
+
+//
+// Closest hit along r in [0, tmax). hit->tri and hit->rec refer to the
+// instance's BLAS and *inst is the instance's slot in tlas->inst -
+// tlas->top.index[*inst] is its index as passed to lm_tlas_build.
+//
+int lm_tlas_intersect( const lm_tlas *tlas, const lm_ray *r, float tmax, lm_hit *hit, int *inst ) {
+  int   stack[LM_BVH_STACK];
+  float stack_t[LM_BVH_STACK];
+  int sp = 0, i, n, left, right;
+  float tn, tf, tn1, tf1;
+  const lm_bvh_flat_node *node = tlas->top.node;
+
+  hit->t   = tmax;
+  hit->tri = -1;
+  *inst    = -1;
+
+  if( tlas->ninst == 0 || !lm_ray_slab( r, node[0].lo, node[0].hi, tmax, &tn, &tf )) {
+    return 0;
+  }
+
+  stack[sp] = 0;
+  stack_t[sp++] = tn;
+
+  while( sp > 0 ) {
+    n = stack[--sp];
+    LM_BVH_VISIT();
+
+    if( stack_t[sp] >= hit->t ) {
+      continue;
+    }
+
+    if( node[n].count > 0 ) {
+      for( i=node[n].offset; i<node[n].offset+node[n].count; i++ ) {
+        if( lm_ray_slab( r, tlas->inst[i].box.lo, tlas->inst[i].box.hi, hit->t, &tn, &tf ) &&
+            lm_inst_intersect( &tlas->inst[i], r, hit )) {
+          *inst = i;
+        }
+      }
+      continue;
+    }
+
+    left  = n + 1;
+    right = node[n].offset;
+
+    int hl = lm_ray_slab( r, node[left].lo, node[left].hi, hit->t, &tn, &tf );
+    int hr = lm_ray_slab( r, node[right].lo, node[right].hi, hit->t, &tn1, &tf1 );
+
+    if( hl && hr ) {
+      if( tn <= tn1 ) {
+        stack[sp] = right; stack_t[sp++] = tn1;
+        stack[sp] = left;  stack_t[sp++] = tn;
+      } else {
+        stack[sp] = left;  stack_t[sp++] = tn;
+        stack[sp] = right; stack_t[sp++] = tn1;
+      }
+    } else if( hl ) {
+      stack[sp] = left;  stack_t[sp++] = tn;
+    } else if( hr ) {
+      stack[sp] = right; stack_t[sp++] = tn1;
+    }
+  }
+
+  return (hit->tri >= 0) ? 1 : 0;
+}
+
+#endif
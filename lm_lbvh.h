@@ -0,0 +1,478 @@
+// Linear BVH builder -=:LogicMonkey:=-
+//
+// The binned SAH build in lm_bvh.h is too slow to redo every frame for a big
+// dynamic scene. This builds a linear BVH (Lauterbach et al. [2009]) the way
+// Karras [2012] does, every stage a parallel loop:
+//
+//   1. triangle bounds, centroids and the centroid bounds of the scene
+//   2. 30 bit Morton code of each centroid - 10 bits an axis, interleaved
+//   3. LSD radix sort of the codes, 3 passes of 10 bits, per thread
+//      histograms then a scatter
+//   4. each internal node i of the n-1 found on its own from the sorted codes
+//      - its range [first, last] is grown from i in the direction of the
+//      longer common prefix and split where the prefix changes
+//   5. bounds bottom up - every leaf walks towards the root and the second
+//      thread to reach a node does its union, the first one stops there
+//   6. emission into an lm_bvh_flat, depth first - the top of the tree is
+//      laid out serially until there are enough subtrees to go round the
+//      threads, which then pull subtrees and lay out each one recursively
+//
+// Subtrees of LM_LBVH_LEAF triangles or fewer become one leaf. The sorted
+// order is the leaf order so the triangle records are built straight into it,
+// and the result is traversed with lm_bvh_flat_intersect like any other.
+//
+// Duplicate codes are split on their sorted position, so the tree is never
+// deeper than 30 + log2(duplicates) levels.
+//
+//   gcc ... -pthread
+//
+#ifndef LM_LBVH_H
+#define LM_LBVH_H
+
+#include "lm_bvh.h"
+#include "lm_par.h"
+
+#define LM_LBVH_LEAF  4
+#define LM_LBVH_RADIX 10
+#define LM_LBVH_JOBS  16      // subtrees a thread for the emission pass
+
+// sorted position k is referred to as ~k when it is a leaf of the radix tree
+typedef struct {
+  lm_aabb box;
+  int left, right;
+  int first, last;
+  int parent;
+  int size;           // flat nodes emitted for this subtree
+  int flag;           // children finished, for the bottom up pass
+} lm_lbvh_node;
+
+typedef struct {
+  const vec3 *v;
+  int ntri, nthreads;
+  lm_aabb *box;
+  vec3 *centre;
+  lm_aabb tbox[LM_PAR_MAX];   // per thread centroid bounds
+  lm_aabb cbox;
+  unsigned int *code, *code_tmp;
+  int *id, *id_tmp;
+  int *hist;                  // nthreads x (1 << LM_LBVH_RADIX)
+  int shift;
+  lm_lbvh_node *node;
+  int *leaf_parent;
+  lm_bvh_flat *flat;
+  int *job_ref, *job_pos;
+  int jobs, next_job;
+} lm_lbvh_ctx;
+
+// 10 bits spread out to every third bit
+unsigned int lm_morton_expand( unsigned int a ) {
+  a = (a * 0x00010001u) & 0xFF0000FFu;
+  a = (a * 0x00000101u) & 0x0F00F00Fu;
+  a = (a * 0x00000011u) & 0xC30C30C3u;
+  a = (a * 0x00000005u) & 0x49249249u;
+  return a;
+}
+
+// p in [0,1]^3
+unsigned int lm_morton3( float x, float y, float z ) {
+  x = MIN( MAX( x * 1024.0f, 0.0f ), 1023.0f );
+  y = MIN( MAX( y * 1024.0f, 0.0f ), 1023.0f );
+  z = MIN( MAX( z * 1024.0f, 0.0f ), 1023.0f );
+  return (lm_morton_expand( (unsigned int) x ) << 2) |
+         (lm_morton_expand( (unsigned int) y ) << 1) |
+          lm_morton_expand( (unsigned int) z );
+}
+
+void lm_lbvh_bounds( void *arg, int first, int last, int thread ) {
+  lm_lbvh_ctx *ctx = (lm_lbvh_ctx *) arg;
+  const vec3 *v = ctx->v;
+  int i;
+
+  lm_aabb_empty( &ctx->tbox[thread] );
+  for( i=first; i<last; i++ ) {
+    lm_aabb_empty( &ctx->box[i] );
+    lm_aabb_grow( &ctx->box[i], v[3*i] );
+    lm_aabb_grow( &ctx->box[i], v[3*i+1] );
+    lm_aabb_grow( &ctx->box[i], v[3*i+2] );
+    ctx->centre[i].x = (ctx->box[i].lo.x + ctx->box[i].hi.x) * 0.5f;
+    ctx->centre[i].y = (ctx->box[i].lo.y + ctx->box[i].hi.y) * 0.5f;
+    ctx->centre[i].z = (ctx->box[i].lo.z + ctx->box[i].hi.z) * 0.5f;
+    lm_aabb_grow( &ctx->tbox[thread], ctx->centre[i] );
+  }
+}
+
+void lm_lbvh_codes( void *arg, int first, int last, int thread ) {
+  lm_lbvh_ctx *ctx = (lm_lbvh_ctx *) arg;
+  vec3 lo = ctx->cbox.lo;
+  float sx = ctx->cbox.hi.x - lo.x;
+  float sy = ctx->cbox.hi.y - lo.y;
+  float sz = ctx->cbox.hi.z - lo.z;
+  int i;
+
+  (void) thread;
+
+  // a flat scene has no extent on some axis
+  sx = (sx > 0.0f) ? 1.0f / sx : 0.0f;
+  sy = (sy > 0.0f) ? 1.0f / sy : 0.0f;
+  sz = (sz > 0.0f) ? 1.0f / sz : 0.0f;
+
+  for( i=first; i<last; i++ ) {
+    ctx->code[i] = lm_morton3( (ctx->centre[i].x - lo.x) * sx,
+                               (ctx->centre[i].y - lo.y) * sy,
+                               (ctx->centre[i].z - lo.z) * sz );
+    ctx->id[i] = i;
+  }
+}
+
+void lm_lbvh_histogram( void *arg, int first, int last, int thread ) {
+  lm_lbvh_ctx *ctx = (lm_lbvh_ctx *) arg;
+  int *hist = &ctx->hist[thread << LM_LBVH_RADIX];
+  int i;
+
+  memset( hist, 0, sizeof(int) << LM_LBVH_RADIX );
+  for( i=first; i<last; i++ ) {
+    hist[(ctx->code[i] >> ctx->shift) & ((1 << LM_LBVH_RADIX) - 1)]++;
+  }
+}
+
+// each thread scatters its own chunk, in order, so the sort is stable
+void lm_lbvh_scatter( void *arg, int first, int last, int thread ) {
+  lm_lbvh_ctx *ctx = (lm_lbvh_ctx *) arg;
+  int *hist = &ctx->hist[thread << LM_LBVH_RADIX];
+  int i, d;
+
+  for( i=first; i<last; i++ ) {
+    d = hist[(ctx->code[i] >> ctx->shift) & ((1 << LM_LBVH_RADIX) - 1)]++;
+    ctx->code_tmp[d] = ctx->code[i];
+    ctx->id_tmp[d]   = ctx->id[i];
+  }
+}
+
+void lm_lbvh_sort( lm_lbvh_ctx *ctx ) {
+  int pass, d, t, sum, c;
+  unsigned int *swap_code;
+  int *swap_id;
+
+  for( pass=0; pass<3; pass++ ) {
+    ctx->shift = pass * LM_LBVH_RADIX;
+    lm_par_for( ctx->ntri, ctx->nthreads, lm_lbvh_histogram, ctx );
+
+    // digit major, thread minor - turns the counts into scatter offsets
+    sum = 0;
+    for( d=0; d<(1 << LM_LBVH_RADIX); d++ ) {
+      for( t=0; t<ctx->nthreads; t++ ) {
+        c = ctx->hist[(t << LM_LBVH_RADIX) + d];
+        ctx->hist[(t << LM_LBVH_RADIX) + d] = sum;
+        sum += c;
+      }
+    }
+
+    lm_par_for( ctx->ntri, ctx->nthreads, lm_lbvh_scatter, ctx );
+
+    swap_code = ctx->code; ctx->code = ctx->code_tmp; ctx->code_tmp = swap_code;
+    swap_id   = ctx->id;   ctx->id   = ctx->id_tmp;   ctx->id_tmp   = swap_id;
+  }
+}
+
+// length of the common prefix of sorted keys i and j, -1 off the end. Equal
+// codes carry on into the positions so every key is distinct.
+int lm_lbvh_delta( const lm_lbvh_ctx *ctx, int i, int j ) {
+  unsigned int a, b;
+
+  if( j < 0 || j >= ctx->ntri ) {
+    return -1;
+  }
+  a = ctx->code[i];
+  b = ctx->code[j];
+  if( a == b ) {
+    return 32 + __builtin_clz( (unsigned int) (i ^ j) );
+  }
+  return __builtin_clz( a ^ b );
+}
+
+void lm_lbvh_internal( void *arg, int first, int last, int thread ) {
+  lm_lbvh_ctx *ctx = (lm_lbvh_ctx *) arg;
+  int i, d, dmin, lmax, l, t, j, dnode, s, split;
+
+  (void) thread;
+  for( i=first; i<last; i++ ) {
+    lm_lbvh_node *node = &ctx->node[i];
+
+    // direction of the range from the longer prefix with a neighbour
+    d = (lm_lbvh_delta( ctx, i, i+1 ) - lm_lbvh_delta( ctx, i, i-1 ) >= 0) ? 1 : -1;
+    dmin = lm_lbvh_delta( ctx, i, i-d );
+
+    // upper bound on the range length, then binary search for the far end
+    lmax = 2;
+    while( lm_lbvh_delta( ctx, i, i + lmax*d ) > dmin ) {
+      lmax *= 2;
+    }
+    l = 0;
+    for( t=lmax/2; t>=1; t/=2 ) {
+      if( lm_lbvh_delta( ctx, i, i + (l+t)*d ) > dmin ) {
+        l += t;
+      }
+    }
+    j = i + l*d;
+
+    // binary search for where the node's common prefix ends
+    dnode = lm_lbvh_delta( ctx, i, j );
+    s = 0;
+    t = l;
+    do {
+      t = (t + 1) >> 1;
+      if( lm_lbvh_delta( ctx, i, i + (s+t)*d ) > dnode ) {
+        s += t;
+      }
+    } while( t > 1 );
+    split = i + s*d + MIN( d, 0 );
+
+    node->first = MIN( i, j );
+    node->last  = MAX( i, j );
+    node->flag  = 0;
+
+    if( node->first == split ) {
+      node->left = ~split;
+      ctx->leaf_parent[split] = i;
+    } else {
+      node->left = split;
+      ctx->node[split].parent = i;
+    }
+    if( node->last == split + 1 ) {
+      node->right = ~(split + 1);
+      ctx->leaf_parent[split + 1] = i;
+    } else {
+      node->right = split + 1;
+      ctx->node[split + 1].parent = i;
+    }
+  }
+}
+
+void lm_lbvh_child( const lm_lbvh_ctx *ctx, int ref, lm_aabb *box, int *size ) {
+  if( ref < 0 ) {
+    *box  = ctx->box[ctx->id[~ref]];
+    *size = 1;
+  } else {
+    *box  = ctx->node[ref].box;
+    *size = ctx->node[ref].size;
+  }
+}
+
+void lm_lbvh_refit( void *arg, int first, int last, int thread ) {
+  lm_lbvh_ctx *ctx = (lm_lbvh_ctx *) arg;
+  lm_aabb b;
+  int i, n, sl, sr;
+
+  (void) thread;
+  for( i=first; i<last; i++ ) {
+    n = ctx->leaf_parent[i];
+
+    while( n >= 0 ) {
+      lm_lbvh_node *node = &ctx->node[n];
+
+      // the first child home leaves the node to its sibling
+      if( __atomic_fetch_add( &node->flag, 1, __ATOMIC_ACQ_REL ) == 0 ) {
+        break;
+      }
+
+      lm_lbvh_child( ctx, node->left, &node->box, &sl );
+      lm_lbvh_child( ctx, node->right, &b, &sr );
+      lm_aabb_union( &node->box, &b );
+
+      if( node->last - node->first + 1 <= LM_LBVH_LEAF ) {
+        node->size = 1;
+      } else {
+        node->size = 1 + sl + sr;
+      }
+
+      // publish the box and size before the parent's flag is bumped
+      __atomic_thread_fence( __ATOMIC_RELEASE );
+      n = node->parent;
+    }
+  }
+}
+
+// write the subtree ref at flat position pos, returns 1 if it was made a leaf
+int lm_lbvh_emit_node( lm_lbvh_ctx *ctx, int ref, int pos ) {
+  lm_bvh_flat_node *out = &ctx->flat->node[pos];
+
+  if( ref < 0 ) {
+    out->lo     = ctx->box[ctx->id[~ref]].lo;
+    out->hi     = ctx->box[ctx->id[~ref]].hi;
+    out->offset = ~ref;
+    out->count  = 1;
+    return 1;
+  }
+
+  lm_lbvh_node *node = &ctx->node[ref];
+  out->lo = node->box.lo;
+  out->hi = node->box.hi;
+
+  if( node->last - node->first + 1 <= LM_LBVH_LEAF ) {
+    out->offset = node->first;
+    out->count  = node->last - node->first + 1;
+    return 1;
+  }
+
+  // left child follows, the right one after the left subtree
+  out->offset = pos + 1 + ((node->left < 0) ? 1 : ctx->node[node->left].size);
+  out->count  = 0;
+  return 0;
+}
+
+void lm_lbvh_emit( lm_lbvh_ctx *ctx, int ref, int pos ) {
+  if( !lm_lbvh_emit_node( ctx, ref, pos )) {
+    lm_lbvh_emit( ctx, ctx->node[ref].left, pos + 1 );
+    lm_lbvh_emit( ctx, ctx->node[ref].right, ctx->flat->node[pos].offset );
+  }
+}
+
+void lm_lbvh_emit_jobs( void *arg, int first, int last, int thread ) {
+  lm_lbvh_ctx *ctx = (lm_lbvh_ctx *) arg;
+  int j;
+
+  (void) first;
+  (void) last;
+  (void) thread;
+
+  // subtrees vary in size, so pull them rather than take a fixed chunk
+  while( (j = __atomic_fetch_add( &ctx->next_job, 1, __ATOMIC_RELAXED )) < ctx->jobs ) {
+    lm_lbvh_emit( ctx, ctx->job_ref[j], ctx->job_pos[j] );
+  }
+}
+
+void lm_lbvh_records( void *arg, int first, int last, int thread ) {
+  lm_lbvh_ctx *ctx = (lm_lbvh_ctx *) arg;
+  const vec3 *v = ctx->v;
+  int i, j;
+
+  (void) thread;
+  for( i=first; i<last; i++ ) {
+    j = ctx->id[i];
+    lm_tri_build( &ctx->flat->tri[i], v[3*j], v[3*j+1], v[3*j+2] );
+    ctx->flat->index[i] = j;
+  }
+}
+
+void lm_lbvh_free_ctx( lm_lbvh_ctx *ctx ) {
+  free( ctx->box );
+  free( ctx->centre );
+  free( ctx->code );
+  free( ctx->code_tmp );
+  free( ctx->id );
+  free( ctx->id_tmp );
+  free( ctx->hist );
+  free( ctx->node );
+  free( ctx->leaf_parent );
+  free( ctx->job_ref );
+  free( ctx->job_pos );
+}
+
+//
+// Build over a soup of ntri triangles held as 3*ntri vertices using nthreads
+// threads, 0 for every core. Returns 0 on allocation failure.
+//
+int lm_lbvh_build( lm_bvh_flat *flat, const vec3 *v, int ntri, int nthreads ) {
+  lm_lbvh_ctx ctx;
+  int n = (ntri > 0) ? ntri : 1;
+  int t, j, split, cap, root, nodes;
+
+  memset( &ctx, 0, sizeof(ctx) );
+  ctx.v        = v;
+  ctx.ntri     = ntri;
+  ctx.nthreads = (nthreads > 0) ? MIN( nthreads, LM_PAR_MAX ) : lm_par_threads();
+  ctx.flat     = flat;
+
+  cap = LM_LBVH_JOBS * ctx.nthreads + 1;
+
+  ctx.box         = (lm_aabb *) malloc( n * sizeof(lm_aabb) );
+  ctx.centre      = (vec3 *) malloc( n * sizeof(vec3) );
+  ctx.code        = (unsigned int *) malloc( n * sizeof(unsigned int) );
+  ctx.code_tmp    = (unsigned int *) malloc( n * sizeof(unsigned int) );
+  ctx.id          = (int *) malloc( n * sizeof(int) );
+  ctx.id_tmp      = (int *) malloc( n * sizeof(int) );
+  ctx.hist        = (int *) malloc( (ctx.nthreads << LM_LBVH_RADIX) * sizeof(int) );
+  ctx.node        = (lm_lbvh_node *) malloc( n * sizeof(lm_lbvh_node) );
+  ctx.leaf_parent = (int *) malloc( n * sizeof(int) );
+  ctx.job_ref     = (int *) malloc( cap * sizeof(int) );
+  ctx.job_pos     = (int *) malloc( cap * sizeof(int) );
+
+  flat->node  = NULL;
+  flat->ntri  = ntri;
+  flat->tri   = (lm_tri *) aligned_alloc( 64, n * sizeof(lm_tri) );
+  flat->index = (int *) malloc( n * sizeof(int) );
+
+  if( ctx.box == NULL || ctx.centre == NULL || ctx.code == NULL || ctx.code_tmp == NULL ||
+      ctx.id == NULL || ctx.id_tmp == NULL || ctx.hist == NULL || ctx.node == NULL ||
+      ctx.leaf_parent == NULL || ctx.job_ref == NULL || ctx.job_pos == NULL ||
+      flat->tri == NULL || flat->index == NULL ) {
+    lm_lbvh_free_ctx( &ctx );
+    lm_bvh_flat_free( flat );
+    return 0;
+  }
+
+  // 1, 2 - bounds and codes
+  lm_par_for( ntri, ctx.nthreads, lm_lbvh_bounds, &ctx );
+  lm_aabb_empty( &ctx.cbox );
+  for( t=0; t<ctx.nthreads; t++ ) {
+    lm_aabb_union( &ctx.cbox, &ctx.tbox[t] );
+  }
+  lm_par_for( ntri, ctx.nthreads, lm_lbvh_codes, &ctx );
+
+  // 3 - sort
+  lm_lbvh_sort( &ctx );
+
+  // 4, 5 - topology then bounds
+  if( ntri > 1 ) {
+    ctx.node[0].parent = -1;
+    lm_par_for( ntri - 1, ctx.nthreads, lm_lbvh_internal, &ctx );
+    lm_par_for( ntri, ctx.nthreads, lm_lbvh_refit, &ctx );
+    root  = 0;
+    nodes = ctx.node[0].size;
+  } else {
+    ctx.leaf_parent[0] = -1;
+    root  = ~0;
+    nodes = 1;
+  }
+
+  flat->nodes = nodes;
+  flat->node  = (lm_bvh_flat_node *) aligned_alloc( 64, ((nodes * sizeof(lm_bvh_flat_node) + 63) & ~63) );
+  if( flat->node == NULL ) {
+    lm_lbvh_free_ctx( &ctx );
+    lm_bvh_flat_free( flat );
+    return 0;
+  }
+
+  // 6 - lay out the top of the tree, replacing each node by its children,
+  // until there is a subtree for every job, then hand them to the threads
+  ctx.jobs = 0;
+  if( ntri > 0 ) {
+    ctx.job_ref[0] = root;
+    ctx.job_pos[0] = 0;
+    ctx.jobs = 1;
+  }
+  for( split=1; split && ctx.jobs < LM_LBVH_JOBS * ctx.nthreads; ) {
+    split = 0;
+    for( j=0; j<ctx.jobs && ctx.jobs < LM_LBVH_JOBS * ctx.nthreads; j++ ) {
+      int ref = ctx.job_ref[j];
+      int pos = ctx.job_pos[j];
+
+      if( ref >= 0 && !lm_lbvh_emit_node( &ctx, ref, pos )) {
+        ctx.job_ref[j] = ctx.node[ref].left;
+        ctx.job_pos[j] = pos + 1;
+        ctx.job_ref[ctx.jobs] = ctx.node[ref].right;
+        ctx.job_pos[ctx.jobs++] = flat->node[pos].offset;
+        split = 1;
+      }
+    }
+  }
+  ctx.next_job = 0;
+  lm_par_for( ctx.nthreads, ctx.nthreads, lm_lbvh_emit_jobs, &ctx );
+
+  lm_par_for( ntri, ctx.nthreads, lm_lbvh_records, &ctx );
+
+  lm_lbvh_free_ctx( &ctx );
+  return 1;
+}
+
+#endif
@@ -0,0 +1,73 @@
+// Fork/join parallel loop over pthreads -=:LogicMonkey:=-
+//
+// lm_par_for splits [0, n) into nthreads contiguous chunks and runs fn on each,
+// the calling thread taking chunk 0. Chunk t is always
+//
+//   [ n*t/nthreads, n*(t+1)/nthreads )
+//
+// so passes that must agree on which thread owned which items (histogram then
+// scatter in a radix sort, say) can rely on it. Threads are created per call -
+// fine for the handful of passes in a build, not for per pixel work.
+//
+//   gcc ... -pthread
+//
+#ifndef LM_PAR_H
+#define LM_PAR_H
+
+#include <pthread.h>
+#include <unistd.h>
+
+#define LM_PAR_MAX 64
+
+typedef void (*lm_par_fn)( void *arg, int first, int last, int thread );
+
+typedef struct {
+  lm_par_fn fn;
+  void *arg;
+  int first, last, thread;
+} lm_par_job;
+
+// all online cores, capped at LM_PAR_MAX
+int lm_par_threads() {
+  long n = sysconf( _SC_NPROCESSORS_ONLN );
+  return (n < 1) ? 1 : (n > LM_PAR_MAX) ? LM_PAR_MAX : (int) n;
+}
+
+void *lm_par_run( void *p ) {
+  lm_par_job *job = (lm_par_job *) p;
+  job->fn( job->arg, job->first, job->last, job->thread );
+  return NULL;
+}
+
+void lm_par_for( int n, int nthreads, lm_par_fn fn, void *arg ) {
+  pthread_t tid[LM_PAR_MAX];
+  lm_par_job job[LM_PAR_MAX];
+  int started[LM_PAR_MAX];
+  int t;
+
+  nthreads = (nthreads < 1) ? 1 : (nthreads > LM_PAR_MAX) ? LM_PAR_MAX : nthreads;
+
+  for( t=0; t<nthreads; t++ ) {
+    job[t].fn     = fn;
+    job[t].arg    = arg;
+    job[t].first  = (int) ((long) n * t / nthreads);
+    job[t].last   = (int) ((long) n * (t + 1) / nthreads);
+    job[t].thread = t;
+    started[t] = 0;
+  }
+
+  // if a thread can't be made its chunk is just run here instead
+  for( t=1; t<nthreads; t++ ) {
+    started[t] = (pthread_create( &tid[t], NULL, lm_par_run, &job[t] ) == 0);
+  }
+  lm_par_run( &job[0] );
+  for( t=1; t<nthreads; t++ ) {
+    if( started[t] ) {
+      pthread_join( tid[t], NULL );
+    } else {
+      lm_par_run( &job[t] );
+    }
+  }
+}
+
+#endif
@@ -0,0 +1,354 @@
+// Parallel PNG writer -=:LogicMonkey:=-
+//
+// libpng filters and deflates one row after another on one thread, which is
+// all the time a big image takes once the rays are traced on every core.
+// lm_png_write cuts the image into stripes of rows and filters and deflates
+// each on its own thread, then writes the pieces out one IDAT chunk each.
+//
+// A stripe is a raw deflate stream of its own, ended with Z_SYNC_FLUSH - that
+// leaves it on a byte boundary with no final block, so the next stripe's
+// blocks simply follow on. Only the last stripe ends with Z_FINISH. Stripes
+// never refer back into the one before, which costs a little size at each
+// boundary. The zlib header goes in front of the first stripe and the Adler-32
+// of the whole image, joined up from the stripes' own with adler32_combine,
+// after the last. A chunk is at most 2^31 - 1 bytes, so a stripe bigger than
+// that is split over several.
+//
+// Filtering needs the row above, so a stripe asks for the row before its
+// first one too - the filtered bytes are the same as a serial writer's.
+//
+//   LM_PNG_FILTER_NONE .. LM_PNG_FILTER_PAETH   one filter on every row
+//   LM_PNG_FILTER_ADAPTIVE                      per row, least sum of |bytes|
+//   level 0 (stored) .. 9 (smallest), -1 for zlib's default
+//
+// LM_PNG_FILTER and LM_PNG_LEVEL are the drivers' choice, -D to trade speed
+// against size.
+//
+//   gcc ... -lz -pthread
+//
+#ifndef LM_PNG_H
+#define LM_PNG_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <zlib.h>
+#include "lm_par.h"
+
+#define LM_PNG_FILTER_NONE     0
+#define LM_PNG_FILTER_SUB      1
+#define LM_PNG_FILTER_UP       2
+#define LM_PNG_FILTER_AVG      3
+#define LM_PNG_FILTER_PAETH    4
+#define LM_PNG_FILTER_ADAPTIVE 5
+
+#ifndef LM_PNG_FILTER
+#define LM_PNG_FILTER LM_PNG_FILTER_ADAPTIVE
+#endif
+
+#ifndef LM_PNG_LEVEL
+#define LM_PNG_LEVEL 6
+#endif
+
+#ifndef LM_PNG_STRIPE
+#define LM_PNG_STRIPE 64              // rows per stripe
+#endif
+
+#define LM_PNG_CHUNK_MAX 0x7fffffffUL // longest chunk data the format allows
+
+// fill rgb with row y of the image, 3 bytes a pixel
+typedef void (*lm_png_row_fn)( void *arg, int y, unsigned char *rgb );
+
+typedef struct {
+  unsigned char *z;                   // deflated stripe, zlib header or trailer included
+  unsigned long size;
+  unsigned long raw;                  // filtered bytes in, for adler32_combine
+  unsigned long adler;
+  int ok;
+} lm_png_stripe;
+
+typedef struct {
+  int width, height, rows, filter, level;
+  lm_png_row_fn row;
+  void *arg;
+  lm_png_stripe *stripe;
+} lm_png_ctx;
+
+int lm_png_paeth( int a, int b, int c ) {
+  int p  = a + b - c;
+  int pa = abs( p - a );
+  int pb = abs( p - b );
+  int pc = abs( p - c );
+
+  return (pa <= pb && pa <= pc) ? a : (pb <= pc) ? b : c;
+}
+
+// filter one row of n bytes into out (type byte first), prev all zero for the
+// top row
+void lm_png_filter( unsigned char *out, const unsigned char *cur, const unsigned char *prev, int n, int type ) {
+  int i;
+
+  // the first pixel has nothing to its left, a and c are 0
+  out[0] = type;
+  out++;
+  switch( type ) {
+    case LM_PNG_FILTER_NONE:
+      memcpy( out, cur, n );
+      break;
+    case LM_PNG_FILTER_SUB:
+      for( i=0; i<3; i++ )  out[i] = cur[i];
+      for( i=3; i<n; i++ )  out[i] = cur[i] - cur[i-3];
+      break;
+    case LM_PNG_FILTER_UP:
+      for( i=0; i<n; i++ )  out[i] = cur[i] - prev[i];
+      break;
+    case LM_PNG_FILTER_AVG:
+      for( i=0; i<3; i++ )  out[i] = cur[i] - (prev[i] >> 1);
+      for( i=3; i<n; i++ )  out[i] = cur[i] - ((cur[i-3] + prev[i]) >> 1);
+      break;
+    default:
+      for( i=0; i<3; i++ )  out[i] = cur[i] - prev[i];
+      for( i=3; i<n; i++ )  out[i] = cur[i] - lm_png_paeth( cur[i-3], prev[i], prev[i-3] );
+      break;
+  }
+}
+
+// the filter whose output bytes, taken as signed, sum smallest - the usual
+// heuristic (libpng's too)
+void lm_png_filter_adaptive( unsigned char *out, unsigned char *tmp, const unsigned char *cur,
+                             const unsigned char *prev, int n ) {
+  int type, i;
+  long sum, best = -1;
+
+  for( type=LM_PNG_FILTER_NONE; type<=LM_PNG_FILTER_PAETH; type++ ) {
+    lm_png_filter( tmp, cur, prev, n, type );
+    sum = 0;
+    for( i=1; i<=n; i++ ) {
+      sum += (tmp[i] < 128) ? tmp[i] : 256 - tmp[i];
+    }
+    if( best < 0 || sum < best ) {
+      best = sum;
+      memcpy( out, tmp, n + 1 );
+    }
+  }
+}
+
+void lm_png_stripe_run( lm_png_ctx *ctx, int s ) {
+  lm_png_stripe *out = &ctx->stripe[s];
+  int n = 3 * ctx->width;
+  int y0 = s * ctx->rows;
+  int y1 = (y0 + ctx->rows < ctx->height) ? y0 + ctx->rows : ctx->height;
+  int last = (y1 == ctx->height);
+  int head = (s == 0) ? 2 : 0;        // room for the zlib header
+  int y;
+  unsigned long raw = (unsigned long) (y1 - y0) * (n + 1);
+  unsigned char *prev, *cur, *swap, *tmp, *filtered;
+  z_stream z;
+
+  out->ok = 0;
+  out->z  = NULL;
+
+  prev     = (unsigned char *) calloc( n, 1 );
+  cur      = (unsigned char *) malloc( n );
+  tmp      = (unsigned char *) malloc( n + 1 );
+  filtered = (unsigned char *) malloc( raw );
+
+  if( prev == NULL || cur == NULL || tmp == NULL || filtered == NULL ) {
+    goto done;
+  }
+
+  if( y0 > 0 ) {
+    ctx->row( ctx->arg, y0 - 1, prev );
+  }
+  for( y=y0; y<y1; y++ ) {
+    ctx->row( ctx->arg, y, cur );
+    if( ctx->filter == LM_PNG_FILTER_ADAPTIVE ) {
+      lm_png_filter_adaptive( filtered + (unsigned long) (y - y0) * (n + 1), tmp, cur, prev, n );
+    } else {
+      lm_png_filter( filtered + (unsigned long) (y - y0) * (n + 1), cur, prev, n, ctx->filter );
+    }
+    swap = prev;
+    prev = cur;
+    cur  = swap;
+  }
+
+  memset( &z, 0, sizeof(z) );
+  if( deflateInit2( &z, ctx->level, Z_DEFLATED, -15, 8,
+                    (ctx->filter == LM_PNG_FILTER_NONE) ? Z_DEFAULT_STRATEGY : Z_FILTERED ) != Z_OK ) {
+    goto done;
+  }
+
+  // room for the worst case plus the sync flush's empty stored block, and
+  // the zlib header and trailer
+  out->size = deflateBound( &z, raw ) + 16;
+  out->z = (unsigned char *) malloc( head + out->size + 4 );
+  if( out->z != NULL ) {
+    z.next_in   = filtered;
+    z.avail_in  = raw;
+    z.next_out  = out->z + head;
+    z.avail_out = out->size;
+    if( deflate( &z, last ? Z_FINISH : Z_SYNC_FLUSH ) == (last ? Z_STREAM_END : Z_OK ) && z.avail_in == 0 ) {
+      out->size  = head + out->size - z.avail_out;
+      out->raw   = raw;
+      out->adler = adler32( adler32( 0L, Z_NULL, 0 ), filtered, raw );
+      out->ok    = 1;
+    }
+  }
+  deflateEnd( &z );
+
+  done:
+  free( prev );
+  free( cur );
+  free( tmp );
+  free( filtered );
+}
+
+void lm_png_worker( void *arg, int first, int last, int thread ) {
+  int s;
+
+  (void) thread;
+  for( s=first; s<last; s++ ) {
+    lm_png_stripe_run( (lm_png_ctx *) arg, s );
+  }
+}
+
+void lm_png_be32( unsigned char *p, unsigned long v ) {
+  p[0] = v >> 24;
+  p[1] = v >> 16;
+  p[2] = v >> 8;
+  p[3] = v;
+}
+
+// one whole chunk - length, type, data, CRC
+int lm_png_chunk( FILE *fp, const char *type, const unsigned char *data, unsigned long size ) {
+  unsigned char head[8], tail[4];
+  unsigned long crc;
+
+  lm_png_be32( head, size );
+  memcpy( head + 4, type, 4 );
+  crc = crc32( crc32( 0L, Z_NULL, 0 ), head + 4, 4 );
+  if( size > 0 ) {
+    crc = crc32( crc, data, size );   // crc32 of a NULL buffer is 0, not crc
+  }
+  lm_png_be32( tail, crc );
+
+  return fwrite( head, 8, 1, fp ) == 1 && (size == 0 || fwrite( data, size, 1, fp ) == 1)
+      && fwrite( tail, 4, 1, fp ) == 1;
+}
+
+//
+// Write a width x height 8 bit RGB PNG, rows from row, with the given filter
+// (LM_PNG_FILTER_*) and zlib level on nthreads threads (0 for all cores).
+// title goes in a tEXt chunk unless NULL. Returns 0 on success, 1 on failure
+// with a message on stderr.
+//
+int lm_png_write( const char *filename, int width, int height, lm_png_row_fn row, void *arg,
+                  const char *title, int filter, int level, int nthreads ) {
+  static const unsigned char sig[8] = { 137, 'P', 'N', 'G', '\r', '\n', 26, '\n' };
+  unsigned char ihdr[13];
+  unsigned long adler, off, part;
+  unsigned char *text = NULL;
+  lm_png_ctx ctx;
+  FILE *fp = NULL;
+  int code = 1, stripes, s, ok;
+
+  ctx.width  = width;
+  ctx.height = height;
+  ctx.rows   = LM_PNG_STRIPE;
+  ctx.filter = (filter >= LM_PNG_FILTER_NONE && filter <= LM_PNG_FILTER_ADAPTIVE) ? filter : LM_PNG_FILTER_ADAPTIVE;
+  ctx.level  = (level >= 0 && level <= 9) ? level : Z_DEFAULT_COMPRESSION;
+  ctx.row    = row;
+  ctx.arg    = arg;
+
+  stripes    = (height + ctx.rows - 1) / ctx.rows;
+  ctx.stripe = (lm_png_stripe *) calloc( stripes, sizeof(lm_png_stripe) );
+  if( width <= 0 || height <= 0 || ctx.stripe == NULL ) {
+    fprintf( stderr, "Could not create PNG stripes\n" );
+    free( ctx.stripe );
+    return 1;
+  }
+
+  nthreads = (nthreads > 0) ? nthreads : lm_par_threads();
+  lm_par_for( stripes, (nthreads < stripes) ? nthreads : stripes, lm_png_worker, &ctx );
+
+  // stitch the stripes together - the check sum first
+  ok    = 1;
+  adler = adler32( 0L, Z_NULL, 0 );
+  for( s=0; s<stripes; s++ ) {
+    ok   &= ctx.stripe[s].ok;
+    adler = adler32_combine( adler, ctx.stripe[s].adler, ctx.stripe[s].raw );
+  }
+  if( !ok ) {
+    fprintf( stderr, "Could not deflate PNG stripes\n" );
+    goto finalise;
+  }
+
+  // zlib header (deflate, 32K window, fastest - FCHECK makes it a multiple
+  // of 31) on the first stripe, Adler-32 on the last
+  ctx.stripe[0].z[0] = 0x78;
+  ctx.stripe[0].z[1] = 0x01;
+  lm_png_be32( ctx.stripe[stripes-1].z + ctx.stripe[stripes-1].size, adler );
+  ctx.stripe[stripes-1].size += 4;
+
+  fp = fopen( filename, "wb" );
+  if( fp == NULL ) {
+    fprintf( stderr, "Could not open file %s for writing\n", filename );
+    goto finalise;
+  }
+
+  lm_png_be32( ihdr, width );
+  lm_png_be32( ihdr + 4, height );
+  ihdr[8]  = 8;                       // bit depth
+  ihdr[9]  = 2;                       // RGB
+  ihdr[10] = 0;                       // deflate
+  ihdr[11] = 0;                       // adaptive filtering, the only method
+  ihdr[12] = 0;                       // not interlaced
+
+  if( fwrite( sig, 8, 1, fp ) != 1 || !lm_png_chunk( fp, "IHDR", ihdr, 13 )) {
+    goto write_error;
+  }
+
+  if( title != NULL ) {
+    text = (unsigned char *) malloc( 6 + strlen( title ));
+    if( text == NULL ) {
+      goto write_error;
+    }
+    memcpy( text, "Title", 6 );
+    memcpy( text + 6, title, strlen( title ));
+    if( !lm_png_chunk( fp, "tEXt", text, 6 + strlen( title ))) {
+      goto write_error;
+    }
+  }
+
+  // an IDAT per stripe, split where a stripe outgrows a chunk
+  for( s=0; s<stripes; s++ ) {
+    for( off=0; off<ctx.stripe[s].size; off+=part ) {
+      part = ctx.stripe[s].size - off;
+      part = (part < LM_PNG_CHUNK_MAX) ? part : LM_PNG_CHUNK_MAX;
+      if( !lm_png_chunk( fp, "IDAT", ctx.stripe[s].z + off, part )) {
+        goto write_error;
+      }
+    }
+  }
+  if( !lm_png_chunk( fp, "IEND", NULL, 0 ) || fflush( fp ) != 0 ) {
+    goto write_error;
+  }
+
+  code = 0;
+  goto finalise;
+
+  write_error:
+  fprintf( stderr, "Could not write file %s\n", filename );
+
+  finalise:
+  if( fp != NULL ) fclose( fp );
+  for( s=0; s<stripes; s++ ) {
+    free( ctx.stripe[s].z );
+  }
+  free( ctx.stripe );
+  free( text );
+
+  return code;
+}
+
+#endif
@@ -0,0 +1,207 @@
+// BVH refit for animated geometry -=:LogicMonkey:=-
+//
+// When only the vertices move between frames the topology can be kept and
+// just the bounds redone. In the depth first lm_bvh_flat every child sits at a
+// higher index than its parent and every subtree is one contiguous run of
+// nodes, so a subtree is refitted by walking its run backwards. The top of the
+// tree is split into subtrees, as lm_lbvh_build does for emission, the threads
+// pull subtrees and rebuild the lm_tri records and bounds bottom up, then the
+// few nodes above them are done on the calling thread.
+//
+// A refitted tree slowly gets worse as triangles drift apart from the ones
+// they share nodes with. Refit works out the tree's SAH cost as it goes
+//
+//   cost = ( Ctrav.sum A_interior + Cisect.sum A_leaf.N_leaf ) / A_root
+//
+// and lm_bvh_update rebuilds with lm_lbvh_build once it has grown by more
+// than a given factor over the cost just after the last build.
+//
+#ifndef LM_REFIT_H
+#define LM_REFIT_H
+
+#include "lm_lbvh.h"
+
+#define LM_BVH_DRIFT 1.3f     // rebuild once the SAH cost has grown by 30%
+
+typedef struct {
+  lm_bvh_flat *flat;
+  const vec3 *v;
+  int *job_first, *job_end;
+  int jobs, next_job;
+  float sum[LM_PAR_MAX];      // per thread area weighted cost
+} lm_refit_ctx;
+
+float lm_bvh_flat_area( const lm_bvh_flat_node *node ) {
+  lm_aabb b;
+  b.lo = node->lo;
+  b.hi = node->hi;
+  return lm_aabb_area( &b );
+}
+
+// one past the last node of the subtree at n
+int lm_bvh_flat_end( const lm_bvh_flat *flat, int n ) {
+  while( flat->node[n].count == 0 ) {
+    n = flat->node[n].offset;
+  }
+  return n + 1;
+}
+
+// new bounds for node n from its triangles or children, returns its share of
+// the cost before the division by the root area
+float lm_refit_node( lm_bvh_flat *flat, const vec3 *v, int n ) {
+  lm_bvh_flat_node *node = &flat->node[n];
+  lm_aabb b;
+  int i, j;
+
+  if( node->count > 0 ) {
+    lm_aabb_empty( &b );
+    for( i=node->offset; i<node->offset+node->count; i++ ) {
+      j = flat->index[i];
+      lm_tri_build( &flat->tri[i], v[3*j], v[3*j+1], v[3*j+2] );
+      lm_aabb_grow( &b, v[3*j] );
+      lm_aabb_grow( &b, v[3*j+1] );
+      lm_aabb_grow( &b, v[3*j+2] );
+    }
+    node->lo = b.lo;
+    node->hi = b.hi;
+    return LM_BVH_CISECT * node->count * lm_aabb_area( &b );
+  }
+
+  b.lo = flat->node[n+1].lo;
+  b.hi = flat->node[n+1].hi;
+  lm_aabb_grow( &b, flat->node[node->offset].lo );
+  lm_aabb_grow( &b, flat->node[node->offset].hi );
+  node->lo = b.lo;
+  node->hi = b.hi;
+  return LM_BVH_CTRAV * lm_aabb_area( &b );
+}
+
+void lm_refit_jobs( void *arg, int first, int last, int thread ) {
+  lm_refit_ctx *ctx = (lm_refit_ctx *) arg;
+  int j, n;
+
+  (void) first;
+  (void) last;
+  ctx->sum[thread] = 0.0f;
+  while( (j = __atomic_fetch_add( &ctx->next_job, 1, __ATOMIC_RELAXED )) < ctx->jobs ) {
+    for( n=ctx->job_end[j]-1; n>=ctx->job_first[j]; n-- ) {
+      ctx->sum[thread] += lm_refit_node( ctx->flat, ctx->v, n );
+    }
+  }
+}
+
+// SAH cost of a tree as it stands
+float lm_bvh_flat_sah( const lm_bvh_flat *flat ) {
+  float sum = 0.0f, root;
+  int n;
+
+  if( flat->ntri == 0 || (root = lm_bvh_flat_area( &flat->node[0] )) <= 0.0f ) {
+    return 0.0f;
+  }
+  for( n=0; n<flat->nodes; n++ ) {
+    if( flat->node[n].count > 0 ) {
+      sum += LM_BVH_CISECT * flat->node[n].count * lm_bvh_flat_area( &flat->node[n] );
+    } else {
+      sum += LM_BVH_CTRAV * lm_bvh_flat_area( &flat->node[n] );
+    }
+  }
+  return sum / root;
+}
+
+//
+// Refit to new positions of the soup the tree was built over - same triangle
+// count and order, 3*ntri vertices. Returns the new SAH cost, or -1 on
+// allocation failure with the tree untouched.
+//
+float lm_bvh_refit( lm_bvh_flat *flat, const vec3 *v, int nthreads ) {
+  lm_refit_ctx ctx;
+  int *top;
+  int ntop = 0, cap, split, i, j, t, n;
+  float sum = 0.0f, root;
+
+  if( flat->ntri == 0 ) {
+    return 0.0f;
+  }
+
+  nthreads = (nthreads > 0) ? MIN( nthreads, LM_PAR_MAX ) : lm_par_threads();
+  cap = LM_LBVH_JOBS * nthreads + 1;
+
+  ctx.flat      = flat;
+  ctx.v         = v;
+  ctx.job_first = (int *) malloc( cap * sizeof(int) );
+  ctx.job_end   = (int *) malloc( cap * sizeof(int) );
+  top           = (int *) malloc( cap * sizeof(int) );
+
+  if( ctx.job_first == NULL || ctx.job_end == NULL || top == NULL ) {
+    free( ctx.job_first );
+    free( ctx.job_end );
+    free( top );
+    return -1.0f;
+  }
+
+  // split the top of the tree into subtrees, the split nodes are kept back
+  ctx.job_first[0] = 0;
+  ctx.jobs = 1;
+  for( split=1; split && ctx.jobs < LM_LBVH_JOBS * nthreads; ) {
+    split = 0;
+    for( j=0; j<ctx.jobs && ctx.jobs < LM_LBVH_JOBS * nthreads; j++ ) {
+      n = ctx.job_first[j];
+      if( flat->node[n].count == 0 ) {
+        top[ntop++] = n;
+        ctx.job_first[j] = n + 1;
+        ctx.job_first[ctx.jobs++] = flat->node[n].offset;
+        split = 1;
+      }
+    }
+  }
+  for( j=0; j<ctx.jobs; j++ ) {
+    ctx.job_end[j] = lm_bvh_flat_end( flat, ctx.job_first[j] );
+  }
+
+  ctx.next_job = 0;
+  lm_par_for( nthreads, nthreads, lm_refit_jobs, &ctx );
+  for( t=0; t<nthreads; t++ ) {
+    sum += ctx.sum[t];
+  }
+
+  // children before parents - highest index first
+  for( i=1; i<ntop; i++ ) {
+    for( j=i; j>0 && top[j-1] < top[j]; j-- ) {
+      n = top[j]; top[j] = top[j-1]; top[j-1] = n;
+    }
+  }
+  for( i=0; i<ntop; i++ ) {
+    sum += lm_refit_node( flat, v, top[i] );
+  }
+
+  free( ctx.job_first );
+  free( ctx.job_end );
+  free( top );
+
+  root = lm_bvh_flat_area( &flat->node[0] );
+  return (root > 0.0f) ? sum / root : 0.0f;
+}
+
+//
+// Refit, or rebuild if the SAH cost has drifted past drift times sah0 - the
+// cost straight after the last build, which is updated on a rebuild. Returns
+// 1 if the tree was rebuilt. If the rebuild can't be allocated the refitted
+// tree is kept.
+//
+int lm_bvh_update( lm_bvh_flat *flat, const vec3 *v, float *sah0, float drift, int nthreads ) {
+  lm_bvh_flat fresh;
+  float sah = lm_bvh_refit( flat, v, nthreads );
+
+  if( sah >= 0.0f && sah <= *sah0 * drift ) {
+    return 0;
+  }
+  if( !lm_lbvh_build( &fresh, v, flat->ntri, nthreads )) {
+    return 0;
+  }
+  lm_bvh_flat_free( flat );
+  *flat = fresh;
+  *sah0 = lm_bvh_flat_sah( flat );
+  return 1;
+}
+
+#endif
@@ -0,0 +1,246 @@
+// Tiled renderer on a work stealing pool -=:LogicMonkey:=-
+//
+// lm_render cuts a region of the image into square tiles and hands them to a
+// tile function on every core. Each thread starts with a deque holding an
+// equal run of tiles in scanline order and works through it from the back.
+// A thread that runs dry steals the front half of another thread's deque, so
+// a few expensive tiles (all the geometry in one corner, say) get shared out
+// rather than leaving one thread to finish alone.
+//
+// A deque is a run of tile indices [top, bottom) packed in one 64 bit word,
+// top in the high half. The owner takes bottom - 1 and thieves take from top,
+// both with a compare and swap on the whole word, so no locks are needed.
+// Nothing is pushed once rendering starts - a thief puts what it stole in
+// its own empty deque - so when every deque is empty all tiles have been
+// handed out.
+//
+// Tiles are numbered in raster, Morton or Hilbert order (LM_ORDER_*) before
+// they are dealt out. Raster order jumps from the end of one row of tiles to
+// the start of the next, so the rays either side of the jump want different
+// parts of the hierarchy. The two curves keep every run of tiles - and so the
+// run each thread starts with - in a compact block of the image. Only the
+// order tiles are visited changes, each still writes its own pixels of the
+// row major buffer.
+//
+// Each tile writes only its own pixels, so the tile function can store
+// straight into the shared buffer. Every pixel is shaded by the same code
+// whatever the thread, so the image is bit for bit the one a single thread
+// makes.
+//
+//   gcc ... -pthread
+//
+#ifndef LM_RENDER_H
+#define LM_RENDER_H
+
+#include <stdlib.h>
+#include "lm_par.h"
+
+#define LM_ORDER_RASTER  0
+#define LM_ORDER_MORTON  1
+#define LM_ORDER_HILBERT 2
+
+#ifndef LM_RENDER_ORDER
+#define LM_RENDER_ORDER LM_ORDER_RASTER
+#endif
+
+#ifndef LM_RENDER_THREADS
+#define LM_RENDER_THREADS 0           // all cores, -DLM_RENDER_THREADS=1 for serial
+#endif
+
+// shade the pixels x0 <= x < x1, y0 <= y < y1
+typedef void (*lm_render_fn)( void *arg, int x0, int y0, int x1, int y1 );
+
+typedef struct {
+  unsigned long long range;           // top << 32 | bottom
+  char pad[56];                       // a cache line each
+} __attribute__((aligned(64))) lm_deque;
+
+typedef struct {
+  lm_deque deque[LM_PAR_MAX];
+  int nthreads;
+  int x0, y0, x1, y1, tile, across;
+  const int *order;                   // tile of each index, NULL for raster
+  lm_render_fn fn;
+  void *arg;
+  int steals;
+} lm_render_ctx;
+
+unsigned long long lm_deque_pack( unsigned top, unsigned bottom ) {
+  return (unsigned long long) top << 32 | bottom;
+}
+
+// owner end, -1 when empty
+int lm_deque_pop( lm_deque *d ) {
+  unsigned long long r = __atomic_load_n( &d->range, __ATOMIC_ACQUIRE );
+  unsigned top, bottom;
+
+  for( ;; ) {
+    top    = r >> 32;
+    bottom = (unsigned) r;
+    if( top >= bottom ) {
+      return -1;
+    }
+    if( __atomic_compare_exchange_n( &d->range, &r, lm_deque_pack( top, bottom - 1 ), 0,
+                                     __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE )) {
+      return bottom - 1;
+    }
+  }
+}
+
+// take the front half of victim into thief, which must be empty. Returns 0 if
+// there was nothing to take.
+int lm_deque_steal( lm_deque *victim, lm_deque *thief ) {
+  unsigned long long r = __atomic_load_n( &victim->range, __ATOMIC_ACQUIRE );
+  unsigned top, bottom, half;
+
+  for( ;; ) {
+    top    = r >> 32;
+    bottom = (unsigned) r;
+    if( top >= bottom ) {
+      return 0;
+    }
+    half = (bottom - top + 1) / 2;
+    if( __atomic_compare_exchange_n( &victim->range, &r, lm_deque_pack( top + half, bottom ), 0,
+                                     __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE )) {
+      __atomic_store_n( &thief->range, lm_deque_pack( top, top + half ), __ATOMIC_RELEASE );
+      return 1;
+    }
+  }
+}
+
+// position d along a Morton or Hilbert curve over a side x side grid, side a
+// power of two
+void lm_render_curve_xy( int order, int side, int d, int *x, int *y ) {
+  int s, rx, ry, t;
+
+  *x = 0;
+  *y = 0;
+  if( order == LM_ORDER_MORTON ) {
+    for( s=0; (1 << s) < side; s++ ) {
+      *x |= ((d >> (2 * s)) & 1) << s;
+      *y |= ((d >> (2 * s + 1)) & 1) << s;
+    }
+    return;
+  }
+  for( s=1; s<side; s*=2 ) {
+    rx = 1 & (d / 2);
+    ry = 1 & (d ^ rx);
+    if( ry == 0 ) {
+      if( rx == 1 ) {
+        *x = s - 1 - *x;
+        *y = s - 1 - *y;
+      }
+      t  = *x;
+      *x = *y;
+      *y = t;
+    }
+    *x += s * rx;
+    *y += s * ry;
+    d /= 4;
+  }
+}
+
+// tile numbers of an across x down grid in curve order - the curve covers the
+// next power of two square and the cells off the grid are dropped
+void lm_render_curve( int *tile, int order, int across, int down ) {
+  int side = 1, d, k = 0, x, y;
+
+  while( side < across || side < down ) {
+    side *= 2;
+  }
+  for( d=0; d<side*side; d++ ) {
+    lm_render_curve_xy( order, side, d, &x, &y );
+    if( x < across && y < down ) {
+      tile[k++] = y * across + x;
+    }
+  }
+}
+
+void lm_render_tile( lm_render_ctx *ctx, int i ) {
+  int t = (ctx->order != NULL) ? ctx->order[i] : i;
+  int x = ctx->x0 + (t % ctx->across) * ctx->tile;
+  int y = ctx->y0 + (t / ctx->across) * ctx->tile;
+
+  ctx->fn( ctx->arg, x, y, (x + ctx->tile < ctx->x1) ? x + ctx->tile : ctx->x1,
+                          (y + ctx->tile < ctx->y1) ? y + ctx->tile : ctx->y1 );
+}
+
+void lm_render_worker( void *arg, int first, int last, int thread ) {
+  lm_render_ctx *ctx = (lm_render_ctx *) arg;
+  lm_deque *own = &ctx->deque[thread];
+  int i, v, stolen;
+
+  (void) first;
+  (void) last;
+  for( ;; ) {
+    while( (i = lm_deque_pop( own )) >= 0 ) {
+      lm_render_tile( ctx, i );
+    }
+
+    // out of work - go round the others once, starting with the next thread
+    stolen = 0;
+    for( v=1; v<ctx->nthreads && !stolen; v++ ) {
+      stolen = lm_deque_steal( &ctx->deque[(thread + v) % ctx->nthreads], own );
+    }
+    if( !stolen ) {
+      return;
+    }
+    __atomic_fetch_add( &ctx->steals, 1, __ATOMIC_RELAXED );
+  }
+}
+
+//
+// Render the region x0 <= x < x1, y0 <= y < y1 in tile x tile pieces visited
+// in the given LM_ORDER_* on nthreads threads (0 for all cores). Returns the
+// number of steals.
+//
+int lm_render_order( int x0, int y0, int x1, int y1, int tile, int order,
+                     lm_render_fn fn, void *arg, int nthreads ) {
+  lm_render_ctx ctx;
+  int *curve = NULL;
+  int across, down, n, t;
+
+  if( x1 <= x0 || y1 <= y0 ) {
+    return 0;
+  }
+
+  tile   = (tile > 0) ? tile : 16;
+  across = (x1 - x0 + tile - 1) / tile;
+  down   = (y1 - y0 + tile - 1) / tile;
+  n      = across * down;
+
+  nthreads = (nthreads > 0) ? nthreads : lm_par_threads();
+  nthreads = (nthreads > LM_PAR_MAX) ? LM_PAR_MAX : nthreads;
+  nthreads = (nthreads > n) ? n : nthreads;
+
+  ctx.nthreads = nthreads;
+  ctx.x0 = x0; ctx.y0 = y0;
+  ctx.x1 = x1; ctx.y1 = y1;
+  ctx.tile   = tile;
+  ctx.across = across;
+  ctx.fn     = fn;
+  ctx.arg    = arg;
+  ctx.steals = 0;
+
+  // no room for the curve just means raster order - the image is the same
+  if( order != LM_ORDER_RASTER && (curve = (int *) malloc( n * sizeof(int) )) != NULL ) {
+    lm_render_curve( curve, order, across, down );
+  }
+  ctx.order = curve;
+
+  for( t=0; t<nthreads; t++ ) {
+    ctx.deque[t].range = lm_deque_pack( (unsigned) ((long) n * t / nthreads),
+                                        (unsigned) ((long) n * (t + 1) / nthreads) );
+  }
+
+  lm_par_for( nthreads, nthreads, lm_render_worker, &ctx );
+  free( curve );
+  return ctx.steals;
+}
+
+// lm_render_order in LM_RENDER_ORDER
+int lm_render( int x0, int y0, int x1, int y1, int tile, lm_render_fn fn, void *arg, int nthreads ) {
+  return lm_render_order( x0, y0, x1, y1, tile, LM_RENDER_ORDER, fn, arg, nthreads );
+}
+
+#endif
@@ -236,6 +236,7 @@ int lm_rt_rayboxint( vec3 ro, vec3 rd, vec3 p0, vec3 p1 ) {
   return 0;
 }
 
+// geometric ray/sphere test - pass normal as NULL when only hit/miss is wanted
 int lm_rt_raysphereint( vec3 ro, vec3 rd, vec3 p0, float rad, vec3 *normal ) {
   vec3 oc, p;
 #ifdef MP
@@ -283,16 +284,25 @@ int lm_rt_raysphereint( vec3 ro, vec3 rd, vec3 p0, float rad, vec3 *normal ) {
   // r^2 = hg^2 + gc^2
   hg_sq = rad*rad - gc_sq;
 
-  // distance along ray to the intersection point
-  t = t - sqrt( hg_sq );
-
+  // a miss is known from the sign alone, so don't pay for the square root
   if( hg_sq < 0.0f ) {
     return 0;
   }
 
+  // nothing more to do if the caller only wants hit or miss
+  if( normal == NULL ) {
+    return 1;
+  }
+
+  // distance along ray to the intersection point
+  t = t - sqrt( hg_sq );
+
   invrad = 1.0f/rad;
 #endif
 
+#ifdef MP
+  if( normal != NULL ) {
+#endif
   // p is the intersection point on the sphere
   lm_vec3_scale( &p, t, rd );
   lm_vec3_add( &p, ro, p );
@@ -300,6 +310,9 @@ int lm_rt_raysphereint( vec3 ro, vec3 rd, vec3 p0, float rad, vec3 *normal ) {
   // with lm_vec3_norm but we know the radius so just divide by that
   lm_vec3_sub( &p, p, p0 );
   lm_vec3_scale( normal, invrad, p );
+#ifdef MP
+  }
+#endif
 
 #ifdef MP
   mpfr_clear( temp );
@@ -765,3 +778,551 @@ int lm_raybox_plucker_optimised( vec3 ro, vec3 rd, vec3 v0, vec3 v7 ) {
 
   return a|b|c|d|e|f;
 }
+
+//
+// six edge silhouette test given the ray Plücker coords r0..r5 and direction
+// octant (bit 0, 1, 2 set for -ve x, y, z) - shared by the vec3 and lm_ray
+// kernels below
+//
+int lm_plucker_silhouette( float r0, float r1, float r2, float r3, float r4, float r5, int sign, vec3 v0, vec3 v7 ) {
+
+  vec3 v1, v2, v3, v4, v5, v6;
+
+  int cx, cy, cz;               // entry face on each axis is C, B, A (else E, D, F)
+  int s0, s1, s2, s3, s4, s5;   // silhouette edge test results
+
+  // copy the appropriate x,y,z positions for V1...V6 from V0 and V7
+  v1   = v0;
+  v1.y = v7.y;
+
+  v2   = v7;
+  v2.z = v1.z;
+
+  v3   = v0;
+  v3.x = v7.x;
+
+  v6   = v7;
+  v6.y = v0.y;
+
+  v5   = v0;
+  v5.z = v7.z;
+
+  v4   = v1;
+  v4.z = v7.z;
+
+/*------------------------------------------------------------------------------
+   Ray/Box intersection test
+
+   Optimised Plücker coordinates with silhouette edge selection
+
+   Box vertex numbering and face lettering are the same as for
+   lm_raybox_plucker_optimised.
+
+   Seen along the ray direction the box outline is a hexagon made of the six
+   edges that separate a face the ray can enter by from one it can't. The line
+   passes through the box when it is inside that hexagon, so only those six
+   edges need testing.
+
+   Entry faces come from the sign bits of rd (the octant). A ray travelling towards -x
+   enters by the x face that holds v0 (C) when v0 is the +x corner, otherwise
+   by E. Likewise B/D for y and A/F for z.
+
+   Each pair of axes contributes the two edges where a chosen face meets the
+   unchosen face of the other axis:
+
+       x,y  C/E vs B/D    z edges   50 14 72 36
+       x,z  C/E vs A/F    y edges   01 45 23 67
+       y,z  B/D vs A/F    x edges   30 56 12 74
+
+   Reading the face equations of lm_raybox_plucker_optimised, one edge of each
+   pair must test 0 and the other 1 (the first and second below). Swapping the
+   box corners mirrors the box and flips all six results, so a hit is all six
+   matching or all six inverted.
+
+   As with lm_raybox_plucker_optimised, v0 and v7 must be the min and max
+   corners (either way round) - mixing them per axis does not give a box.
+
+  FlOps
+    Ray Plücker coords: 6 x mul + 3 x add
+    AABB silhouette edges 6 x [ 2 x mul + 2 x add ]
+
+    18 mul + 15 add
+
+------------------------------------------------------------------------------*/
+
+  cx = ( sign       & 1) ^ (v0.x < v7.x);
+  cy = ((sign >> 1) & 1) ^ (v0.y < v7.y);
+  cz = ((sign >> 2) & 1) ^ (v0.z < v7.z);
+
+  // x,y pair - z edges
+  if( cx ) {
+    if( cy ) {
+      s0 = (-r2*v1.y - r5*v1.x + r0 ) < 0 ? 1 : 0; // t14
+      s1 = (-r2*v3.y - r5*v3.x + r0 ) < 0 ? 1 : 0; // t36
+    } else {
+      s0 = ( r2*v5.y + r5*v5.x - r0 ) < 0 ? 1 : 0; // t50
+      s1 = ( r2*v7.y + r5*v7.x - r0 ) < 0 ? 1 : 0; // t72
+    }
+  } else {
+    if( cy ) {
+      s0 = ( r2*v7.y + r5*v7.x - r0 ) < 0 ? 1 : 0; // t72
+      s1 = ( r2*v5.y + r5*v5.x - r0 ) < 0 ? 1 : 0; // t50
+    } else {
+      s0 = (-r2*v3.y - r5*v3.x + r0 ) < 0 ? 1 : 0; // t36
+      s1 = (-r2*v1.y - r5*v1.x + r0 ) < 0 ? 1 : 0; // t14
+    }
+  }
+
+  // x,z pair - y edges
+  if( cx ) {
+    if( cz ) {
+      s2 = (-r2*v4.z + r4*v4.x + r1 ) < 0 ? 1 : 0; // t45
+      s3 = (-r2*v2.z + r4*v2.x + r1 ) < 0 ? 1 : 0; // t23
+    } else {
+      s2 = ( r2*v0.z - r4*v0.x - r1 ) < 0 ? 1 : 0; // t01
+      s3 = ( r2*v6.z - r4*v6.x - r1 ) < 0 ? 1 : 0; // t67
+    }
+  } else {
+    if( cz ) {
+      s2 = ( r2*v6.z - r4*v6.x - r1 ) < 0 ? 1 : 0; // t67
+      s3 = ( r2*v0.z - r4*v0.x - r1 ) < 0 ? 1 : 0; // t01
+    } else {
+      s2 = (-r2*v2.z + r4*v2.x + r1 ) < 0 ? 1 : 0; // t23
+      s3 = (-r2*v4.z + r4*v4.x + r1 ) < 0 ? 1 : 0; // t45
+    }
+  }
+
+  // y,z pair - x edges
+  if( cy ) {
+    if( cz ) {
+      s4 = ( r5*v5.z + r4*v5.y + r3 ) < 0 ? 1 : 0; // t56
+      s5 = ( r5*v1.z + r4*v1.y + r3 ) < 0 ? 1 : 0; // t12
+    } else {
+      s4 = (-r5*v3.z - r4*v3.y - r3 ) < 0 ? 1 : 0; // t30
+      s5 = (-r5*v7.z - r4*v7.y - r3 ) < 0 ? 1 : 0; // t74
+    }
+  } else {
+    if( cz ) {
+      s4 = (-r5*v7.z - r4*v7.y - r3 ) < 0 ? 1 : 0; // t74
+      s5 = (-r5*v3.z - r4*v3.y - r3 ) < 0 ? 1 : 0; // t30
+    } else {
+      s4 = ( r5*v1.z + r4*v1.y + r3 ) < 0 ? 1 : 0; // t12
+      s5 = ( r5*v5.z + r4*v5.y + r3 ) < 0 ? 1 : 0; // t56
+    }
+  }
+
+  // a ray parallel to an axis sees that axis' edges end on - their side tests
+  // are exactly zero and say nothing, so borrow another pair's results. The
+  // outline is then the four edges of the face the ray looks straight into.
+  // (r2, r5, r4 are -rd.x, rd.y, -rd.z)
+  if( r2 == 0.0f && r5 == 0.0f ) { s0 = s2; s1 = s3; }
+  if( r2 == 0.0f && r4 == 0.0f ) { s2 = s4; s3 = s5; }
+  if( r5 == 0.0f && r4 == 0.0f ) { s4 = s0; s5 = s1; }
+
+  return (( ~s0 &  s1 & ~s2 &  s3 & ~s4 &  s5 ) |
+          (  s0 & ~s1 &  s2 & ~s3 &  s4 & ~s5 )) & 1;
+}
+
+int lm_raybox_plucker_silhouette( vec3 ro, vec3 rd, vec3 v0, vec3 v7 ) {
+
+  float r0, r1, r2, r3, r4, r5; // ray Plücker coords
+  int sign;
+
+  r0 = ro.x*rd.y - rd.x*ro.y;
+  r1 = ro.x*rd.z - rd.x*ro.z;
+  r2 = -rd.x;
+  r3 = ro.y*rd.z - rd.y*ro.z;
+  r4 = -rd.z;
+  r5 = rd.y;
+
+  sign = (rd.x < 0.0f) | (rd.y < 0.0f) << 1 | (rd.z < 0.0f) << 2;
+
+  return lm_plucker_silhouette( r0, r1, r2, r3, r4, r5, sign, v0, v7 );
+}
+
+//
+// Precomputed ray record -=:LogicMonkey:=-
+//
+// Everything the kernels above work out from ro and rd on every call, done
+// once per ray. A ray that is tested against thousands of primitives pays
+// for one normalise, three divisions and the Plücker coords instead of doing
+// them per test. The lm_ray_* kernels take the record in place of ro, rd.
+//
+typedef struct {
+  vec3  o;      // origin
+  vec3  d;      // unit direction
+  vec3  inv;    // 1/d per axis, +/-inf along an axis the ray doesn't move in
+  int   sign;   // direction octant - bit 0, 1, 2 set for -ve x, y, z
+  float p[6];   // Plücker coords r0..r5 as in lm_raybox_plucker_optimised
+} lm_ray;
+
+void lm_ray_init( lm_ray *r, vec3 ro, vec3 rd ) {
+  r->o = ro;
+  lm_vec3_norm( &r->d, rd );
+
+  r->inv.x = 1.0f / r->d.x;
+  r->inv.y = 1.0f / r->d.y;
+  r->inv.z = 1.0f / r->d.z;
+
+  r->sign = (r->d.x < 0.0f) | (r->d.y < 0.0f) << 1 | (r->d.z < 0.0f) << 2;
+
+  r->p[0] = ro.x*r->d.y - r->d.x*ro.y;
+  r->p[1] = ro.x*r->d.z - r->d.x*ro.z;
+  r->p[2] = -r->d.x;
+  r->p[3] = ro.y*r->d.z - r->d.y*ro.z;
+  r->p[4] = -r->d.z;
+  r->p[5] = r->d.y;
+}
+
+// lm_rt_raytriint without the normalise - same maths, same results
+int lm_ray_triint( const lm_ray *r, vec3 p0, vec3 p1, vec3 p2, float *beta, float *gamma, float *t ) {
+  vec3 edge0, edge1, normal, edge2, interm;
+  float v, va, v1, v2;
+
+  lm_vec3_sub( &edge0, p1, p0 );
+  lm_vec3_sub( &edge1, p0, p2 );
+  lm_vec3_cross( &normal, edge1, edge0 );
+
+  lm_vec3_dot( &v, normal, r->d );
+  lm_vec3_sub( &edge2, p0, r->o );
+  lm_vec3_dot( &va, normal, edge2 );
+
+  *t = va / v;
+
+  lm_vec3_cross( &interm, r->d, edge2 );
+  lm_vec3_dot( &v1, interm, edge1 );
+  lm_vec3_dot( &v2, interm, edge0 );
+
+  *beta  = v1 / v;
+  *gamma = v2 / v;
+
+  if ((( v1 < 0.0f && v2 < 0.0f && v < 0.0f) || (v1 > 0.0f && v2 > 0.0f && v > 0.0f) ) && ((v1 + v2) <= v) && (*beta >= 0.0f) && (*gamma >= 0.0f) && ((*beta + *gamma) < 1.0f)) {
+    return 1;
+  }
+  return 0;
+}
+
+// lm_rt_rayboxint with the six divisions replaced by reciprocal multiplies
+int lm_ray_boxint( const lm_ray *r, vec3 p0, vec3 p1 ) {
+  float t0x, t0y, t0z, t1x, t1y, t1z;
+
+  t0x = (p0.x - r->o.x) * r->inv.x;
+  t0y = (p0.y - r->o.y) * r->inv.y;
+  t0z = (p0.z - r->o.z) * r->inv.z;
+
+  t1x = (p1.x - r->o.x) * r->inv.x;
+  t1y = (p1.y - r->o.y) * r->inv.y;
+  t1z = (p1.z - r->o.z) * r->inv.z;
+
+  float tmin = MAX( MIN( t0x, t1x ), MAX( MIN( t0y, t1y ), MIN( t0z, t1z )));
+  float tmax = MIN( MAX( t0x, t1x ), MIN( MAX( t0y, t1y ), MAX( t0z, t1z )));
+
+  if( tmin <= tmax ) {
+    return 1;
+  }
+
+  return 0;
+}
+
+// lm_rt_raysphereint without the normalise, normal may be NULL as there
+int lm_ray_sphereint( const lm_ray *r, vec3 p0, float rad, vec3 *normal ) {
+  vec3 oc, p;
+  float oc_sq, t, gc_sq, hg_sq;
+
+  lm_vec3_sub( &oc, p0, r->o );
+  lm_vec3_dot( &oc_sq, oc, oc );
+  lm_vec3_dot( &t, oc, r->d );
+
+  gc_sq = oc_sq - t*t;
+  hg_sq = rad*rad - gc_sq;
+
+  if( hg_sq < 0.0f ) {
+    return 0;
+  }
+
+  if( normal == NULL ) {
+    return 1;
+  }
+
+  t = t - sqrt( hg_sq );
+
+  lm_vec3_scale( &p, t, r->d );
+  lm_vec3_add( &p, r->o, p );
+  lm_vec3_sub( &p, p, p0 );
+  lm_vec3_scale( normal, 1.0f/rad, p );
+
+  return 1;
+}
+
+// six edge silhouette Plücker test straight from the stored coords and octant
+int lm_ray_boxint_plucker( const lm_ray *r, vec3 v0, vec3 v7 ) {
+  return lm_plucker_silhouette( r->p[0], r->p[1], r->p[2], r->p[3], r->p[4], r->p[5], r->sign, v0, v7 );
+}
+
+//
+// Precomputed triangle record -=:LogicMonkey:=-
+//
+// lm_rt_raytriint starts by working out E0, E1 and N from p0, p1, p2. For a
+// static scene they never change, so build them once at scene load and keep
+// them with p0 - the hot path then starts at the N.D volume. One record is
+// padded and aligned to a 64 byte cache line so a test touches a single line.
+//
+typedef struct {
+  vec3 p0;      // first vertex
+  vec3 e0;      // edge p0 -> p1
+  vec3 e1;      // edge p2 -> p0 (note the direction)
+  vec3 n;       // E1 X E0, not normalised
+} __attribute__((aligned(64))) lm_tri;
+
+void lm_tri_build( lm_tri *tri, vec3 p0, vec3 p1, vec3 p2 ) {
+  tri->p0 = p0;
+  lm_vec3_sub( &tri->e0, p1, p0 );
+  lm_vec3_sub( &tri->e1, p0, p2 );
+  lm_vec3_cross( &tri->n, tri->e1, tri->e0 );
+}
+
+// build records for a soup of n triangles held as 3n vertices, returns NULL
+// on allocation failure, release with free()
+lm_tri *lm_tri_soup( const vec3 *v, int n ) {
+  int i;
+  lm_tri *tri = (lm_tri *) aligned_alloc( 64, (n > 0 ? n : 1) * sizeof(lm_tri) );
+
+  if( tri == NULL ) {
+    return NULL;
+  }
+
+  for( i=0; i<n; i++ ) {
+    lm_tri_build( &tri[i], v[3*i], v[3*i+1], v[3*i+2] );
+  }
+  return tri;
+}
+
+// lm_ray_triint starting from a precomputed record - same results
+int lm_ray_tri( const lm_ray *r, const lm_tri *tri, float *beta, float *gamma, float *t ) {
+  vec3 edge2, interm;
+  float v, va, v1, v2;
+
+  lm_vec3_dot( &v, tri->n, r->d );
+  lm_vec3_sub( &edge2, tri->p0, r->o );
+  lm_vec3_dot( &va, tri->n, edge2 );
+
+  *t = va / v;
+
+  lm_vec3_cross( &interm, r->d, edge2 );
+  lm_vec3_dot( &v1, interm, tri->e1 );
+  lm_vec3_dot( &v2, interm, tri->e0 );
+
+  *beta  = v1 / v;
+  *gamma = v2 / v;
+
+  if ((( v1 < 0.0f && v2 < 0.0f && v < 0.0f) || (v1 > 0.0f && v2 > 0.0f && v > 0.0f) ) && ((v1 + v2) <= v) && (*beta >= 0.0f) && (*gamma >= 0.0f) && ((*beta + *gamma) < 1.0f)) {
+    return 1;
+  }
+  return 0;
+}
+
+//
+// Early reject ray/triangle test -=:LogicMonkey:=-
+//
+// lm_rt_raytriint divides for t, beta and gamma before it knows whether there
+// is a hit. Most tests miss, so here the signed volumes are tested first and
+// nothing is divided until the hit is confirmed.
+//
+// With V, V1 and V2 all negative the (V1 + V2) <= V test means beta + gamma
+// can't be below 1, so lm_rt_raytriint only ever accepts V > 0. That leaves
+//
+//   V1 > 0, V2 > 0, V1 + V2 < V       barycentrics in range
+//   0 <= Va < tmax.V                  0 <= t < tmax
+//
+// as the whole test. The t-range also culls hits behind the ray origin,
+// which lm_rt_raytriint does not. On a hit only the outputs asked for are
+// divided out - pass NULL for beta and gamma when only t is needed.
+//
+int lm_rt_raytriint_early( vec3 ro, vec3 rd, vec3 p0, vec3 p1, vec3 p2, float tmax, float *beta, float *gamma, float *t ) {
+  vec3 edge0, edge1, normal, edge2, interm;
+  float v, va, v1, v2;
+
+  lm_vec3_sub( &edge0, p1, p0 );
+  lm_vec3_sub( &edge1, p0, p2 );
+  lm_vec3_cross( &normal, edge1, edge0 );
+
+  lm_vec3_norm( &rd, rd );
+
+  lm_vec3_dot( &v, normal, rd );
+  if( !(v > 0.0f) ) {
+    return 0;
+  }
+
+  lm_vec3_sub( &edge2, p0, ro );
+  lm_vec3_dot( &va, normal, edge2 );
+  if( va < 0.0f || !(va < tmax * v) ) {
+    return 0;
+  }
+
+  lm_vec3_cross( &interm, rd, edge2 );
+  lm_vec3_dot( &v1, interm, edge1 );
+  lm_vec3_dot( &v2, interm, edge0 );
+  if( !(v1 > 0.0f && v2 > 0.0f && (v1 + v2) < v) ) {
+    return 0;
+  }
+
+  if( t != NULL )     *t     = va / v;
+  if( beta != NULL )  *beta  = v1 / v;
+  if( gamma != NULL ) *gamma = v2 / v;
+
+  return 1;
+}
+
+// the same from the precomputed ray and triangle records
+int lm_ray_tri_early( const lm_ray *r, const lm_tri *tri, float tmax, float *beta, float *gamma, float *t ) {
+  vec3 edge2, interm;
+  float v, va, v1, v2;
+
+  lm_vec3_dot( &v, tri->n, r->d );
+  if( !(v > 0.0f) ) {
+    return 0;
+  }
+
+  lm_vec3_sub( &edge2, tri->p0, r->o );
+  lm_vec3_dot( &va, tri->n, edge2 );
+  if( va < 0.0f || !(va < tmax * v) ) {
+    return 0;
+  }
+
+  lm_vec3_cross( &interm, r->d, edge2 );
+  lm_vec3_dot( &v1, interm, tri->e1 );
+  lm_vec3_dot( &v2, interm, tri->e0 );
+  if( !(v1 > 0.0f && v2 > 0.0f && (v1 + v2) < v) ) {
+    return 0;
+  }
+
+  if( t != NULL )     *t     = va / v;
+  if( beta != NULL )  *beta  = v1 / v;
+  if( gamma != NULL ) *gamma = v2 / v;
+
+  return 1;
+}
+
+//
+// Kay & Kajiya slab test with entry and exit distances -=:LogicMonkey:=-
+//
+// As lm_ray_boxint, multiplying by the ray's reciprocal direction instead of
+// dividing, but it hands back where the ray enters (tnear) and leaves (tfar)
+// the box. tnear is negative when the origin is inside. A hit needs the slab
+// overlap to meet the range [0, tmax] so a hierarchy can order children by
+// tnear and drop any box beyond the closest hit found so far.
+//
+int lm_ray_slab( const lm_ray *r, vec3 p0, vec3 p1, float tmax, float *tnear, float *tfar ) {
+  float t0x, t0y, t0z, t1x, t1y, t1z;
+  float tn, tf;
+
+  t0x = (p0.x - r->o.x) * r->inv.x;
+  t0y = (p0.y - r->o.y) * r->inv.y;
+  t0z = (p0.z - r->o.z) * r->inv.z;
+
+  t1x = (p1.x - r->o.x) * r->inv.x;
+  t1y = (p1.y - r->o.y) * r->inv.y;
+  t1z = (p1.z - r->o.z) * r->inv.z;
+
+  tn = MAX( MIN( t0x, t1x ), MAX( MIN( t0y, t1y ), MIN( t0z, t1z )));
+  tf = MIN( MAX( t0x, t1x ), MIN( MAX( t0y, t1y ), MAX( t0z, t1z )));
+
+  *tnear = tn;
+  *tfar  = tf;
+
+  return ( MAX( tn, 0.0f ) <= MIN( tf, tmax )) ? 1 : 0;
+}
+
+//
+// Batched ray/spheres test -=:LogicMonkey:=-
+//
+// Spheres are held structure-of-arrays so the loop streams through four
+// contiguous float arrays. Each sphere is the same geometric test as
+// lm_rt_raysphereint and a miss drops out on the sign of hg^2 before the
+// square root. Only the closest hit in [0, tmax) survives, and its normal is
+// worked out once at the end rather than for every sphere that was hit.
+//
+typedef struct {
+  int    n;
+  float *x, *y, *z;   // centres
+  float *rad;         // radii
+} lm_spheres;
+
+// one 64 byte aligned block holding all four arrays, returns 0 on failure
+int lm_spheres_alloc( lm_spheres *s, int n ) {
+  int stride = (n + 15) & ~15;   // keep each array on a cache line boundary
+  float *block = (float *) aligned_alloc( 64, 4 * (stride > 0 ? stride : 16) * sizeof(float) );
+
+  if( block == NULL ) {
+    return 0;
+  }
+
+  s->n   = n;
+  s->x   = block;
+  s->y   = block + stride;
+  s->z   = block + 2*stride;
+  s->rad = block + 3*stride;
+  return 1;
+}
+
+void lm_spheres_free( lm_spheres *s ) {
+  free( s->x );
+  s->n = 0;
+}
+
+void lm_spheres_set( lm_spheres *s, int i, vec3 p0, float rad ) {
+  s->x[i]   = p0.x;
+  s->y[i]   = p0.y;
+  s->z[i]   = p0.z;
+  s->rad[i] = rad;
+}
+
+// returns the index of the closest sphere hit, or -1. t and normal (either
+// may be NULL) are only written on a hit. When the origin is inside a
+// sphere its far intersection is used.
+int lm_ray_spheres( const lm_ray *r, const lm_spheres *s, float tmax, float *t, vec3 *normal ) {
+  int i, closest = -1;
+  float ocx, ocy, ocz, oc_sq, tc, hg_sq, th;
+  float best = tmax;
+
+  for( i=0; i<s->n; i++ ) {
+    ocx = s->x[i] - r->o.x;
+    ocy = s->y[i] - r->o.y;
+    ocz = s->z[i] - r->o.z;
+
+    oc_sq = ocx*ocx + ocy*ocy + ocz*ocz;
+    tc    = ocx*r->d.x + ocy*r->d.y + ocz*r->d.z;
+    hg_sq = s->rad[i]*s->rad[i] - (oc_sq - tc*tc);
+
+    if( hg_sq < 0.0f ) {
+      continue;
+    }
+
+    th = tc - sqrt( hg_sq );
+    th = (th < 0.0f) ? tc + sqrt( hg_sq ) : th;
+
+    closest = (th >= 0.0f && th < best) ? i : closest;
+    best    = (th >= 0.0f && th < best) ? th : best;
+  }
+
+  if( closest < 0 ) {
+    return -1;
+  }
+
+  if( t != NULL ) {
+    *t = best;
+  }
+
+  if( normal != NULL ) {
+    vec3 p, c;
+    c.x = s->x[closest];
+    c.y = s->y[closest];
+    c.z = s->z[closest];
+    lm_vec3_scale( &p, best, r->d );
+    lm_vec3_add( &p, r->o, p );
+    lm_vec3_sub( &p, p, c );
+    lm_vec3_scale( normal, 1.0f/s->rad[closest], p );
+  }
+
+  return closest;
+}
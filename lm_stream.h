@@ -0,0 +1,186 @@
+// Streaming row band renderer -=:LogicMonkey:=-
+//
+// lm_stream renders an image a band of rows at a time into a small ring of
+// band buffers and hands the rows over in order to a writer (png_write_row,
+// say) as soon as each band is done, so the whole float image never exists.
+// Peak memory is ring x width x band floats however tall the image is, and
+// rendering later bands overlaps writing the earlier ones.
+//
+// lm_par_for makes nthreads + 1 threads. Thread 0 is the writer - it waits
+// for band b to be ready, feeds its rows out, then frees its slot. The rest
+// are renderers which claim bands in order and wait for their slot (b % ring)
+// to be freed before rendering into it, so the ring can't overrun the writer.
+// One mutex and two condition variables cover it, taken once per band. The
+// writer renders the next band itself when no renderer has claimed it, so it
+// never sits idle and a thread that could not be started costs nothing.
+//
+// If the writer fails the renderers are told to stop, and lm_stream returns
+// once they have.
+//
+//   gcc ... -pthread
+//
+#ifndef LM_STREAM_H
+#define LM_STREAM_H
+
+#include <stdlib.h>
+#include "lm_par.h"
+
+#ifndef LM_STREAM_BAND
+#define LM_STREAM_BAND 64             // rows per band
+#endif
+
+// shade rows y0 <= y < y1 into band, row y at band + (y - y0) * width
+typedef void (*lm_band_fn)( void *arg, float *band, int y0, int y1 );
+
+// take row y of the image, non zero to give up
+typedef int (*lm_row_fn)( void *arg, const float *row, int y );
+
+typedef struct {
+  int width, height, band, ring, bands;
+  float *buf;
+  int *ready;                         // band held by each slot, -1 none
+  int next, written, stop, failed;
+  pthread_mutex_t lock;
+  pthread_cond_t band_ready, slot_free;
+  lm_band_fn render;
+  void *render_arg;
+  lm_row_fn row;
+  void *row_arg;
+} lm_stream_ctx;
+
+// render claimed band b into its slot and tell the writer
+void lm_stream_band( lm_stream_ctx *ctx, int b ) {
+  int slot = b % ctx->ring;
+  int y0 = b * ctx->band;
+  int y1 = (y0 + ctx->band < ctx->height) ? y0 + ctx->band : ctx->height;
+
+  ctx->render( ctx->render_arg, ctx->buf + (long) slot * ctx->band * ctx->width, y0, y1 );
+
+  pthread_mutex_lock( &ctx->lock );
+  ctx->ready[slot] = b;
+  pthread_cond_broadcast( &ctx->band_ready );
+  pthread_mutex_unlock( &ctx->lock );
+}
+
+void lm_stream_writer( lm_stream_ctx *ctx ) {
+  int b, y, y1, slot;
+
+  for( b=0; b<ctx->bands; b++ ) {
+    slot = b % ctx->ring;
+
+    // render the band here if no renderer has claimed it yet
+    pthread_mutex_lock( &ctx->lock );
+    if( ctx->next == b ) {
+      ctx->next++;
+      pthread_mutex_unlock( &ctx->lock );
+      lm_stream_band( ctx, b );
+      pthread_mutex_lock( &ctx->lock );
+    }
+    while( ctx->ready[slot] != b ) {
+      pthread_cond_wait( &ctx->band_ready, &ctx->lock );
+    }
+    pthread_mutex_unlock( &ctx->lock );
+
+    y1 = (b + 1) * ctx->band;
+    y1 = (y1 < ctx->height) ? y1 : ctx->height;
+    for( y=b*ctx->band; y<y1 && !ctx->failed; y++ ) {
+      ctx->failed = ctx->row( ctx->row_arg, ctx->buf + ((long) slot * ctx->band + y - b * ctx->band) * ctx->width, y );
+    }
+
+    pthread_mutex_lock( &ctx->lock );
+    ctx->written = b + 1;
+    ctx->stop = ctx->failed;
+    pthread_cond_broadcast( &ctx->slot_free );
+    pthread_mutex_unlock( &ctx->lock );
+
+    if( ctx->failed ) {
+      return;
+    }
+  }
+}
+
+void lm_stream_renderer( lm_stream_ctx *ctx ) {
+  int b;
+
+  for( ;; ) {
+    pthread_mutex_lock( &ctx->lock );
+    b = ctx->next++;
+    while( !ctx->stop && b < ctx->bands && b - ctx->written >= ctx->ring ) {
+      pthread_cond_wait( &ctx->slot_free, &ctx->lock );
+    }
+    pthread_mutex_unlock( &ctx->lock );
+
+    if( ctx->stop || b >= ctx->bands ) {
+      return;
+    }
+
+    lm_stream_band( ctx, b );
+  }
+}
+
+void lm_stream_thread( void *arg, int first, int last, int thread ) {
+  (void) first;
+  (void) last;
+  if( thread == 0 ) {
+    lm_stream_writer( (lm_stream_ctx *) arg );
+  } else {
+    lm_stream_renderer( (lm_stream_ctx *) arg );
+  }
+}
+
+//
+// Render a width x height image in bands of band rows (0 for LM_STREAM_BAND)
+// on nthreads renderers (0 for all cores), passing each row to row in order.
+// Returns 0 when every row was written, 1 if the ring could not be allocated
+// or row gave up.
+//
+int lm_stream( int width, int height, int band, int nthreads,
+               lm_band_fn render, void *render_arg, lm_row_fn row, void *row_arg ) {
+  lm_stream_ctx ctx;
+  int i;
+
+  nthreads = (nthreads > 0) ? nthreads : lm_par_threads();
+  nthreads = (nthreads > LM_PAR_MAX - 1) ? LM_PAR_MAX - 1 : nthreads;
+
+  ctx.width   = width;
+  ctx.height  = height;
+  ctx.band    = (band > 0) ? band : LM_STREAM_BAND;
+  ctx.bands   = (height + ctx.band - 1) / ctx.band;
+  ctx.ring    = nthreads + 1;         // one being written while every renderer has one
+  ctx.next    = 0;
+  ctx.written = 0;
+  ctx.stop    = 0;
+  ctx.failed  = 0;
+  ctx.render     = render;
+  ctx.render_arg = render_arg;
+  ctx.row        = row;
+  ctx.row_arg    = row_arg;
+
+  ctx.buf   = (float *) malloc( (long) ctx.ring * ctx.band * width * sizeof(float) );
+  ctx.ready = (int *) malloc( ctx.ring * sizeof(int) );
+
+  if( ctx.buf == NULL || ctx.ready == NULL ) {
+    free( ctx.buf );
+    free( ctx.ready );
+    return 1;
+  }
+  for( i=0; i<ctx.ring; i++ ) {
+    ctx.ready[i] = -1;
+  }
+
+  pthread_mutex_init( &ctx.lock, NULL );
+  pthread_cond_init( &ctx.band_ready, NULL );
+  pthread_cond_init( &ctx.slot_free, NULL );
+
+  lm_par_for( nthreads + 1, nthreads + 1, lm_stream_thread, &ctx );
+
+  pthread_cond_destroy( &ctx.slot_free );
+  pthread_cond_destroy( &ctx.band_ready );
+  pthread_mutex_destroy( &ctx.lock );
+  free( ctx.buf );
+  free( ctx.ready );
+
+  return ctx.failed;
+}
+
+#endif
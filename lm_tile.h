@@ -0,0 +1,371 @@
+// Tile frustum culling for primary rays -=:LogicMonkey:=-
+//
+// The lm_rt_primary_rays drivers fire every ray from one origin, so the rays
+// of a rectangular tile of pixels all lie inside the pyramid spanned by the
+// tile's four corner rays. An object can be classified against that pyramid
+// once per tile:
+//
+//   LM_TILE_MISS    no ray of the tile can hit it - skip the tile
+//   LM_TILE_HIT     every ray hits it - no per pixel test needed
+//   LM_TILE_MIXED   test each pixel as before
+//
+// Miss: the pyramid's sides are the planes through the origin and two
+// neighbouring corner rays. Which side of such a plane a point p is on is the
+// sign of the Plücker side product of the corner ray with the line through p
+// along the next corner ray, so an object that is wholly outside any one side
+// is missed by the whole tile. For a box that is its 8 vertices, for a sphere
+// its centre more than rad outside - the side product is the distance from
+// the plane times |d_i X d_i+1|.
+//
+// Hit: seen from a point outside it, the directions that hit a convex object
+// form a convex cone, so if the four corner rays hit it so does every ray
+// between them. Corners use the Plücker box test (lm_ray_boxint_plucker) and
+// lm_ray_sphereint. Those are line tests, so a box must also lie wholly in
+// front of the origin, and a sphere's centre in front along each corner ray,
+// to count as hit.
+//
+// Both answers are conservative - anything doubtful is MIXED. A vertex only
+// counts as outside when it is clear of the side by LM_TILE_EPS of its
+// distance, as a ray grazing an edge of the object can lie in the side
+// itself. The tests are float only, an MP build gets the constants and tests
+// every pixel.
+//
+// Before any of that lm_rect_box and lm_rect_sphere project an object to a
+// conservative rectangle of pixels, so the drivers only walk the tiles inside
+// the union of the rectangles and clear the rest of the image in one go.
+//
+// For hit/miss masks lm_quad_cover goes further and subdivides the image,
+// filling any block whose corners and frustum agree without tracing it.
+//
+#ifndef LM_TILE_H
+#define LM_TILE_H
+
+#include <string.h>
+#include "lm_rt.h"
+
+#ifndef LM_TILE
+#define LM_TILE 16             // tile edge in pixels, -DLM_TILE=8 also suits
+#endif
+#define LM_TILE_EPS 1e-5f
+
+#define LM_TILE_MISS  0
+#define LM_TILE_HIT   1
+#define LM_TILE_MIXED 2
+
+#ifndef MP
+
+typedef struct {
+  lm_ray c[4];                 // corner rays, going round the tile
+  vec3 fwd;                    // sum of the corner directions
+  float inside[4];             // +1 or -1 so lm_tile_side is +ve inside
+  float dist[4];               // lm_tile_side to distance, 0 for a flat side
+} lm_tile;
+
+// which side of the plane through corner ray i and i+1 the point p is on,
+// times |d_i X d_i+1|
+float lm_tile_side( const lm_tile *f, int i, vec3 p ) {
+  const lm_ray *r = &f->c[i];
+  vec3 d = f->c[(i + 1) & 3].d;
+  float l0, l1, l2, l3, l4, l5;
+
+  // the line's coords straight from p and d, as lm_ray_init does - going via
+  // a second point p + d would cancel away most of the precision
+  l0 = p.x*d.y - d.x*p.y;
+  l1 = p.x*d.z - d.x*p.z;
+  l2 = -d.x;
+  l3 = p.y*d.z - d.y*p.z;
+  l4 = -d.z;
+  l5 = d.y;
+
+  return f->inside[i] * (r->p[2]*l3 + r->p[5]*l1 + r->p[4]*l0 + r->p[1]*l5 + r->p[0]*l4 + r->p[3]*l2);
+}
+
+// d0..d3 are the corner ray directions going round the tile
+void lm_tile_init( lm_tile *f, vec3 ro, vec3 d0, vec3 d1, vec3 d2, vec3 d3 ) {
+  vec3 p, e;
+  float len;
+  int i;
+
+  lm_ray_init( &f->c[0], ro, d0 );
+  lm_ray_init( &f->c[1], ro, d1 );
+  lm_ray_init( &f->c[2], ro, d2 );
+  lm_ray_init( &f->c[3], ro, d3 );
+
+  f->fwd = f->c[0].d;
+  for( i=1; i<4; i++ ) {
+    lm_vec3_add( &f->fwd, f->fwd, f->c[i].d );
+  }
+  lm_vec3_add( &p, ro, f->fwd );
+
+  // orient each side by a point on the centre ray, which is inside
+  for( i=0; i<4; i++ ) {
+    f->inside[i] = 1.0f;
+    f->inside[i] = (lm_tile_side( f, i, p ) < 0.0f) ? -1.0f : 1.0f;
+
+    lm_vec3_cross( &e, f->c[i].d, f->c[(i + 1) & 3].d );
+    lm_vec3_dot( &len, e, e );
+    f->dist[i] = (len > 0.0f) ? 1.0f / sqrt( len ) : 0.0f;
+  }
+}
+
+// the box with corners lo and hi
+int lm_tile_box( const lm_tile *f, vec3 lo, vec3 hi ) {
+  vec3 v, o;
+  float d;
+  int i, k, out, front = 1;
+
+  for( i=0; i<4; i++ ) {
+    out = 1;
+    for( k=0; k<8 && out; k++ ) {
+      v.x = (k & 1) ? hi.x : lo.x;
+      v.y = (k & 2) ? hi.y : lo.y;
+      v.z = (k & 4) ? hi.z : lo.z;
+      lm_vec3_sub( &o, v, f->c[0].o );
+      out = lm_tile_side( f, i, v ) * f->dist[i] < -LM_TILE_EPS * (fabsf( o.x ) + fabsf( o.y ) + fabsf( o.z ));
+    }
+    if( out ) {
+      return LM_TILE_MISS;
+    }
+  }
+
+  for( k=0; k<8; k++ ) {
+    v.x = (k & 1) ? hi.x : lo.x;
+    v.y = (k & 2) ? hi.y : lo.y;
+    v.z = (k & 4) ? hi.z : lo.z;
+    lm_vec3_sub( &o, v, f->c[0].o );
+    lm_vec3_dot( &d, o, f->fwd );
+    front &= d > 0.0f;
+  }
+
+  for( i=0; i<4 && front; i++ ) {
+    if( !lm_ray_boxint_plucker( &f->c[i], hi, lo )) {
+      return LM_TILE_MIXED;
+    }
+  }
+  return front ? LM_TILE_HIT : LM_TILE_MIXED;
+}
+
+// the sphere centred on p0
+int lm_tile_sphere( const lm_tile *f, vec3 p0, float rad ) {
+  vec3 o;
+  float d, eps;
+  int i;
+
+  lm_vec3_sub( &o, p0, f->c[0].o );
+  eps = LM_TILE_EPS * (fabsf( o.x ) + fabsf( o.y ) + fabsf( o.z ) + rad);
+  for( i=0; i<4; i++ ) {
+    if( lm_tile_side( f, i, p0 ) * f->dist[i] < -rad - eps ) {
+      return LM_TILE_MISS;
+    }
+  }
+
+  for( i=0; i<4; i++ ) {
+    lm_vec3_dot( &d, o, f->c[i].d );
+    if( d <= 0.0f || !lm_ray_sphereint( &f->c[i], p0, rad, NULL )) {
+      return LM_TILE_MIXED;
+    }
+  }
+  return LM_TILE_HIT;
+}
+
+//
+// Quadtree coverage -=:LogicMonkey:=-
+//
+// A hit/miss mask is mostly big flat regions, so rather than a ray per pixel
+// lm_quad_cover traces the four corner pixels of a block. When they agree and
+// the block's frustum classifies the same way - so no edge of the object
+// crosses the block - it is filled without tracing the inside, otherwise it
+// is split in four. Blocks of LM_QUAD_MIN pixels or less across are traced
+// pixel by pixel. Corner pixels shared by neighbouring blocks are cached in a
+// per pixel state array so each ray is traced once at most.
+//
+// The caller supplies the per pixel test and the frustum classification, the
+// camera is the drivers' - pixel x, y is the ray from ro through (x, y, depth).
+//
+#define LM_QUAD_MIN 4
+
+typedef int (*lm_quad_ray)( void *arg, vec3 ro, vec3 rd );
+typedef int (*lm_quad_tile)( void *arg, const lm_tile *f );
+
+typedef struct {
+  float *buffer;
+  signed char *state;          // -1 untraced, else 0 miss 1 hit
+  int width;
+  vec3 ro;
+  float depth;
+  lm_quad_ray ray;
+  lm_quad_tile tile;
+  void *arg;
+  long rays;
+} lm_quad_ctx;
+
+vec3 lm_quad_dir( const lm_quad_ctx *q, int x, int y ) {
+  vec3 rd;
+  rd.x = (float) x;
+  rd.y = (float) y;
+  rd.z = q->depth;
+  return rd;
+}
+
+int lm_quad_pixel( lm_quad_ctx *q, int x, int y ) {
+  signed char *s = &q->state[y * q->width + x];
+
+  if( *s < 0 ) {
+    *s = q->ray( q->arg, q->ro, lm_quad_dir( q, x, y )) ? 1 : 0;
+    q->buffer[y * q->width + x] = *s;
+    q->rays++;
+  }
+  return *s;
+}
+
+void lm_quad_block( lm_quad_ctx *q, int x0, int y0, int x1, int y1 ) {
+  lm_tile f;
+  int x, y, xm, ym, c;
+
+  if( x1 - x0 < LM_QUAD_MIN || y1 - y0 < LM_QUAD_MIN ) {
+    for( y=y0; y<=y1; y++ ) {
+      for( x=x0; x<=x1; x++ ) {
+        lm_quad_pixel( q, x, y );
+      }
+    }
+    return;
+  }
+
+  c = lm_quad_pixel( q, x0, y0 );
+  if( lm_quad_pixel( q, x1, y0 ) == c && lm_quad_pixel( q, x1, y1 ) == c && lm_quad_pixel( q, x0, y1 ) == c ) {
+    lm_tile_init( &f, q->ro, lm_quad_dir( q, x0, y0 ), lm_quad_dir( q, x1, y0 ),
+                              lm_quad_dir( q, x1, y1 ), lm_quad_dir( q, x0, y1 ));
+    if( q->tile( q->arg, &f ) == (c ? LM_TILE_HIT : LM_TILE_MISS) ) {
+      for( y=y0; y<=y1; y++ ) {
+        for( x=x0; x<=x1; x++ ) {
+          q->buffer[y * q->width + x] = c;
+        }
+      }
+      return;
+    }
+  }
+
+  xm = (x0 + x1) / 2;
+  ym = (y0 + y1) / 2;
+  lm_quad_block( q, x0,     y0,     xm, ym );
+  lm_quad_block( q, xm + 1, y0,     x1, ym );
+  lm_quad_block( q, x0,     ym + 1, xm, y1 );
+  lm_quad_block( q, xm + 1, ym + 1, x1, y1 );
+}
+
+// Fill buffer with 1.0 where ray reports a hit and 0.0 elsewhere. Returns the
+// number of rays traced, or -1 on allocation failure.
+long lm_quad_cover( float *buffer, int width, int height, vec3 ro, float depth,
+                    lm_quad_ray ray, lm_quad_tile tile, void *arg ) {
+  lm_quad_ctx q;
+
+  q.state = (signed char *) malloc( width * height );
+  if( q.state == NULL ) {
+    return -1;
+  }
+  memset( q.state, -1, width * height );
+
+  q.buffer = buffer;
+  q.width  = width;
+  q.ro     = ro;
+  q.depth  = depth;
+  q.ray    = ray;
+  q.tile   = tile;
+  q.arg    = arg;
+  q.rays   = 0;
+
+  if( width > 0 && height > 0 ) {
+    lm_quad_block( &q, 0, 0, width - 1, height - 1 );
+  }
+
+  free( q.state );
+  return q.rays;
+}
+
+#endif
+
+//
+// Screen space bounds -=:LogicMonkey:=-
+//
+// The drivers' pinhole camera sits at the origin and pixel x, y is the ray
+// through (x, y, depth), so a point P lands on pixel depth.Px/Pz, depth.Py/Pz.
+// Taken over a box that is largest and smallest at its vertices. A sphere's
+// edges are where the planes through the origin touch it - for the x
+// extent, the planes x = k.z with
+//
+//   (cz^2 - r^2).k^2 - 2.cx.cz.k + cx^2 - r^2 = 0
+//
+// and likewise for y. Anything reaching back to z <= 0 (a sphere to within
+// its radius) can't be bounded and gets the whole image. Rectangles are
+// rounded out by a pixel and clipped to the image, x0, y0 inclusive and x1,
+// y1 exclusive. Plain floats in and out so an MP build can use them too.
+//
+typedef struct {
+  int x0, y0, x1, y1;
+} lm_rect;
+
+void lm_rect_set( lm_rect *r, float x0, float y0, float x1, float y1, int width, int height ) {
+  r->x0 = (int) MAX( floorf( x0 ) - 1.0f, 0.0f );
+  r->y0 = (int) MAX( floorf( y0 ) - 1.0f, 0.0f );
+  r->x1 = (int) MIN( ceilf( x1 ) + 2.0f, (float) width );
+  r->y1 = (int) MIN( ceilf( y1 ) + 2.0f, (float) height );
+  if( r->x0 >= r->x1 || r->y0 >= r->y1 ) {
+    r->x0 = r->y0 = r->x1 = r->y1 = 0;
+  }
+}
+
+void lm_rect_union( lm_rect *r, const lm_rect *a ) {
+  if( a->x0 >= a->x1 ) {
+    return;
+  }
+  if( r->x0 >= r->x1 ) {
+    *r = *a;
+    return;
+  }
+  r->x0 = MIN( r->x0, a->x0 );
+  r->y0 = MIN( r->y0, a->y0 );
+  r->x1 = MAX( r->x1, a->x1 );
+  r->y1 = MAX( r->y1, a->y1 );
+}
+
+// the box with corners lo and hi
+void lm_rect_box( lm_rect *r, const float *lo, const float *hi, float depth, int width, int height ) {
+  float x, y, z, sx0 = INFINITY, sy0 = INFINITY, sx1 = -INFINITY, sy1 = -INFINITY;
+  int k;
+
+  for( k=0; k<8; k++ ) {
+    x = (k & 1) ? hi[0] : lo[0];
+    y = (k & 2) ? hi[1] : lo[1];
+    z = (k & 4) ? hi[2] : lo[2];
+    if( z <= 0.0f ) {
+      lm_rect_set( r, 0.0f, 0.0f, width, height, width, height );
+      return;
+    }
+    sx0 = MIN( sx0, depth * x / z );
+    sy0 = MIN( sy0, depth * y / z );
+    sx1 = MAX( sx1, depth * x / z );
+    sy1 = MAX( sy1, depth * y / z );
+  }
+  lm_rect_set( r, sx0, sy0, sx1, sy1, width, height );
+}
+
+// the sphere centred on c
+void lm_rect_sphere( lm_rect *r, const float *c, float rad, float depth, int width, int height ) {
+  float a, h, s[4];
+  int i;
+
+  if( c[2] <= rad ) {
+    lm_rect_set( r, 0.0f, 0.0f, width, height, width, height );
+    return;
+  }
+
+  a = c[2]*c[2] - rad*rad;
+  for( i=0; i<2; i++ ) {
+    h = rad * sqrt( c[i]*c[i] + a );
+    s[i]   = depth * (c[i]*c[2] - h) / a;
+    s[i+2] = depth * (c[i]*c[2] + h) / a;
+  }
+  lm_rect_set( r, s[0], s[1], s[2], s[3], width, height );
+}
+
+#endif
@@ -0,0 +1,164 @@
+// Row at a time colour mapping -=:LogicMonkey:=-
+//
+// Every driver shows a float per pixel through the same three band ramp -
+// 0 to 1 runs black to blue, through green, to red - over 768 steps:
+//
+//   v = (int) (val * 767) clamped to 0..767
+//   v <  256   r = 0        g = 0          b = v
+//   v <  512   r = 0        g = v - 256    b = 511 - v
+//   else       r = v - 512  g = 767 - v    b = 0
+//
+// Rather than branch per pixel, lm_tonemap_init fills 768 entry tables of the
+// finished pixel for each output - RGB888 for PNG rows, RGB565 and XRGB8888
+// for 16 and 32 bit framebuffers, and a character ramp for the console. A
+// row is then scaled and clamped to indices with SIMD (AVX, SSE2 or scalar,
+// following the -m flags) and looked up. Clamping happens in float. NaN and
+// anything too big for an int land on 0 - black - which is what the (int)
+// cast gave on x86, so the pictures don't change.
+//
+// The RGB888 table keeps a spare byte per entry so each pixel is one 4 byte
+// copy, the spare byte overwritten by the next pixel.
+//
+#ifndef LM_TONEMAP_H
+#define LM_TONEMAP_H
+
+#include <string.h>
+
+#if defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+#define LM_TONEMAP_SIZE  768
+#define LM_TONEMAP_BLOCK 256          // indices worked out at a time
+
+// darkest to brightest, miss to hit
+#define LM_TONEMAP_ASCII ".:-=+*%#"
+
+typedef struct {
+  unsigned char rgb[LM_TONEMAP_SIZE][4];        // r, g, b, spare
+  unsigned short rgb565[LM_TONEMAP_SIZE];
+  unsigned int xrgb[LM_TONEMAP_SIZE];
+  char ascii[LM_TONEMAP_SIZE];
+} lm_tonemap_lut;
+
+void lm_tonemap_init( lm_tonemap_lut *lut ) {
+  int v, r, g, b;
+  int levels = sizeof(LM_TONEMAP_ASCII) - 1;
+
+  for( v=0; v<LM_TONEMAP_SIZE; v++ ) {
+    if( v < 256 ) {
+      r = 0;        g = 0;         b = v;
+    } else if( v < 512 ) {
+      r = 0;        g = v - 256;   b = 511 - v;
+    } else {
+      r = v - 512;  g = 767 - v;   b = 0;
+    }
+    lut->rgb[v][0] = r;
+    lut->rgb[v][1] = g;
+    lut->rgb[v][2] = b;
+    lut->rgb[v][3] = 0;
+    lut->rgb565[v] = (r >> 3) << 11 | (g >> 2) << 5 | (b >> 3);
+    lut->xrgb[v]   = (unsigned int) r << 16 | g << 8 | b;
+    lut->ascii[v]  = LM_TONEMAP_ASCII[ v * levels / LM_TONEMAP_SIZE ];
+  }
+}
+
+// table index of each of n values
+void lm_tonemap_index( int *idx, const float *val, int n ) {
+  int i = 0;
+  float f;
+
+#if defined(__AVX__)
+  __m256 scale8 = _mm256_set1_ps( 767.0f );
+  __m256 zero8  = _mm256_setzero_ps();
+  __m256 big8   = _mm256_set1_ps( 2147483648.0f );
+  for( ; i+8<=n; i+=8 ) {
+    __m256 v = _mm256_mul_ps( _mm256_loadu_ps( val + i ), scale8 );
+    v = _mm256_and_ps( v, _mm256_cmp_ps( v, big8, _CMP_LT_OQ ));
+    v = _mm256_min_ps( _mm256_max_ps( v, zero8 ), scale8 );
+    _mm256_storeu_si256( (__m256i *) (idx + i), _mm256_cvttps_epi32( v ));
+  }
+#endif
+#if defined(__SSE2__)
+  __m128 scale4 = _mm_set1_ps( 767.0f );
+  __m128 zero4  = _mm_setzero_ps();
+  __m128 big4   = _mm_set1_ps( 2147483648.0f );
+  for( ; i+4<=n; i+=4 ) {
+    __m128 v = _mm_mul_ps( _mm_loadu_ps( val + i ), scale4 );
+    v = _mm_and_ps( v, _mm_cmplt_ps( v, big4 ));
+    v = _mm_min_ps( _mm_max_ps( v, zero4 ), scale4 );
+    _mm_storeu_si128( (__m128i *) (idx + i), _mm_cvttps_epi32( v ));
+  }
+#endif
+  for( ; i<n; i++ ) {
+    f = val[i] * 767.0f;
+    f = (f > 0.0f && f < 2147483648.0f) ? f : 0.0f;
+    f = (f < 767.0f) ? f : 767.0f;
+    idx[i] = (int) f;
+  }
+}
+
+// n floats to 3 byte pixels
+void lm_tonemap_rgb888( const lm_tonemap_lut *lut, unsigned char *out, const float *val, int n ) {
+  int idx[LM_TONEMAP_BLOCK];
+  int i, j, m;
+
+  for( i=0; i<n; i+=m ) {
+    m = (n - i < LM_TONEMAP_BLOCK) ? n - i : LM_TONEMAP_BLOCK;
+    lm_tonemap_index( idx, val + i, m );
+    for( j=0; j<m-1; j++ ) {
+      memcpy( out + 3 * (i + j), lut->rgb[idx[j]], 4 );
+    }
+    memcpy( out + 3 * (i + j), lut->rgb[idx[j]], 3 );
+  }
+}
+
+void lm_tonemap_rgb565( const lm_tonemap_lut *lut, unsigned short *out, const float *val, int n ) {
+  int idx[LM_TONEMAP_BLOCK];
+  int i, j, m;
+
+  for( i=0; i<n; i+=m ) {
+    m = (n - i < LM_TONEMAP_BLOCK) ? n - i : LM_TONEMAP_BLOCK;
+    lm_tonemap_index( idx, val + i, m );
+    for( j=0; j<m; j++ ) {
+      out[i+j] = lut->rgb565[idx[j]];
+    }
+  }
+}
+
+void lm_tonemap_xrgb8888( const lm_tonemap_lut *lut, unsigned int *out, const float *val, int n ) {
+  int idx[LM_TONEMAP_BLOCK];
+  int i, j, m;
+
+  for( i=0; i<n; i+=m ) {
+    m = (n - i < LM_TONEMAP_BLOCK) ? n - i : LM_TONEMAP_BLOCK;
+    lm_tonemap_index( idx, val + i, m );
+    j = 0;
+#if defined(__AVX2__)
+    for( ; j+8<=m; j+=8 ) {
+      _mm256_storeu_si256( (__m256i *) (out + i + j),
+                           _mm256_i32gather_epi32( (const int *) lut->xrgb,
+                                                   _mm256_loadu_si256( (const __m256i *) (idx + j) ), 4 ));
+    }
+#endif
+    for( ; j<m; j++ ) {
+      out[i+j] = lut->xrgb[idx[j]];
+    }
+  }
+}
+
+// n characters, not terminated
+void lm_tonemap_ascii( const lm_tonemap_lut *lut, char *out, const float *val, int n ) {
+  int idx[LM_TONEMAP_BLOCK];
+  int i, j, m;
+
+  for( i=0; i<n; i+=m ) {
+    m = (n - i < LM_TONEMAP_BLOCK) ? n - i : LM_TONEMAP_BLOCK;
+    lm_tonemap_index( idx, val + i, m );
+    for( j=0; j<m; j++ ) {
+      out[i+j] = lut->ascii[idx[j]];
+    }
+  }
+}
+
+#endif
@@ -0,0 +1,325 @@
+// LibPNG example :: A.Greensted :: http://www.labbookpages.co.uk
+
+#include <stdio.h>
+#include <math.h>
+#include <string.h>
+#include <malloc.h>
+#include <time.h>
+#include <png.h>
+#include "lm_tonemap.h"
+#include "lm_cache.h"
+#include "lm_render.h"
+#include "lm_stream.h"
+
+typedef struct {
+  const lm_bvh_flat *bvh;
+  float *buffer;
+  int row0;                   // image row of buffer[0]
+  int width, height, order;
+} lm_rt_scene;
+
+// This function renders the scene and writes out the PNG image file a band of
+// rows at a time. The string 'title' is also written into the image file
+int writeImage(char* filename, int width, int height, lm_rt_scene *scene, char* title);
+
+vec3 *lm_torus( int segments, int *ntri );
+void lm_rt_band( void *arg, float *band, int y0, int y1 );
+
+double now() {
+  struct timespec ts;
+  clock_gettime( CLOCK_MONOTONIC, &ts );
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+int main(int argc, char *argv[]) {
+  // Make sure that the output filename argument has been provided
+  if (argc < 2 || argc > 6 || argc == 5) {
+    fprintf(stderr, "Please specify output file [torus segments [BVH cache file|- [width height]]]\n");
+    return 1;
+  }
+
+  int width = (argc == 6) ? atoi(argv[4]) : 640;
+  int height = (argc == 6) ? atoi(argv[5]) : 480;
+  int segments = (argc >= 3) ? atoi(argv[2]) : 256;
+  int ntri;
+  double start;
+  lm_bvh tree;
+  lm_bvh_flat bvh;
+  lm_bvh_map map;
+  const lm_bvh_flat *trace = &bvh;
+  lm_rt_scene scene;
+
+  map.base = NULL;
+
+  // Tessellated torus - 2 * segments^2 triangles
+  vec3 *soup = lm_torus( segments, &ntri );
+  if (soup == NULL) {
+    fprintf(stderr, "Could not create mesh\n");
+    return 1;
+  }
+
+  start = now();
+  if (argc >= 4 && strcmp(argv[3], "-") != 0) {
+    // Map the hierarchy from the cache, building and writing it first if it
+    // is missing or was made from a different mesh
+    int got = lm_bvh_cache_load( &map, argv[3], soup, ntri );
+    free(soup);
+    if (!got) {
+      fprintf(stderr, "Could not build BVH\n");
+      return 1;
+    }
+    trace = &map.flat;
+    printf("%d triangles, %d nodes, %s %s in %.3fs\n", ntri, map.flat.nodes,
+           (got == 1) ? "mapped from" : (got == 2) ? "built and cached to" : "built, could not cache to",
+           argv[3], now() - start);
+  } else {
+    if (!lm_bvh_build( &tree, soup, ntri )) {
+      fprintf(stderr, "Could not build BVH\n");
+      free(soup);
+      return 1;
+    }
+    free(soup);
+
+    // Trace through the flat node array, the pointer tree isn't needed after
+    if (!lm_bvh_flatten( &bvh, &tree )) {
+      fprintf(stderr, "Could not flatten BVH\n");
+      lm_bvh_free( &tree );
+      return 1;
+    }
+    printf("%d triangles, %d nodes, %d leaves, built in %.3fs\n", ntri, tree.nodes, tree.leaves, now() - start);
+    lm_bvh_free( &tree );
+  }
+
+  scene.bvh    = trace;
+  scene.width  = width;
+  scene.height = height;
+  scene.order  = LM_RENDER_ORDER;
+
+  // Render straight into a PNG file - only a few bands of the image are ever
+  // held as floats
+  start = now();
+  int result = writeImage(argv[1], width, height, &scene, "This is my test image");
+  printf("%d x %d rays traced and written in %.3fs\n", width, height, now() - start);
+
+  if (map.base != NULL) {
+    lm_bvh_cache_unmap( &map );
+  } else {
+    lm_bvh_flat_free( &bvh );
+  }
+
+  return result;
+}
+
+// Write the rows out as the band renderer finishes them
+typedef struct {
+  png_structp png_ptr;
+  png_bytep row;
+  int width;
+  lm_tonemap_lut lut;
+} lm_png_rows;
+
+// png_write_row can only report an error by longjmp, so each row sets its own
+// handler - writeImage must set its own again once the rows are done
+int lm_png_row(void *arg, const float *buffer, int y) {
+  lm_png_rows *out = (lm_png_rows *) arg;
+
+  (void) y;
+  if (setjmp(png_jmpbuf(out->png_ptr))) {
+    fprintf(stderr, "Error during png creation\n");
+    return 1;
+  }
+
+  lm_tonemap_rgb888(&out->lut, out->row, buffer, out->width);
+  png_write_row(out->png_ptr, out->row);
+  return 0;
+}
+
+int writeImage(char* filename, int width, int height, lm_rt_scene *scene, char* title) {
+  int code = 0;
+  FILE *fp;
+  png_structp png_ptr;
+  png_infop info_ptr;
+  png_bytep row;
+
+  // Open file for writing (binary mode)
+  fp = fopen(filename, "wb");
+  if (fp == NULL) {
+    fprintf(stderr, "Could not open file %s for writing\n", filename);
+    code = 1;
+    goto finalise;
+  }
+
+  // Initialize write structure
+  png_ptr = png_create_write_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
+  if (png_ptr == NULL) {
+    fprintf(stderr, "Could not allocate write struct\n");
+    code = 1;
+    goto finalise;
+  }
+
+  // Initialize info structure
+  info_ptr = png_create_info_struct(png_ptr);
+  if (info_ptr == NULL) {
+    fprintf(stderr, "Could not allocate info struct\n");
+    code = 1;
+    goto finalise;
+  }
+
+  // Setup Exception handling
+  if (setjmp(png_jmpbuf(png_ptr))) {
+    fprintf(stderr, "Error during png creation\n");
+    code = 1;
+    goto finalise;
+  }
+
+  png_init_io(png_ptr, fp);
+
+  // Write header (8 bit colour depth)
+  png_set_IHDR(png_ptr, info_ptr, width, height,
+      8, PNG_COLOR_TYPE_RGB, PNG_INTERLACE_NONE,
+      PNG_COMPRESSION_TYPE_BASE, PNG_FILTER_TYPE_BASE);
+
+  // Set title
+  if (title != NULL) {
+    png_text title_text;
+    title_text.compression = PNG_TEXT_COMPRESSION_NONE;
+    title_text.key = "Title";
+    title_text.text = title;
+    png_set_text(png_ptr, info_ptr, &title_text, 1);
+  }
+
+  png_write_info(png_ptr, info_ptr);
+
+  // Allocate memory for one row (3 bytes per pixel - RGB)
+  row = (png_bytep) malloc(3 * width * sizeof(png_byte));
+
+  // Render and write image data, one row of pixels after another
+  lm_png_rows out;
+  out.png_ptr = png_ptr;
+  out.row = row;
+  out.width = width;
+  lm_tonemap_init(&out.lut);
+  if (lm_stream(width, height, LM_STREAM_BAND, LM_RENDER_THREADS, lm_rt_band, scene, lm_png_row, &out)) {
+    fprintf(stderr, "Could not render image\n");
+    code = 1;
+    goto finalise;
+  }
+
+  // The rows left png_jmpbuf pointing at lm_png_row's finished frame, so
+  // take exception handling back before the final flush
+  if (setjmp(png_jmpbuf(png_ptr))) {
+    fprintf(stderr, "Error during png creation\n");
+    code = 1;
+    goto finalise;
+  }
+
+  // End write
+  png_write_end(png_ptr, NULL);
+
+  finalise:
+  if (fp != NULL) fclose(fp);
+  if (info_ptr != NULL) png_free_data(png_ptr, info_ptr, PNG_FREE_ALL, -1);
+  if (png_ptr != NULL) png_destroy_write_struct(&png_ptr, (png_infopp)NULL);
+  if (row != NULL) free(row);
+
+  return code;
+}
+
+// A torus lying tilted in front of the camera. The quads are wound so that
+// E1 X E0 points into the tube - the side rays from the camera arrive at.
+vec3 *lm_torus( int segments, int *ntri ) {
+  int i, j, k = 0;
+  int nu = segments, nv = segments;
+  float major = 3.0f, minor = 1.2f, tilt = 1.0f;
+  vec3 *grid, *soup;
+
+  if (segments < 3) {
+    return NULL;
+  }
+
+  grid = (vec3 *) malloc( (nu + 1) * (nv + 1) * sizeof(vec3) );
+  soup = (vec3 *) malloc( 6 * nu * nv * sizeof(vec3) );
+  if (grid == NULL || soup == NULL) {
+    free(grid);
+    free(soup);
+    return NULL;
+  }
+
+  for( i=0; i<=nu; i++ ) {
+    for( j=0; j<=nv; j++ ) {
+      float u = 2.0f * M_PI * (i % nu) / nu;
+      float v = 2.0f * M_PI * (j % nv) / nv;
+      float x = (major + minor * cos(v)) * cos(u);
+      float y = (major + minor * cos(v)) * sin(u);
+      float z = minor * sin(v);
+
+      // tilt about the x axis and push away from the camera
+      grid[i * (nv + 1) + j].x = x;
+      grid[i * (nv + 1) + j].y = y * cos(tilt) - z * sin(tilt);
+      grid[i * (nv + 1) + j].z = y * sin(tilt) + z * cos(tilt) + 12.0f;
+    }
+  }
+
+  for( i=0; i<nu; i++ ) {
+    for( j=0; j<nv; j++ ) {
+      vec3 p00 = grid[ i      * (nv + 1) + j     ];
+      vec3 p10 = grid[(i + 1) * (nv + 1) + j     ];
+      vec3 p01 = grid[ i      * (nv + 1) + j + 1 ];
+      vec3 p11 = grid[(i + 1) * (nv + 1) + j + 1 ];
+
+      soup[k++] = p00; soup[k++] = p11; soup[k++] = p10;
+      soup[k++] = p00; soup[k++] = p01; soup[k++] = p11;
+    }
+  }
+
+  free(grid);
+  *ntri = 2 * nu * nv;
+  return soup;
+}
+
+// one tile of the image - tiles write disjoint pixels so can run in parallel
+void lm_rt_tile( void *arg, int x0, int y0, int x1, int y1 ) {
+  const lm_rt_scene *scene = (const lm_rt_scene *) arg;
+  const lm_bvh_flat *bvh = scene->bvh;
+  int width = scene->width, height = scene->height;
+  int x, y;
+  vec3 ro, rd;
+  lm_ray ray;
+  lm_hit hit;
+
+  // All rays originate from 0,0,0 - the image is centred on the z axis
+  //
+  ro.x = 0.0f;
+  ro.y = 0.0f;
+  ro.z = 0.0f;
+
+  for( y=y0; y<y1; y++ ) {
+    for( x=x0; x<x1; x++ ) {
+
+      rd.x = (float) (x - width / 2);
+      rd.y = (float) (y - height / 2);
+      rd.z = (float) width;   // pinhole camera with screen at depth width
+
+      lm_ray_init( &ray, ro, rd );
+
+      // shade by the angle between the ray and the triangle that was hit
+      if (lm_bvh_flat_intersect( bvh, &ray, INFINITY, &hit )) {
+        float ndotd, nn;
+        lm_vec3_dot( &ndotd, bvh->tri[hit.rec].n, ray.d );
+        lm_vec3_dot( &nn, bvh->tri[hit.rec].n, bvh->tri[hit.rec].n );
+        scene->buffer[ (y - scene->row0) * width + x ] = ndotd / sqrt( nn );
+      } else {
+        scene->buffer[ (y - scene->row0) * width + x ] = 0.0f;
+      }
+    }
+  }
+}
+
+// one band of rows for lm_stream, its tiles visited in the scene's LM_ORDER_*
+void lm_rt_band( void *arg, float *band, int y0, int y1 ) {
+  lm_rt_scene scene = *(const lm_rt_scene *) arg;
+
+  scene.buffer = band;
+  scene.row0   = y0;
+  lm_render_order( 0, y0, scene.width, y1, 16, scene.order, lm_rt_tile, &scene, 1 );
+}
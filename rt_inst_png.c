@@ -0,0 +1,268 @@
+// LibPNG example :: A.Greensted :: http://www.labbookpages.co.uk
+
+#include <stdio.h>
+#include <math.h>
+#include <malloc.h>
+#include <time.h>
+#include <png.h>
+#include "lm_tonemap.h"
+#include "lm_inst.h"
+#include "lm_render.h"
+#include "lm_png.h"
+
+// This function actually writes out the PNG image file. The string 'title' is
+// also written into the image file
+int writeImage(char* filename, int width, int height, float *buffer, char* title);
+
+vec3 *lm_torus( int segments, int *ntri );
+float *lm_rt_primary_rays( int width, int height, const lm_tlas *tlas, int order );
+
+float frand( float lo, float hi ) {
+  return lo + (hi - lo) * ((float) rand() / (float) RAND_MAX);
+}
+
+double now() {
+  struct timespec ts;
+  clock_gettime( CLOCK_MONOTONIC, &ts );
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+int main(int argc, char *argv[]) {
+  // Make sure that the output filename argument has been provided
+  if (argc != 2 && argc != 3) {
+    fprintf(stderr, "Please specify output file [and instance count]\n");
+    return 1;
+  }
+
+  int width = 640;
+  int height = 480;
+  int count = (argc == 3) ? atoi(argv[2]) : 1000;
+  int ntri, i;
+  double start;
+  lm_bvh tree;
+  lm_bvh_flat mesh;
+  lm_tlas tlas;
+  lm_xform x, step;
+  vec3 axis, at;
+
+  // One tessellated torus in object space - 2 * 64^2 triangles
+  vec3 *soup = lm_torus( 64, &ntri );
+  lm_inst *inst = (lm_inst *) malloc( (count > 0 ? count : 1) * sizeof(lm_inst) );
+
+  if (soup == NULL || inst == NULL) {
+    fprintf(stderr, "Could not create scene\n");
+    free(soup);
+    free(inst);
+    return 1;
+  }
+
+  start = now();
+  if (!lm_bvh_build( &tree, soup, ntri )) {
+    fprintf(stderr, "Could not build BVH\n");
+    return 1;
+  }
+  free(soup);
+
+  if (!lm_bvh_flatten( &mesh, &tree )) {
+    fprintf(stderr, "Could not flatten BVH\n");
+    return 1;
+  }
+  lm_bvh_free( &tree );
+  printf("mesh: %d triangles, %d nodes, built in %.3fs\n", ntri, mesh.nodes, now() - start);
+
+  // Scatter the copies through the view, each turned and sized at random
+  srand( 1 );
+  for (i = 0; i < count; i++) {
+    axis.x = frand( -1.0f, 1.0f );
+    axis.y = frand( -1.0f, 1.0f );
+    axis.z = frand( -1.0f, 1.0f );
+    at.z = frand( 15.0f, 120.0f );
+    at.x = frand( -0.55f, 0.55f ) * at.z;
+    at.y = frand( -0.4f, 0.4f ) * at.z;
+
+    lm_xform_scale( &x, frand( 0.3f, 1.0f ) );
+    lm_xform_rotate( &step, axis, frand( 0.0f, 2.0f * M_PI ) );
+    lm_xform_mul( &x, &step, &x );
+    lm_xform_translate( &step, at );
+    lm_xform_mul( &x, &step, &x );
+    lm_inst_set( &inst[i], &mesh, &x );
+  }
+
+  start = now();
+  if (!lm_tlas_build( &tlas, inst, count )) {
+    fprintf(stderr, "Could not build TLAS\n");
+    return 1;
+  }
+  free(inst);
+  printf("%d instances, %d top level nodes, built in %.3fs\n", count, tlas.top.nodes, now() - start);
+  printf("memory: mesh %zu bytes + instances %zu bytes, flattened copies would be %zu bytes\n",
+         mesh.nodes * sizeof(lm_bvh_flat_node) + ntri * (sizeof(lm_tri) + sizeof(int)),
+         tlas.top.nodes * sizeof(lm_bvh_flat_node) + count * (sizeof(lm_inst) + sizeof(int)),
+         count * (mesh.nodes * sizeof(lm_bvh_flat_node) + ntri * (sizeof(lm_tri) + sizeof(int))));
+
+  // Create image - a 1D array of floats, length: width * height
+  start = now();
+  float *buffer = lm_rt_primary_rays( width, height, &tlas, LM_RENDER_ORDER );
+  if (buffer == NULL) {
+    lm_tlas_free( &tlas );
+    lm_bvh_flat_free( &mesh );
+    return 1;
+  }
+  printf("%d x %d rays traced in %.3fs\n", width, height, now() - start);
+
+  // Save the image to a PNG file
+  int result = writeImage(argv[1], width, height, buffer, "This is my test image");
+
+  free(buffer);
+  lm_tlas_free( &tlas );
+  lm_bvh_flat_free( &mesh );
+
+  return result;
+}
+
+// Rows for lm_png_write, coloured a row at a time from the float image
+typedef struct {
+  float *buffer;
+  int width;
+  lm_tonemap_lut lut;
+} lm_png_image;
+
+void lm_png_rgb_row(void *arg, int y, unsigned char *rgb) {
+  const lm_png_image *image = (const lm_png_image *) arg;
+
+  lm_tonemap_rgb888(&image->lut, rgb, &image->buffer[y*image->width], image->width);
+}
+
+int writeImage(char* filename, int width, int height, float *buffer, char* title) {
+  lm_png_image image;
+
+  image.buffer = buffer;
+  image.width = width;
+  lm_tonemap_init(&image.lut);
+
+  // Filter and deflate stripes of rows on every core
+  return lm_png_write(filename, width, height, lm_png_rgb_row, &image, title,
+                      LM_PNG_FILTER, LM_PNG_LEVEL, LM_RENDER_THREADS);
+}
+
+// A torus about the origin in the x,y plane. The quads are wound so that
+// E1 X E0 points into the tube - the side rays from outside arrive at.
+vec3 *lm_torus( int segments, int *ntri ) {
+  int i, j, k = 0;
+  int nu = segments, nv = segments;
+  float major = 3.0f, minor = 1.2f;
+  vec3 *grid, *soup;
+
+  if (segments < 3) {
+    return NULL;
+  }
+
+  grid = (vec3 *) malloc( (nu + 1) * (nv + 1) * sizeof(vec3) );
+  soup = (vec3 *) malloc( 6 * nu * nv * sizeof(vec3) );
+  if (grid == NULL || soup == NULL) {
+    free(grid);
+    free(soup);
+    return NULL;
+  }
+
+  for( i=0; i<=nu; i++ ) {
+    for( j=0; j<=nv; j++ ) {
+      float u = 2.0f * M_PI * (i % nu) / nu;
+      float v = 2.0f * M_PI * (j % nv) / nv;
+      float x = (major + minor * cos(v)) * cos(u);
+      float y = (major + minor * cos(v)) * sin(u);
+      float z = minor * sin(v);
+
+      grid[i * (nv + 1) + j].x = x;
+      grid[i * (nv + 1) + j].y = y;
+      grid[i * (nv + 1) + j].z = z;
+    }
+  }
+
+  for( i=0; i<nu; i++ ) {
+    for( j=0; j<nv; j++ ) {
+      vec3 p00 = grid[ i      * (nv + 1) + j     ];
+      vec3 p10 = grid[(i + 1) * (nv + 1) + j     ];
+      vec3 p01 = grid[ i      * (nv + 1) + j + 1 ];
+      vec3 p11 = grid[(i + 1) * (nv + 1) + j + 1 ];
+
+      soup[k++] = p00; soup[k++] = p11; soup[k++] = p10;
+      soup[k++] = p00; soup[k++] = p01; soup[k++] = p11;
+    }
+  }
+
+  free(grid);
+  *ntri = 2 * nu * nv;
+  return soup;
+}
+
+typedef struct {
+  const lm_tlas *tlas;
+  float *buffer;
+  int width, height;
+} lm_rt_scene;
+
+// one tile of the image - tiles write disjoint pixels so can run in parallel
+void lm_rt_tile( void *arg, int x0, int y0, int x1, int y1 ) {
+  const lm_rt_scene *scene = (const lm_rt_scene *) arg;
+  const lm_tlas *tlas = scene->tlas;
+  int width = scene->width, height = scene->height;
+  int x, y;
+  vec3 ro, rd;
+  lm_ray ray;
+  lm_hit hit;
+  int inst;
+  vec3 n;
+
+  // All rays originate from 0,0,0 - the image is centred on the z axis
+  //
+  ro.x = 0.0f;
+  ro.y = 0.0f;
+  ro.z = 0.0f;
+
+  for( y=y0; y<y1; y++ ) {
+    for( x=x0; x<x1; x++ ) {
+
+      rd.x = (float) (x - width / 2);
+      rd.y = (float) (y - height / 2);
+      rd.z = (float) width;   // pinhole camera with screen at depth width
+
+      lm_ray_init( &ray, ro, rd );
+
+      // shade by the angle between the ray and the triangle that was hit
+      if (lm_tlas_intersect( tlas, &ray, INFINITY, &hit, &inst )) {
+        float ndotd, nn;
+        const lm_inst *in = &tlas->inst[inst];
+        // the object space normal of the hit taken out to world space
+        lm_inst_normal( &n, in, in->blas->tri[hit.rec].n );
+        lm_vec3_dot( &ndotd, n, ray.d );
+        lm_vec3_dot( &nn, n, n );
+        scene->buffer[ y * width + x ] = ndotd / sqrt( nn );
+      } else {
+        scene->buffer[ y * width + x ] = 0.0f;
+      }
+    }
+  }
+}
+
+float *lm_rt_primary_rays( int width, int height, const lm_tlas *tlas, int order ) {
+
+  lm_rt_scene scene;
+
+  float *buffer = (float *) malloc(width * height * sizeof(float));
+
+  if (buffer == NULL) {
+    fprintf(stderr, "Could not create image buffer\n");
+    return NULL;
+  }
+
+  scene.tlas   = tlas;
+  scene.buffer = buffer;
+  scene.width  = width;
+  scene.height = height;
+
+  // tiles spread over all the cores, visited in the given LM_ORDER_*
+  lm_render_order( 0, 0, width, height, 16, order, lm_rt_tile, &scene, LM_RENDER_THREADS );
+
+  return buffer;
+}
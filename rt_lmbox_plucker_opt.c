@@ -1,11 +1,13 @@
 #include <stdio.h>
-#include "lm_vec3.h"
+#include "lm_rt.h"
 
 char lm_raybox( vec3 ro, vec3 rd, vec3 v0, vec3 v7, int debug ) {
   vec3 v1, v2, v3, v4, v5, v6;
   float r0, r1, r2, r3, r4, r5;
   int t01, t12, t23, t30, t45, t56, t67, t74, t14, t72, t36, t50;
   int a, b, c, d, e, f;
+  // six edge silhouette result, cross checked against the 12 edge faces
+  int s;
 
   // copy the appropriate x,y,z positions for V1...V6 from V0 and V7
   v1   = v0;
@@ -72,7 +74,9 @@ char lm_raybox( vec3 ro, vec3 rd, vec3 v0, vec3 v7, int debug ) {
     This is very good - even compared to the signed volume calculation method.
 
     There is no silhouette logic in the following code, so all 12 edges are
-    calculated.
+    calculated. lm_raybox_plucker_silhouette in lm_rt.h is the 6 edge version
+    and every ray fired below is checked against it - a '!' marks a ray where
+    the two disagree.
 
   Calculations
     Each box edge is reduced to a unit vector in a single x, y or z directon
@@ -127,6 +131,14 @@ char lm_raybox( vec3 ro, vec3 rd, vec3 v0, vec3 v7, int debug ) {
     printf( "a%d b%d c%d d%d e%d f%d\n", a, b, c, d, e, f );
   }
 
+  s = lm_raybox_plucker_silhouette( ro, rd, v0, v7 );
+
+  if( debug==1 ) {
+    printf( "silhouette: %d\n", s );
+  }
+
+  if( s != (a|b|c|d|e|f) ){ return '!'; };
+
   if( a==1 ){ return 'A'; };
   if( b==1 ){ return 'B'; };
   if( c==1 ){ return 'C'; };
@@ -2,13 +2,12 @@
 
 #include <stdio.h>
 #include <math.h>
+#include <string.h>
 #include <malloc.h>
 #include <png.h>
-#include "lm_rt.h"
-
-// This takes the float value 'val', converts it to red, green & blue values, then
-// sets those values into the image memory buffer location pointed to by 'ptr'
-void setRGB(png_byte *ptr, float val);
+#include "lm_tonemap.h"
+#include "lm_tile.h"
+#include "lm_render.h"
 
 // This function actually writes out the PNG image file. The string 'title' is
 // also written into the image file
@@ -16,18 +15,32 @@ int writeImage(char* filename, int width, int height, float *buffer, char * titl
 
 float *lm_rt_primary_rays( int width, int height );
 
+#ifndef MP
+float *lm_rt_coverage( int width, int height );
+#endif
+
 int main(int argc, char *argv[]) {
   // Make sure that the output filename argument has been provided
-  if (argc != 2) {
-    fprintf(stderr, "Please specify output file\n");
+  if (argc < 2 || argc > 3) {
+    fprintf(stderr, "Please specify output file [mask]\n");
     return 1;
   }
 
   int width = 640;
   int height = 480;
+  float *buffer;
 
   // Create image - a 1D array of floats, length: width * height
-  float *buffer = lm_rt_primary_rays( width, height );
+  if (argc == 3 && strcmp(argv[2], "mask") == 0) {
+#ifdef MP
+    fprintf(stderr, "No mask mode in the MP build\n");
+    return 1;
+#else
+    buffer = lm_rt_coverage( width, height );
+#endif
+  } else {
+    buffer = lm_rt_primary_rays( width, height );
+  }
   if (buffer == NULL) {
     return 1;
   }
@@ -40,29 +53,13 @@ int main(int argc, char *argv[]) {
   return result;
 }
 
-void setRGB(png_byte *ptr, float val) {
-  int v = (int)(val * 767);
-  if (v < 0) v = 0;
-  if (v > 767) v = 767;
-  int offset = v % 256;
-
-  if (v<256) {
-    ptr[0] = 0; ptr[1] = 0; ptr[2] = offset;
-  }
-  else if (v<512) {
-    ptr[0] = 0; ptr[1] = offset; ptr[2] = 255-offset;
-  }
-  else {
-    ptr[0] = offset; ptr[1] = 255-offset; ptr[2] = 0;
-  }
-}
-
 int writeImage(char* filename, int width, int height, float *buffer, char * title) {
   int code = 0;
   FILE *fp;
   png_structp png_ptr;
   png_infop info_ptr;
   png_bytep row;
+  lm_tonemap_lut lut;
 
   // Open file for writing (binary mode)
   fp = fopen(filename, "wb");
@@ -116,12 +113,11 @@ int writeImage(char* filename, int width, int height, float *buffer, char * titl
   // Allocate memory for one row (3 bytes per pixel - RGB)
   row = (png_bytep) malloc(3 * width * sizeof(png_byte));
 
-  // Write image data
-  int x, y;
+  // Write image data, coloured a row at a time
+  lm_tonemap_init(&lut);
+  int y;
   for (y=0 ; y<height ; y++) {
-    for (x=0 ; x<width ; x++) {
-      setRGB(&(row[x*3]), buffer[y*width + x]);
-    }
+    lm_tonemap_rgb888(&lut, row, &buffer[y*width], width);
     png_write_row(png_ptr, row);
   }
 
@@ -137,13 +133,82 @@ int writeImage(char* filename, int width, int height, float *buffer, char * titl
   return code;
 }
 
-float *lm_rt_primary_rays( int width, int height ) {
+typedef struct {
+  float *buffer;
+  int width;
+  vec3 ro, p0, p1;
+} lm_rt_scene;
+
+// one tile of the image - tiles write disjoint pixels so can run in parallel
+void lm_rt_tile( void *arg, int tx, int ty, int x1, int y1 ) {
+  lm_rt_scene *scene = (lm_rt_scene *) arg;
+  int x, y, t, cls;
+  vec3 rd;
+#ifndef MP
+  vec3 c0, c1, c2, c3;
+  lm_tile tile;
+#endif
 
-  int x, y, t;
-  vec3 ro, rd;
+#ifdef MP
+  cls = LM_TILE_MIXED;
+#else
+  // classify the box against the tile's four corner rays once
+  c0.x = tx;     c0.y = ty;     c0.z = 8.0f;
+  c1.x = x1 - 1; c1.y = ty;     c1.z = 8.0f;
+  c2.x = x1 - 1; c2.y = y1 - 1; c2.z = 8.0f;
+  c3.x = tx;     c3.y = y1 - 1; c3.z = 8.0f;
+  lm_tile_init( &tile, scene->ro, c0, c1, c2, c3 );
+  cls = lm_tile_box( &tile, scene->p0, scene->p1 );
+#endif
+
+  // a tile that misses stays background without any ray work
+  if (cls == LM_TILE_MISS) {
+    return;
+  }
+
+  for( y=ty; y<y1; y++ ) {
+    for( x=tx; x<x1; x++ ) {
+
+#ifdef MP
+       mpfr_init_set_d( rd.x, (float) x, MPFR_RNDN );
+       mpfr_init_set_d( rd.y, (float) y, MPFR_RNDN );
+       mpfr_init_set_d( rd.z, 8.0f, MPFR_RNDN );
+#else
+       rd.x = (float) x;
+       rd.y = (float) y;
+       rd.z = 8.0f;          // pinhole camera with screen at depth 8.0f
+#endif
+
+       lm_vec3_norm( &rd, rd );
+
+       // test rays against a single box defined by P0 and P1
+    //     t = lm_rt_lmrayboxint( scene->ro, rd, scene->p0, scene->p1, 0 );
+    //     t = lm_raybox_plucker( scene->ro, rd, scene->p0, scene->p1 );
+       t = (cls == LM_TILE_HIT) ? 1 : lm_raybox_plucker_optimised( scene->ro, rd, scene->p0, scene->p1 );
+
+#ifdef MP
+       scene->buffer[ y * scene->width + x ] = (t == 1) ?  mpfr_get_flt( rd.x, MPFR_RNDN )
+                                                         + mpfr_get_flt( rd.y, MPFR_RNDN )
+                                                         * mpfr_get_flt( rd.z, MPFR_RNDN ) : 0.0f;
+#else
+       scene->buffer[ y * scene->width + x ] = (t == 1) ?  rd.x + rd.y * rd.z : 0.0f;
+#endif
+    }
+  }
+
+#ifdef MP
+  mpfr_clear( rd.x );
+  mpfr_clear( rd.y );
+  mpfr_clear( rd.z );
+#endif
+}
+
+float *lm_rt_primary_rays( int width, int height ) {
 
   float p0x, p0y, p0z, p1x, p1y, p1z;
-  vec3 p0, p1;
+  float lo[3], hi[3];
+  lm_rect rect;
+  lm_rt_scene scene;
 
   float *buffer = (float *) malloc(width * height * sizeof(float));
 
@@ -152,6 +217,9 @@ float *lm_rt_primary_rays( int width, int height ) {
     return NULL;
   }
 
+  scene.buffer = buffer;
+  scene.width  = width;
+
   // Set up single box
   //
   p0x = (float) width / 4.0f;
@@ -163,74 +231,113 @@ float *lm_rt_primary_rays( int width, int height ) {
   p1z = p0z * 10.0f;
 
 #ifdef MP
-  mpfr_init_set_d( p0.x, p0x,  MPFR_RNDN );
-  mpfr_init_set_d( p0.y, p0y,  MPFR_RNDN );
-  mpfr_init_set_d( p0.z, p0z,  MPFR_RNDN );
-  mpfr_init_set_d( p1.x, p1x,  MPFR_RNDN );
-  mpfr_init_set_d( p1.y, p1y,  MPFR_RNDN );
-  mpfr_init_set_d( p1.z, p1z,  MPFR_RNDN );
-
-  mpfr_init_set_d( ro.x, 0.0f, MPFR_RNDN );
-  mpfr_init_set_d( ro.y, 0.0f, MPFR_RNDN );
-  mpfr_init_set_d( ro.z, 0.0f, MPFR_RNDN );
+  mpfr_init_set_d( scene.p0.x, p0x,  MPFR_RNDN );
+  mpfr_init_set_d( scene.p0.y, p0y,  MPFR_RNDN );
+  mpfr_init_set_d( scene.p0.z, p0z,  MPFR_RNDN );
+  mpfr_init_set_d( scene.p1.x, p1x,  MPFR_RNDN );
+  mpfr_init_set_d( scene.p1.y, p1y,  MPFR_RNDN );
+  mpfr_init_set_d( scene.p1.z, p1z,  MPFR_RNDN );
+
+  mpfr_init_set_d( scene.ro.x, 0.0f, MPFR_RNDN );
+  mpfr_init_set_d( scene.ro.y, 0.0f, MPFR_RNDN );
+  mpfr_init_set_d( scene.ro.z, 0.0f, MPFR_RNDN );
 #else
-  p0.x = p0x;
-  p0.y = p0y;
-  p0.z = p0z;
-  p1.x = p1x;
-  p1.y = p1y;
-  p1.z = p1z;
+  scene.p0.x = p0x;
+  scene.p0.y = p0y;
+  scene.p0.z = p0z;
+  scene.p1.x = p1x;
+  scene.p1.y = p1y;
+  scene.p1.z = p1z;
 
   // All rays originate from 0,0,0 creating a frustum with one aligned axis
   //
-  ro.x = 0.0f;
-  ro.y = 0.0f;
-  ro.z = 0.0f;
+  scene.ro.x = 0.0f;
+  scene.ro.y = 0.0f;
+  scene.ro.z = 0.0f;
 #endif
 
-  for( y=0; y<height; y++ ) {
-    for( x=0; x<width; x++ ) {
-
+  // only the pixels inside the box's screen rectangle get rays, the rest of
+  // the image is background
+  //
+  lo[0] = p0x;
+  lo[1] = p0y;
+  lo[2] = p0z;
+  hi[0] = p1x;
+  hi[1] = p1y;
+  hi[2] = p1z;
+  lm_rect_box( &rect, lo, hi, 8.0f, width, height );
+  memset( buffer, 0, width * height * sizeof(float) );
+
+  // tiles of the rectangle spread over all the cores - mpfr runs on one
 #ifdef MP
-       mpfr_init_set_d( rd.x, (float) x, MPFR_RNDN );
-       mpfr_init_set_d( rd.y, (float) y, MPFR_RNDN );
-       mpfr_init_set_d( rd.z, 8.0f, MPFR_RNDN );
+  lm_render( rect.x0, rect.y0, rect.x1, rect.y1, LM_TILE, lm_rt_tile, &scene, 1 );
 #else
-       rd.x = (float) x;
-       rd.y = (float) y;
-       rd.z = 8.0f;          // pinhole camera with screen at depth 8.0f
+  lm_render( rect.x0, rect.y0, rect.x1, rect.y1, LM_TILE, lm_rt_tile, &scene, LM_RENDER_THREADS );
 #endif
 
-       lm_vec3_norm( &rd, rd );
-
-       // test rays against a single box defined by P0 and P1
-//     t = lm_rt_lmrayboxint( ro, rd, p0, p1, 0 );
-//     t = lm_raybox_plucker( ro, rd, p0, p1 );
-       t = lm_raybox_plucker_optimised( ro, rd, p0, p1 );
-
 #ifdef MP
-       buffer[ y * width + x ] = (t == 1) ?  mpfr_get_flt( rd.x, MPFR_RNDN )
-                                           + mpfr_get_flt( rd.y, MPFR_RNDN )
-                                           * mpfr_get_flt( rd.z, MPFR_RNDN ) : 0.0f;
-#else
-       buffer[ y * width + x ] = (t == 1) ?  rd.x + rd.y * rd.z : 0.0f;
+  mpfr_clear( scene.p0.x );
+  mpfr_clear( scene.p0.y );
+  mpfr_clear( scene.p0.z );
+  mpfr_clear( scene.p1.x );
+  mpfr_clear( scene.p1.y );
+  mpfr_clear( scene.p1.z );
+  mpfr_clear( scene.ro.x );
+  mpfr_clear( scene.ro.y );
+  mpfr_clear( scene.ro.z );
 #endif
-    }
+  return buffer;
+}
+
+#ifndef MP
+// hit/miss of one pixel's ray against the box b[0], b[1]
+int lm_box_cover( void *arg, vec3 ro, vec3 rd ) {
+  const vec3 *b = (const vec3 *) arg;
+
+  lm_vec3_norm( &rd, rd );
+  return lm_raybox_plucker_optimised( ro, rd, b[0], b[1] );
+}
+
+int lm_box_tile( void *arg, const lm_tile *f ) {
+  const vec3 *b = (const vec3 *) arg;
+
+  return lm_tile_box( f, b[0], b[1] );
+}
+
+// The same box as lm_rt_primary_rays as a coverage mask - 1.0 hit, 0.0 miss -
+// rendered by quadtree subdivision
+float *lm_rt_coverage( int width, int height ) {
+
+  vec3 ro, box[2];
+  long rays;
+
+  float *buffer = (float *) malloc(width * height * sizeof(float));
+
+  if (buffer == NULL) {
+    fprintf(stderr, "Could not create image buffer\n");
+    return NULL;
   }
 
-#ifdef MP
-  mpfr_clear( p0.x );
-  mpfr_clear( p0.y );
-  mpfr_clear( p0.z );
-  mpfr_clear( p1.x );
-  mpfr_clear( p1.y );
-  mpfr_clear( p1.z );
-  mpfr_clear( ro.x );
-  mpfr_clear( ro.y );
-  mpfr_clear( ro.z );
-  mpfr_clear( rd.x );
-  mpfr_clear( rd.y );
-  mpfr_clear( rd.z );
-#endif
+  box[0].x = (float) width / 4.0f;
+  box[0].y = (float) width / 4.0f;
+  box[0].z = (float) width / 10.0f;
+
+  box[1].x = box[0].x * 20.0f;
+  box[1].y = box[0].y * 20.0f;
+  box[1].z = box[0].z * 10.0f;
+
+  ro.x = 0.0f;
+  ro.y = 0.0f;
+  ro.z = 0.0f;
+
+  rays = lm_quad_cover( buffer, width, height, ro, 8.0f, lm_box_cover, lm_box_tile, box );
+  if (rays < 0) {
+    fprintf(stderr, "Could not create quadtree state\n");
+    free( buffer );
+    return NULL;
+  }
+  printf("%ld rays for %d pixels\n", rays, width * height);
+
   return buffer;
 }
+#endif
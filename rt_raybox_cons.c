@@ -1,46 +1,69 @@
+// Console box - one box drawn in characters, the rows shaded in tiles on
+// every core through lm_render then printed in order.
+//
+//   gcc -O2 rt_raybox_cons.c -o rt_raybox_cons -lm -pthread
+//
 #include <stdio.h>
 #include "lm_rt.h"
+#include "lm_tonemap.h"
+#include "lm_render.h"
 
-int main(){
+typedef struct {
+  vec3 ro, p0, p1;
+  float shade[60][160];
+} lm_rt_scene;
 
+// one tile of the character grid
+void lm_rt_tile( void *arg, int x0, int y0, int x1, int y1 ) {
+  lm_rt_scene *scene = (lm_rt_scene *) arg;
   int x, y, t;
-  vec3 ro, rd;
+  vec3 rd;
+
+  for( y=y0; y<y1; y++ ) {
+    for( x=x0; x<x1; x++ ) {
+
+       rd.x = (float) x;
+       rd.y = (float) y;
+       rd.z = 8.0f;          // pinhole camera with screen at depth 8.0f
+
+       // test rays against box
+       t  = lm_rt_rayboxint( scene->ro, rd, scene->p0, scene->p1 );
+
+       scene->shade[y][x] = (t == 0) ? 0.0f : 1.0f;    // . miss, # hit
+    }
+  }
+}
+
+int main(){
 
-  vec3 p0, p1;
+  int y;
+  char line[160];
+  lm_tonemap_lut lut;
+  lm_rt_scene scene;
 
   // Set up single triangle
   //
-  p0.x.f = 40.0f;
-  p0.y.f = 40.0f;
-  p0.z.f = 16.0f;
+  scene.p0.x = 40.0f;
+  scene.p0.y = 40.0f;
+  scene.p0.z = 16.0f;
 
-  p1.x.f = p0.x.f + 40.0f;
-  p1.y.f = p0.y.f + 50.0f;
-  p1.z.f = p0.z.f + 60.0f;
+  scene.p1.x = scene.p0.x + 40.0f;
+  scene.p1.y = scene.p0.y + 50.0f;
+  scene.p1.z = scene.p0.z + 60.0f;
 
   // All rays originate from 0,0,0 creating a frustum with one aligned axis
   //
-  ro.x.f = 0.0f;
-  ro.y.f = 0.0f;
-  ro.z.f = 0.0f;
-
-  for( y=0; y<60; y++ ) {
-    for( x=0; x<160; x++ ) {
+  scene.ro.x = 0.0f;
+  scene.ro.y = 0.0f;
+  scene.ro.z = 0.0f;
 
-       rd.x.f = (float) x;
-       rd.y.f = (float) y;
-       rd.z.f = 8.0f;          // pinhole camera with screen at depth 8.0f
+  lm_tonemap_init( &lut );
 
-       // test rays against box
-       t  = lm_rt_rayboxint( ro, rd, p0, p1 );
+  lm_render( 0, 0, 160, 60, 16, lm_rt_tile, &scene, LM_RENDER_THREADS );
 
-       if( t == 0 ) {
-         printf( "." );
-       } else {
-         printf( "#" );
-       }
-    }
-    printf( "\n" );
+  for( y=0; y<60; y++ ) {
+    lm_tonemap_ascii( &lut, line, scene.shade[y], 160 );
+    printf( "%.160s\n", line );
   }
 
   return 0;
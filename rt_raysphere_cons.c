@@ -1,46 +1,68 @@
+// Console sphere - one sphere drawn in characters, the rows shaded in tiles
+// on every core through lm_render then printed in order.
+//
+//   gcc -O2 rt_raysphere_cons.c -o rt_raysphere_cons -lm -pthread
+//
 #include <stdio.h>
 #include "lm_rt.h"
+#include "lm_tonemap.h"
+#include "lm_render.h"
 
-int main(){
+typedef struct {
+  vec3 ro, p0;
+  float rad;
+  float shade[60][160];
+} lm_rt_scene;
 
+// one tile of the character grid
+void lm_rt_tile( void *arg, int x0, int y0, int x1, int y1 ) {
+  lm_rt_scene *scene = (lm_rt_scene *) arg;
   int x, y, hit;
-  vec3 ro, rd;
+  vec3 rd, n;
 
-  vec3 p0;
-  vec3 n;
-  float rad;
+  for( y=y0; y<y1; y++ ) {
+    for( x=x0; x<x1; x++ ) {
+
+       rd.x = (float) x;
+       rd.y = (float) y;
+       rd.z = 8.0f;          // pinhole camera with screen at depth 8.0f
+
+       // test rays against sphere
+       hit = lm_rt_raysphereint( scene->ro, rd, scene->p0, scene->rad, &n );
+
+       scene->shade[y][x] = (hit == 0) ? 0.0f : 1.0f;    // . miss, # hit
+    }
+  }
+}
+
+int main(){
+
+  int y;
+  char line[160];
+  lm_tonemap_lut lut;
+  lm_rt_scene scene;
 
   // Set up single sphere
   //
-  p0.x.f = 40.0f;
-  p0.y.f = 40.0f;
-  p0.z.f = 20.0f;
+  scene.p0.x = 40.0f;
+  scene.p0.y = 40.0f;
+  scene.p0.z = 20.0f;
 
-  rad = 14.0f;
+  scene.rad = 14.0f;
 
   // All rays originate from 0,0,0 creating a frustum with one aligned axis
   //
-  ro.x.f = 0.0f;
-  ro.y.f = 0.0f;
-  ro.z.f = 0.0f;
+  scene.ro.x = 0.0f;
+  scene.ro.y = 0.0f;
+  scene.ro.z = 0.0f;
 
-  for( y=0; y<60; y++ ) {
-    for( x=0; x<160; x++ ) {
+  lm_tonemap_init( &lut );
 
-       rd.x.f = (float) x;
-       rd.y.f = (float) y;
-       rd.z.f = 8.0f;          // pinhole camera with screen at depth 8.0f
+  lm_render( 0, 0, 160, 60, 16, lm_rt_tile, &scene, LM_RENDER_THREADS );
 
-       // test rays against sphere
-       hit = lm_rt_raysphereint( ro, rd, p0, rad, &n );
-
-       if( hit == 0 ) {
-         printf( "." );
-       } else {
-         printf( "#" );
-       }
-    }
-    printf( "\n" );
+  for( y=0; y<60; y++ ) {
+    lm_tonemap_ascii( &lut, line, scene.shade[y], 160 );
+    printf( "%.160s\n", line );
   }
 
   return 0;
@@ -1,112 +1,129 @@
-#include <unistd.h>
+// Frame buffer sphere - renders a sphere circling the middle of the screen
+// frame after frame into the lm_fb back buffer and presents each one, then
+// prints the frame times. A device that is a plain file is a fake frame
+// buffer of width x height at bpp bits, for timing on a box with no screen.
+//
+//   gcc -O2 rt_raysphere_fb.c -o rt_raysphere_fb -lm -pthread
+//   ./rt_raysphere_fb [device [frames [width height [bpp]]]]
+//
+//   ./rt_raysphere_fb                           /dev/fb0 until Ctrl-C
+//   ./rt_raysphere_fb /tmp/fb 500 1920 1080     500 frames to a fake 1080p
+//
 #include <stdio.h>
 #include <stdlib.h>
-#include <fcntl.h>
-#include <linux/fb.h>
-#include <sys/mman.h>
-
-#include "lm_rt.h"
-
-int main() {
-  // linux frame buffer variables
-  int fbfd = 0;
-  struct fb_var_screeninfo vinfo;
-  struct fb_fix_screeninfo finfo;
-  long int screensize = 0;
-  char *fbp = 0;
-  int x = 0, y = 0;
-  long int location = 0;
-
-  int v, offset, r, g, b;
-  unsigned short int colour;
-
-  // the ray tracer variables
-  int hit;
-  vec3 ro, rd;
-  vec3 p0, n;
-  float rad, beta, gamma;
-
-  // Open the file for reading and writing
-  fbfd = open("/dev/fb0", O_RDWR);
-  if (!fbfd) {
-    printf("Error: cannot open framebuffer device.\n");
-    exit(1);
-  }
-
-  // Get fixed screen information
-  if (ioctl(fbfd, FBIOGET_FSCREENINFO, &finfo)) {
-    printf("Error reading fixed information - permissions on /dev/fb0?\n");
-    exit(2);
-  }
-
-  // Get variable screen information
-  if (ioctl(fbfd, FBIOGET_VSCREENINFO, &vinfo)) {
-    printf("Error reading variable information.\n");
-    exit(3);
-  }
-
-  // Figure out the size of the screen in bytes
-  screensize = vinfo.xres * vinfo.yres * vinfo.bits_per_pixel / 8;
+#include <signal.h>
 
-  // Map the device to memory
-  fbp = (char *)mmap(0, screensize, PROT_READ | PROT_WRITE, MAP_SHARED,
-             fbfd, 0);
-  if ((int)fbp == -1) {
-    printf("Error: failed to map framebuffer device to memory.\n");
-    exit(4);
-  }
-
-  p0.x.f = (float) vinfo.xres / 2.0f;
-  p0.y.f = (float) vinfo.yres / 2.0f;
-  p0.z.f = 600.0f;
-
-  rad = 400.0f;
+#include "lm_fb.h"
+#include "lm_tile.h"
+#include "lm_render.h"
 
-  // All rays originate from 0,0,0 creating a frustum with one aligned axis
-  //
-  ro.x.f = (float) vinfo.xres / 2.0f;
-  ro.y.f = (float) vinfo.yres / 2.0f;
-  ro.z.f = 0.0f;
+typedef struct {
+  lm_fb *fb;
+  const lm_tonemap_lut *lut;
+  vec3 ro, p0;
+  float rad;
+  lm_spheres spheres;
+} lm_rt_scene;
 
-  // Figure out where in memory to put the pixel
-  for ( y = 0; y < vinfo.yres; y++ )
-    for ( x = 0; x < vinfo.xres; x++ ) {
+volatile sig_atomic_t lm_rt_stop = 0;
 
-      location = (x+vinfo.xoffset) * (vinfo.bits_per_pixel/8) +
-             (y+vinfo.yoffset) * finfo.line_length;
+void lm_rt_interrupt( int sig ) {
+  (void) sig;
+  lm_rt_stop = 1;
+}
 
-      rd.x.f = (float) x;
-      rd.y.f = (float) y;
-      rd.z.f = 8.0f;          // pinhole camera with screen at depth 8.0f
+// the ray through pixel x, y - camera in the middle of the screen looking
+// down z, focal length one screen width
+vec3 lm_rt_dir( const lm_fb *fb, int x, int y ) {
+  vec3 rd;
 
+  rd.x = (float) (x - fb->width / 2);
+  rd.y = (float) (y - fb->height / 2);
+  rd.z = (float) fb->width;
+  return rd;
+}
 
-      rd = lm_vec3_norm( rd );
+// one tile straight into the back buffer, a row of shades at a time
+void lm_rt_tile( void *arg, int tx, int ty, int x1, int y1 ) {
+  lm_rt_scene *scene = (lm_rt_scene *) arg;
+  float shade[LM_TILE];
+  int x, y, miss;
+  vec3 rd, n;
+  lm_tile tile;
+  lm_ray ray;
+
+  // a tile all four corner rays say misses the sphere is background
+  lm_tile_init( &tile, scene->ro, lm_rt_dir( scene->fb, tx, ty ), lm_rt_dir( scene->fb, x1 - 1, ty ),
+                lm_rt_dir( scene->fb, x1 - 1, y1 - 1 ), lm_rt_dir( scene->fb, tx, y1 - 1 ) );
+  miss = (lm_tile_sphere( &tile, scene->p0, scene->rad ) == LM_TILE_MISS);
+
+  for( y=ty; y<y1; y++ ) {
+    for( x=tx; x<x1; x++ ) {
+      shade[x - tx] = 0.0f;
+      if (!miss) {
+        rd = lm_rt_dir( scene->fb, x, y );
+        lm_vec3_norm( &rd, rd );
+        lm_ray_init( &ray, scene->ro, rd );
+
+        // brightest where the surface faces the camera
+        if (lm_ray_spheres( &ray, &scene->spheres, INFINITY, NULL, &n ) >= 0) {
+          shade[x - tx] = -n.z;
+        }
+      }
+    }
+    lm_fb_put( scene->fb, scene->lut, tx, y, shade, x1 - tx );
+  }
+}
 
-      // test rays against two objects P and Q :)
-      hit = lm_rt_raysphereint( ro, rd, p0, rad, &n );
+int main(int argc, char *argv[]) {
+  const char *device = (argc > 1) ? argv[1] : "/dev/fb0";
+  long frames = (argc > 2) ? atol(argv[2]) : 0;        // 0 until interrupted
+  int width   = (argc > 4) ? atoi(argv[3]) : 640;      // fake device only
+  int height  = (argc > 4) ? atoi(argv[4]) : 480;
+  int bpp     = (argc > 5) ? atoi(argv[5]) : 32;
+  long frame;
+  float a;
+  lm_fb fb;
+  lm_tonemap_lut lut;
+  lm_rt_scene scene;
+
+  if (lm_fb_open(&fb, device, width, height, bpp)) {
+    return 1;
+  }
 
-      v = (hit == 1) ? (int) 95.0f * sqrt( n.x.f*n.z.f + n.y.f*n.z.f ) : 0;
+  if (!lm_spheres_alloc(&scene.spheres, 1)) {
+    fprintf(stderr, "Could not create sphere list\n");
+    lm_fb_close(&fb);
+    return 1;
+  }
 
-      if( v<0 ) v = 0;
-      if( v>95 ) v = 95;
-      offset = v % 32;
-    
-      if( v<32 ) {
-        r = 0; g = 0; b = offset;
-      }
-      else if( v<64 ) {
-        r = 0; g = offset; b = 31-offset;
-      }
-      else {
-        r = offset; g = 31-offset; b = 0;
-      }
+  lm_tonemap_init(&lut);
+  scene.fb  = &fb;
+  scene.lut = &lut;
+  scene.rad = (float) fb.width / 4.0f;
 
-      colour = r<<11 | g << 5 | b;
-      *((unsigned short int*)(fbp + location)) = colour;
+  // All rays originate from 0,0,0
+  //
+  scene.ro.x = 0.0f;
+  scene.ro.y = 0.0f;
+  scene.ro.z = 0.0f;
+
+  signal(SIGINT, lm_rt_interrupt);
+
+  for (frame = 0; (frames == 0 || frame < frames) && !lm_rt_stop; frame++) {
+    // once round every 120 frames
+    a = (float) frame * 2.0f * (float) M_PI / 120.0f;
+    scene.p0.x = (float) fb.width / 4.0f * cosf(a);
+    scene.p0.y = (float) fb.height / 4.0f * sinf(a);
+    scene.p0.z = (float) fb.width * 2.0f;
+    lm_spheres_set(&scene.spheres, 0, scene.p0, scene.rad);
+
+    lm_render(0, 0, fb.width, fb.height, LM_TILE, lm_rt_tile, &scene, LM_RENDER_THREADS);
+    lm_fb_present(&fb);
+  }
 
-    }
-  munmap(fbp, screensize);
-  close(fbfd);
-  printf("%d x %d\n", vinfo.xres, vinfo.yres);
+  lm_fb_report(&fb);
+  lm_spheres_free(&scene.spheres);
+  lm_fb_close(&fb);
   return 0;
 }
@@ -2,13 +2,12 @@
 
 #include <stdio.h>
 #include <math.h>
+#include <string.h>
 #include <malloc.h>
 #include <png.h>
-#include "lm_rt.h"
-
-// This takes the float value 'val', converts it to red, green & blue values, then
-// sets those values into the image memory buffer location pointed to by 'ptr'
-inline void setRGB(png_byte *ptr, float val);
+#include "lm_tonemap.h"
+#include "lm_tile.h"
+#include "lm_render.h"
 
 // This function actually writes out the PNG image file. The string 'title' is
 // also written into the image file
@@ -40,29 +39,13 @@ int main(int argc, char *argv[]) {
   return result;
 }
 
-inline void setRGB(png_byte *ptr, float val) {
-  int v = (int)(val * 767);
-  if (v < 0) v = 0;
-  if (v > 767) v = 767;
-  int offset = v % 256;
-
-  if (v<256) {
-    ptr[0] = 0; ptr[1] = 0; ptr[2] = offset;
-  }
-  else if (v<512) {
-    ptr[0] = 0; ptr[1] = offset; ptr[2] = 255-offset;
-  }
-  else {
-    ptr[0] = offset; ptr[1] = 255-offset; ptr[2] = 0;
-  }
-}
-
 int writeImage(char* filename, int width, int height, float *buffer, char* title) {
   int code = 0;
   FILE *fp;
   png_structp png_ptr;
   png_infop info_ptr;
   png_bytep row;
+  lm_tonemap_lut lut;
 
   // Open file for writing (binary mode)
   fp = fopen(filename, "wb");
@@ -116,12 +99,11 @@ int writeImage(char* filename, int width, int height, float *buffer, char* title
   // Allocate memory for one row (3 bytes per pixel - RGB)
   row = (png_bytep) malloc(3 * width * sizeof(png_byte));
 
-  // Write image data
-  int x, y;
+  // Write image data, coloured a row at a time
+  lm_tonemap_init(&lut);
+  int y;
   for (y=0 ; y<height ; y++) {
-    for (x=0 ; x<width ; x++) {
-      setRGB(&(row[x*3]), buffer[y*width + x]);
-    }
+    lm_tonemap_rgb888(&lut, row, &buffer[y*width], width);
     png_write_row(png_ptr, row);
   }
 
@@ -137,56 +119,62 @@ int writeImage(char* filename, int width, int height, float *buffer, char* title
   return code;
 }
 
-float *lm_rt_primary_rays( int width, int height ) {
-
-  int x, y, hit;
-  vec3 ro, rd;
-
-  float p0x, p0y, p0z, nx, ny, nz;
-  vec3 p0, n;
+typedef struct {
+  float *buffer;
+  int width;
+  vec3 ro, p0;
   float rad;
-
-  float *buffer = (float *) malloc(width * height * sizeof(float));
-
-  if (buffer == NULL) {
-    fprintf(stderr, "Could not create image buffer\n");
-    return NULL;
-  }
-
-  // Set up single sphere
-  //
-  p0x = (float) width / 4.0f;
-  p0y = (float) height / 4.0f;
-  p0z = (float) width / 8.0f;
-
-  rad = 0.965 * p0z;
+#ifndef MP
+  lm_spheres spheres;
+#endif
+} lm_rt_scene;
+
+// one tile of the image - tiles write disjoint pixels so can run in parallel
+void lm_rt_tile( void *arg, int tx, int ty, int x1, int y1 ) {
+  lm_rt_scene *scene = (lm_rt_scene *) arg;
+  int x, y, hit, cls;
+  vec3 rd, n;
+  float nx, ny, nz;
+#ifndef MP
+  int i;
+  vec3 c0, c1, c2, c3;
+  lm_tile tile;
+  lm_ray ray;
+  const lm_spheres *spheres = &scene->spheres;
+#endif
 
 #ifdef MP
-  mpfr_init_set_d( p0.x, p0x, MPFR_RNDN );
-  mpfr_init_set_d( p0.y, p0y, MPFR_RNDN );
-  mpfr_init_set_d( p0.z, p0z, MPFR_RNDN );
-
-  mpfr_init_set_d( ro.x, 0.0f, MPFR_RNDN );
-  mpfr_init_set_d( ro.y, 0.0f, MPFR_RNDN );
-  mpfr_init_set_d( ro.z, 0.0f, MPFR_RNDN );
-
   mpfr_init( n.x );
   mpfr_init( n.y );
   mpfr_init( n.z );
+  cls = LM_TILE_MIXED;
 #else
-  p0.x = p0x;
-  p0.y = p0y;
-  p0.z = p0z;
-
-  // All rays originate from 0,0,0 creating a frustum with one aligned axis
-  //
-  ro.x = 0.0f;
-  ro.y = 0.0f;
-  ro.z = 0.0f;
+  // classify the spheres against the tile's four corner rays once - the
+  // tile can only be skipped when every one misses it, and the pixels of a
+  // tile that is hit still need their normals so anything else is tested
+  c0.x = tx;     c0.y = ty;     c0.z = 8.0f;
+  c1.x = x1 - 1; c1.y = ty;     c1.z = 8.0f;
+  c2.x = x1 - 1; c2.y = y1 - 1; c2.z = 8.0f;
+  c3.x = tx;     c3.y = y1 - 1; c3.z = 8.0f;
+  lm_tile_init( &tile, scene->ro, c0, c1, c2, c3 );
+  cls = LM_TILE_MISS;
+  for( i=0; i<spheres->n && cls == LM_TILE_MISS; i++ ) {
+    c0.x = spheres->x[i];
+    c0.y = spheres->y[i];
+    c0.z = spheres->z[i];
+    if (lm_tile_sphere( &tile, c0, spheres->rad[i] ) != LM_TILE_MISS) {
+      cls = LM_TILE_MIXED;
+    }
+  }
 #endif
 
-  for( y=0; y<height; y++ ) {
-    for( x=0; x<width; x++ ) {
+  // a tile that misses stays background without any ray work
+  if (cls == LM_TILE_MISS) {
+    return;
+  }
+
+  for( y=ty; y<y1; y++ ) {
+    for( x=tx; x<x1; x++ ) {
 
 #ifdef MP
       mpfr_init_set_d( rd.x, (float) x, MPFR_RNDN );
@@ -200,8 +188,13 @@ float *lm_rt_primary_rays( int width, int height ) {
 
       lm_vec3_norm( &rd, rd );
 
-      // test rays against two objects P and Q :)
-      hit = lm_rt_raysphereint( ro, rd, p0, rad, &n );
+#ifdef MP
+      hit = lm_rt_raysphereint( scene->ro, rd, scene->p0, scene->rad, &n );
+#else
+      // closest of all the spheres in the list
+      lm_ray_init( &ray, scene->ro, rd );
+      hit = (lm_ray_spheres( &ray, spheres, INFINITY, NULL, &n ) >= 0) ? 1 : 0;
+#endif
 
 #ifdef MP
       nx = mpfr_get_flt( n.x, MPFR_RNDN );
@@ -213,18 +206,11 @@ float *lm_rt_primary_rays( int width, int height ) {
       nz = n.z;
 #endif
 
-      buffer[ y * width + x ] = (hit == 1) ? sqrt(nx*nz + ny*nz) : 0.0f;
+      scene->buffer[ y * scene->width + x ] = (hit == 1) ? sqrt(nx*nz + ny*nz) : 0.0f;
     }
   }
-  return buffer;
 
 #ifdef MP
-  mpfr_clear( p0.x );
-  mpfr_clear( p0.y );
-  mpfr_clear( p0.z );
-  mpfr_clear( ro.x );
-  mpfr_clear( ro.y );
-  mpfr_clear( ro.z );
   mpfr_clear( rd.x );
   mpfr_clear( rd.y );
   mpfr_clear( rd.z );
@@ -233,3 +219,100 @@ float *lm_rt_primary_rays( int width, int height ) {
   mpfr_clear( n.z );
 #endif
 }
+
+float *lm_rt_primary_rays( int width, int height ) {
+
+  float p0x, p0y, p0z;
+  float c[3];
+  lm_rect rect;
+  lm_rt_scene scene;
+#ifndef MP
+  int i;
+  lm_rect r1;
+#endif
+
+  float *buffer = (float *) malloc(width * height * sizeof(float));
+
+  if (buffer == NULL) {
+    fprintf(stderr, "Could not create image buffer\n");
+    return NULL;
+  }
+
+  scene.buffer = buffer;
+  scene.width  = width;
+
+  // Set up single sphere
+  //
+  p0x = (float) width / 4.0f;
+  p0y = (float) height / 4.0f;
+  p0z = (float) width / 8.0f;
+
+  scene.rad = 0.965 * p0z;
+
+#ifdef MP
+  mpfr_init_set_d( scene.p0.x, p0x, MPFR_RNDN );
+  mpfr_init_set_d( scene.p0.y, p0y, MPFR_RNDN );
+  mpfr_init_set_d( scene.p0.z, p0z, MPFR_RNDN );
+
+  mpfr_init_set_d( scene.ro.x, 0.0f, MPFR_RNDN );
+  mpfr_init_set_d( scene.ro.y, 0.0f, MPFR_RNDN );
+  mpfr_init_set_d( scene.ro.z, 0.0f, MPFR_RNDN );
+#else
+  scene.p0.x = p0x;
+  scene.p0.y = p0y;
+  scene.p0.z = p0z;
+
+  // The scene is a structure-of-arrays sphere list - just the one for now
+  //
+  if( !lm_spheres_alloc( &scene.spheres, 1 ) ) {
+    fprintf(stderr, "Could not create sphere list\n");
+    free( buffer );
+    return NULL;
+  }
+  lm_spheres_set( &scene.spheres, 0, scene.p0, scene.rad );
+
+  // All rays originate from 0,0,0 creating a frustum with one aligned axis
+  //
+  scene.ro.x = 0.0f;
+  scene.ro.y = 0.0f;
+  scene.ro.z = 0.0f;
+#endif
+
+  // only the pixels inside the spheres' screen rectangles get rays, the
+  // rest of the image is background
+  //
+#ifdef MP
+  c[0] = p0x;
+  c[1] = p0y;
+  c[2] = p0z;
+  lm_rect_sphere( &rect, c, scene.rad, 8.0f, width, height );
+#else
+  rect.x0 = rect.y0 = rect.x1 = rect.y1 = 0;
+  for( i=0; i<scene.spheres.n; i++ ) {
+    c[0] = scene.spheres.x[i];
+    c[1] = scene.spheres.y[i];
+    c[2] = scene.spheres.z[i];
+    lm_rect_sphere( &r1, c, scene.spheres.rad[i], 8.0f, width, height );
+    lm_rect_union( &rect, &r1 );
+  }
+#endif
+  memset( buffer, 0, width * height * sizeof(float) );
+
+  // tiles of the rectangle spread over all the cores - mpfr runs on one
+#ifdef MP
+  lm_render( rect.x0, rect.y0, rect.x1, rect.y1, LM_TILE, lm_rt_tile, &scene, 1 );
+#else
+  lm_render( rect.x0, rect.y0, rect.x1, rect.y1, LM_TILE, lm_rt_tile, &scene, LM_RENDER_THREADS );
+  lm_spheres_free( &scene.spheres );
+#endif
+  return buffer;
+
+#ifdef MP
+  mpfr_clear( scene.p0.x );
+  mpfr_clear( scene.p0.y );
+  mpfr_clear( scene.p0.z );
+  mpfr_clear( scene.ro.x );
+  mpfr_clear( scene.ro.y );
+  mpfr_clear( scene.ro.z );
+#endif
+}
@@ -1,71 +1,85 @@
+// Console triangle - one triangle drawn in characters, the rows shaded in
+// tiles on every core through lm_render then printed in order, followed by
+// the barycentrics and distance of the last hit in scanline order.
+//
+//   gcc -O2 rt_raytri_cons.c -o rt_raytri_cons -lm -pthread
+//
 #include <stdio.h>
 #include "lm_rt.h"
+#include "lm_tonemap.h"
+#include "lm_render.h"
+
+typedef struct {
+  vec3 ro, p0, p1, p2;
+  float shade[60][160];
+  float beta[60][160], gamma[60][160], t[60][160];   // each pixel's hit
+} lm_rt_scene;
+
+// one tile of the character grid
+void lm_rt_tile( void *arg, int x0, int y0, int x1, int y1 ) {
+  lm_rt_scene *scene = (lm_rt_scene *) arg;
+  int x, y, hit;
+  vec3 rd;
 
-int main(){
+  for( y=y0; y<y1; y++ ) {
+    for( x=x0; x<x1; x++ ) {
 
-  int x, y, hit;
-  vec3 ro, rd;
+       rd.x = (float) x;
+       rd.y = (float) y;
+       rd.z = 8.0f;          // pinhole camera with screen at depth 8.0f
 
-  vec3 p0, p1, p2;
-  vec3 q0, q1, q2;
+       // test rays against triangle
+       hit = lm_rt_raytriint( scene->ro, rd, scene->p0, scene->p1, scene->p2,
+                              &scene->beta[y][x], &scene->gamma[y][x], &scene->t[y][x]);
 
-  float temp_t, temp_beta, temp_gamma;
-  float t, beta, gamma;
+       scene->shade[y][x] = (hit == 0) ? 0.0f : 1.0f;    // . miss, # hit
+    }
+  }
+}
 
-  // Set up single triangle
-  //
-  p0.x.f = 40.0f;
-  p0.y.f = 40.0f;
-  p0.z.f = 16.0f;
+int main(){
 
-  p1.x.f = 318.0f;
-  p1.y.f = 0.0f;
-  p1.z.f = 16.0f;
+  int x, y;
+  char line[160];
+  lm_tonemap_lut lut;
+  lm_rt_scene scene;
 
-  p2.x.f = 0.0f;
-  p2.y.f = 118.0f;
-  p2.z.f = 16.0f;
+  float t = 0.0f, beta = 0.0f, gamma = 0.0f;   // last hit, printed at the end
 
-  // OK - and another...
-  q0.x.f = 80.0f + 40.0f;
-  q0.y.f = 30.0f + 40.0f;
-  q0.z.f = 4.0f * 16.0f;
+  // Set up single triangle
+  //
+  scene.p0.x = 40.0f;
+  scene.p0.y = 40.0f;
+  scene.p0.z = 16.0f;
 
-  q1.x.f = 80.0f + 320.0f;
-  q1.y.f = 30.0f + 0.0f;
-  q1.z.f = 4.0f * 16.0f;
+  scene.p1.x = 318.0f;
+  scene.p1.y = 0.0f;
+  scene.p1.z = 16.0f;
 
-  q2.x.f = 80.0f + 0.0f;
-  q2.y.f = 30.0f + 120.0f;
-  q2.z.f = 4.0f * 16.0f;
+  scene.p2.x = 0.0f;
+  scene.p2.y = 118.0f;
+  scene.p2.z = 16.0f;
 
   // All rays originate from 0,0,0 creating a frustum with one aligned axis
   //
-  ro.x.f = 0.0f;
-  ro.y.f = 0.0f;
-  ro.z.f = 0.0f;
+  scene.ro.x = 0.0f;
+  scene.ro.y = 0.0f;
+  scene.ro.z = 0.0f;
+
+  lm_tonemap_init( &lut );
+
+  lm_render( 0, 0, 160, 60, 16, lm_rt_tile, &scene, LM_RENDER_THREADS );
 
   for( y=0; y<60; y++ ) {
     for( x=0; x<160; x++ ) {
-
-       rd.x.f = (float) x;
-       rd.y.f = (float) y;
-       rd.z.f = 8.0f;          // pinhole camera with screen at depth 8.0f
-
-       // test rays against two objects P and Q :) 
-       //t  = lm_rt_raytriint( ro, rd, p0, p1, p2 ) | lm_rt_raytriint( ro, rd, q0, q1, q2 );
-       hit = lm_rt_raytriint( ro, rd, p0, p1, p2, &temp_beta, &temp_gamma, &temp_t);
-
-       if( hit == 0 ) {
-         printf( "." );
-       } else {
-         printf( "#" );
-         beta = temp_beta;
-         gamma = temp_gamma;
-         t = temp_t;
-       }
+      if( scene.shade[y][x] != 0.0f ) {
+        beta = scene.beta[y][x];
+        gamma = scene.gamma[y][x];
+        t = scene.t[y][x];
+      }
     }
-    printf( "\n" );
+    lm_tonemap_ascii( &lut, line, scene.shade[y], 160 );
+    printf( "%.160s\n", line );
   }
 
   printf( "%f %f %f\n", beta, gamma, t );
@@ -1,135 +1,151 @@
-#include <unistd.h>
+// Frame buffer triangles - the two triangles of rt_raytri_png, the far one
+// sliding from side to side, rendered frame after frame into the lm_fb back
+// buffer and presented, then the frame times printed. A device that is a
+// plain file is a fake frame buffer of width x height at bpp bits, for
+// timing on a box with no screen.
+//
+//   gcc -O2 rt_raytri_fb.c -o rt_raytri_fb -lm -pthread
+//   ./rt_raytri_fb [device [frames [width height [bpp]]]]
+//
+//   ./rt_raytri_fb                              /dev/fb0 until Ctrl-C
+//   ./rt_raytri_fb /tmp/fb 500 1920 1080        500 frames to a fake 1080p
+//
 #include <stdio.h>
 #include <stdlib.h>
-#include <fcntl.h>
-#include <linux/fb.h>
-#include <sys/mman.h>
-
-#include "lm_rt.h"
-
-int main() {
-  // linux frame buffer variables
-  int fbfd = 0;
-  struct fb_var_screeninfo vinfo;
-  struct fb_fix_screeninfo finfo;
-  long int screensize = 0;
-  char *fbp = 0;
-  int x = 0, y = 0;
-  long int location = 0;
-
-  int v, offset, r, g, b;
-  unsigned short int colour;
-
-  // the ray tracer variables
-  int hit;
-  vec3 ro, rd;
-  vec3 p0, p1, p2;
-  vec3 q0, q1, q2;
-  float beta, gamma, t;
+#include <signal.h>
 
-  // Open the file for reading and writing
-  fbfd = open("/dev/fb0", O_RDWR);
-  if (!fbfd) {
-    printf("Error: cannot open framebuffer device.\n");
-    exit(1);
-  }
+#include "lm_fb.h"
+#include "lm_rt_simd.h"
+#include "lm_render.h"
 
-  // Get fixed screen information
-  if (ioctl(fbfd, FBIOGET_FSCREENINFO, &finfo)) {
-    printf("Error reading fixed information - permissions on /dev/fb0?\n");
-    exit(2);
-  }
-
-  // Get variable screen information
-  if (ioctl(fbfd, FBIOGET_VSCREENINFO, &vinfo)) {
-    printf("Error reading variable information.\n");
-    exit(3);
-  }
+typedef struct {
+  lm_fb *fb;
+  const lm_tonemap_lut *lut;
+  vec3 ro, p0, p1, p2, q0, q1, q2;
+} lm_rt_scene;
 
-  // Figure out the size of the screen in bytes
-  screensize = vinfo.xres * vinfo.yres * vinfo.bits_per_pixel / 8;
+volatile sig_atomic_t lm_rt_stop = 0;
 
-  // Map the device to memory
-  fbp = (char *)mmap(0, screensize, PROT_READ | PROT_WRITE, MAP_SHARED,
-             fbfd, 0);
-  if ((int)fbp == -1) {
-    printf("Error: failed to map framebuffer device to memory.\n");
-    exit(4);
-  }
-
-  // Set up single triangle
-  //
-  p0.x.f = (float) vinfo.xres / 4.0f;
-  p0.y.f = (float) vinfo.yres / 4.0f;
-  p0.z.f = 16.0f;
+void lm_rt_interrupt( int sig ) {
+  (void) sig;
+  lm_rt_stop = 1;
+}
 
-  p1.x.f = (float) vinfo.xres * 1.8f - 1.0f;
-  p1.y.f = (float) vinfo.yres * 0.9f;
-  p1.z.f = 16.0f;
+// one tile straight into the back buffer, a row of shades at a time
+void lm_rt_tile( void *arg, int x0, int y0, int x1, int y1 ) {
+  lm_rt_scene *scene = (lm_rt_scene *) arg;
+  float shade[2 * LM_PACKET];
+  int x, y, hit;
+  vec3 rd;
+  float beta, gamma, t;
+  lm_ray8 packet;
+  float pbeta[LM_PACKET], pgamma[LM_PACKET], pt[LM_PACKET];
+  int lane, mask;
+
+  for( y=y0; y<y1; y++ ) {
+    // eight pixels of the row at a time, the remainder falls through to the
+    // scalar loop below
+    for( x=x0; x+LM_PACKET<=x1; x+=LM_PACKET ) {
+      for( lane=0; lane<LM_PACKET; lane++ ) {
+        rd.x = (float) (x + lane);
+        rd.y = (float) y;
+        rd.z = 8.0f;        // pinhole camera with screen at depth 8.0f
+
+        lm_vec3_norm( &rd, rd );
+        lm_ray8_set( &packet, lane, scene->ro, rd );
+      }
 
-  p2.x.f = (float) vinfo.yres * 0.9f;
-  p2.y.f = (float) vinfo.yres * 1.8f - 1.0f;
-  p2.z.f = 16.0f;
+      mask = lm_rt_raytriint8( &packet, scene->p0, scene->p1, scene->p2, pbeta, pgamma, pt );
+      for( lane=0; lane<LM_PACKET; lane++ ) {
+        shade[ x - x0 + lane ] = ((mask >> lane) & 1) ? pbeta[lane] + pgamma[lane] : 0.0f;
+      }
 
-  // OK - and another...
-  q0.x.f = p0.x.f;
-  q0.y.f = p0.y.f;
-  q0.z.f = p0.z.f * 6.0f;
+      mask = lm_rt_raytriint8( &packet, scene->q0, scene->q1, scene->q2, pbeta, pgamma, pt );
+      for( lane=0; lane<LM_PACKET; lane++ ) {
+        shade[ x - x0 + lane ] += ((mask >> lane) & 1) ? pbeta[lane] + pgamma[lane] : 0.0f;
+      }
+    }
+    for( ; x<x1; x++ ) {
+      rd.x = (float) x;
+      rd.y = (float) y;
+      rd.z = 8.0f;
 
-  q1.x.f = p1.x.f;
-  q1.y.f = p1.y.f;
-  q1.z.f = p1.z.f * 6.0f;
+      lm_vec3_norm( &rd, rd );
 
-  q2.x.f = p2.x.f;
-  q2.y.f = p2.y.f;
-  q2.z.f = p2.z.f * 6.0f;
+      hit = lm_rt_raytriint( scene->ro, rd, scene->p0, scene->p1, scene->p2, &beta, &gamma, &t);
+      shade[ x - x0 ] = (hit == 1) ?  beta + gamma : 0.0f;
 
-  // All rays originate from 0,0,0 creating a frustum with one aligned axis
-  //
-  ro.x.f = 0.0f;
-  ro.y.f = 0.0f;
-  ro.z.f = 0.0f;
-
-  // Figure out where in memory to put the pixel
-  for ( y = 0; y < vinfo.yres; y++ )
-    for ( x = 0; x < vinfo.xres; x++ ) {
+      hit = lm_rt_raytriint( scene->ro, rd, scene->q0, scene->q1, scene->q2, &beta, &gamma, &t);
+      shade[ x - x0 ] += (hit == 1) ?  beta + gamma : 0.0f;
+    }
+    lm_fb_put( scene->fb, scene->lut, x0, y, shade, x1 - x0 );
+  }
+}
 
-      location = (x+vinfo.xoffset) * (vinfo.bits_per_pixel/8) +
-             (y+vinfo.yoffset) * finfo.line_length;
+int main(int argc, char *argv[]) {
+  const char *device = (argc > 1) ? argv[1] : "/dev/fb0";
+  long frames = (argc > 2) ? atol(argv[2]) : 0;        // 0 until interrupted
+  int width   = (argc > 4) ? atoi(argv[3]) : 640;      // fake device only
+  int height  = (argc > 4) ? atoi(argv[4]) : 480;
+  int bpp     = (argc > 5) ? atoi(argv[5]) : 32;
+  long frame;
+  float slide;
+  lm_fb fb;
+  lm_tonemap_lut lut;
+  lm_rt_scene scene;
+
+  if (lm_fb_open(&fb, device, width, height, bpp)) {
+    return 1;
+  }
 
-      rd.x.f = (float) x;
-      rd.y.f = (float) y;
-      rd.z.f = 8.0f;          // pinhole camera with screen at depth 8.0f
+  lm_tonemap_init(&lut);
+  scene.fb  = &fb;
+  scene.lut = &lut;
 
-      rd = lm_vec3_norm( rd );
+  // Set up single triangle
+  //
+  scene.p0.x = (float) fb.width / 4.0f;
+  scene.p0.y = (float) fb.height / 4.0f;
+  scene.p0.z = 16.0f;
 
-      // test rays against two objects P and Q :)
-      //t  = lm_rt_raytriint( ro, rd, p0, p1, p2 ) | lm_rt_raytriint( ro, rd, q0, q1, q2 );
-      hit = lm_rt_raytriint( ro, rd, p0, p1, p2, &beta, &gamma, &t);
-      v = (hit == 1) ? (int) 95.0f * ( beta + gamma ) : 0;
+  scene.p1.x = (float) fb.width * 1.8f - 1.0f;
+  scene.p1.y = (float) fb.height * 0.9f;
+  scene.p1.z = 16.0f;
 
-      hit = lm_rt_raytriint( ro, rd, q0, q1, q2, &beta, &gamma, &t);
-      v = (hit == 1) ? (int) 95.0f * ( beta + gamma ) : v;
+  scene.p2.x = (float) fb.height * 0.9f;
+  scene.p2.y = (float) fb.height * 1.8f - 1.0f;
+  scene.p2.z = 16.0f;
 
-      if (v < 0) v = 0;
-      if (v > 95) v = 95;
-      offset = v % 32;
-    
-      if (v<32) {
-        r = 0, g = 0; b = offset;
-      }
-      else if (v<64) {
-        r= 0; g = offset; b = 31-offset;
-      }
-      else {
-        r = offset; g = 31-offset; b = 0;
-      }
+  // OK - and another...
+  scene.q0.y = scene.p0.y;
+  scene.q0.z = scene.p0.z * 6.0f;
+  scene.q1.y = scene.p1.y;
+  scene.q1.z = scene.p1.z * 6.0f;
+  scene.q2.y = scene.p2.y;
+  scene.q2.z = scene.p2.z * 6.0f;
 
-      colour = r<<11 | g << 5 | b;
-      *((unsigned short int*)(fbp + location)) = colour;
+  // All rays originate from 0,0,0 creating a frustum with one aligned axis
+  //
+  scene.ro.x = 0.0f;
+  scene.ro.y = 0.0f;
+  scene.ro.z = 0.0f;
+
+  signal(SIGINT, lm_rt_interrupt);
+
+  for (frame = 0; (frames == 0 || frame < frames) && !lm_rt_stop; frame++) {
+    // the far triangle swings half a screen either way every 120 frames
+    slide = (float) fb.width * 0.5f * sinf((float) frame * 2.0f * (float) M_PI / 120.0f);
+    scene.q0.x = scene.p0.x + slide;
+    scene.q1.x = scene.p1.x + slide;
+    scene.q2.x = scene.p2.x + slide;
+
+    // tiles a multiple of LM_PACKET wide so the packets cover the same
+    // pixels as a whole row would
+    lm_render(0, 0, fb.width, fb.height, 2 * LM_PACKET, lm_rt_tile, &scene, LM_RENDER_THREADS);
+    lm_fb_present(&fb);
+  }
 
-    }
-  munmap(fbp, screensize);
-  close(fbfd);
+  lm_fb_report(&fb);
+  lm_fb_close(&fb);
   return 0;
 }
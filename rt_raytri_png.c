@@ -4,11 +4,9 @@
 #include <math.h>
 #include <malloc.h>
 #include <png.h>
-#include "lm_rt.h"
-
-// This takes the float value 'val', converts it to red, green & blue values, then
-// sets those values into the image memory buffer location pointed to by 'ptr'
-inline void setRGB(png_byte *ptr, float val);
+#include "lm_tonemap.h"
+#include "lm_rt_simd.h"
+#include "lm_render.h"
 
 // This function actually writes out the PNG image file. The string 'title' is
 // also written into the image file
@@ -40,29 +38,13 @@ int main(int argc, char *argv[]) {
   return result;
 }
 
-inline void setRGB(png_byte *ptr, float val) {
-  int v = (int)(val * 767);
-  if (v < 0) v = 0;
-  if (v > 767) v = 767;
-  int offset = v % 256;
-
-  if (v<256) {
-    ptr[0] = 0; ptr[1] = 0; ptr[2] = offset;
-  }
-  else if (v<512) {
-    ptr[0] = 0; ptr[1] = offset; ptr[2] = 255-offset;
-  }
-  else {
-    ptr[0] = offset; ptr[1] = 255-offset; ptr[2] = 0;
-  }
-}
-
 int writeImage(char* filename, int width, int height, float *buffer, char* title) {
   int code = 0;
   FILE *fp;
   png_structp png_ptr;
   png_infop info_ptr;
   png_bytep row;
+  lm_tonemap_lut lut;
 
   // Open file for writing (binary mode)
   fp = fopen(filename, "wb");
@@ -116,12 +98,11 @@ int writeImage(char* filename, int width, int height, float *buffer, char* title
   // Allocate memory for one row (3 bytes per pixel - RGB)
   row = (png_bytep) malloc(3 * width * sizeof(png_byte));
 
-  // Write image data
-  int x, y;
+  // Write image data, coloured a row at a time
+  lm_tonemap_init(&lut);
+  int y;
   for (y=0 ; y<height ; y++) {
-    for (x=0 ; x<width ; x++) {
-      setRGB(&(row[x*3]), buffer[y*width + x]);
-    }
+    lm_tonemap_rgb888(&lut, row, &buffer[y*width], width);
     png_write_row(png_ptr, row);
   }
 
@@ -137,18 +118,90 @@ int writeImage(char* filename, int width, int height, float *buffer, char* title
   return code;
 }
 
-float *lm_rt_primary_rays( int width, int height ) {
-
+typedef struct {
+  float *buffer;
+  int width;
+  vec3 ro, p0, p1, p2, q0, q1, q2;
+} lm_rt_scene;
+
+// one tile of the image - tiles write disjoint pixels so can run in parallel
+void lm_rt_tile( void *arg, int x0, int y0, int x1, int y1 ) {
+  lm_rt_scene *scene = (lm_rt_scene *) arg;
+  float *buffer = scene->buffer;
+  int width = scene->width;
   int x, y, hit;
-  vec3 ro, rd;
+  vec3 rd;
+  float beta, gamma, t;
+#ifndef MP
+  lm_ray8 packet;
+  float pbeta[LM_PACKET], pgamma[LM_PACKET], pt[LM_PACKET];
+  int lane, mask;
+#endif
+
+  for( y=y0; y<y1; y++ ) {
+#ifdef MP
+    x = x0;
+#else
+    // eight pixels of the row at a time, the remainder falls through to the
+    // scalar loop below
+    for( x=x0; x+LM_PACKET<=x1; x+=LM_PACKET ) {
+      for( lane=0; lane<LM_PACKET; lane++ ) {
+        rd.x = (float) (x + lane);
+        rd.y = (float) y;
+        rd.z = 8.0f;        // pinhole camera with screen at depth 8.0f
+
+        lm_vec3_norm( &rd, rd );
+        lm_ray8_set( &packet, lane, scene->ro, rd );
+      }
+
+      mask = lm_rt_raytriint8( &packet, scene->p0, scene->p1, scene->p2, pbeta, pgamma, pt );
+      for( lane=0; lane<LM_PACKET; lane++ ) {
+        buffer[ y * width + x + lane ] = ((mask >> lane) & 1) ? pbeta[lane] + pgamma[lane] : 0.0f;
+      }
+
+      mask = lm_rt_raytriint8( &packet, scene->q0, scene->q1, scene->q2, pbeta, pgamma, pt );
+      for( lane=0; lane<LM_PACKET; lane++ ) {
+        buffer[ y * width + x + lane ] += ((mask >> lane) & 1) ? pbeta[lane] + pgamma[lane] : 0.0f;
+      }
+    }
+#endif
+    for( ; x<x1; x++ ) {
 
-  vec3 p0, p1, p2;
-  vec3 q0, q1, q2;
+#ifdef MP
+       mpfr_init_set_d( rd.x, (float) x, MPFR_RNDN );
+       mpfr_init_set_d( rd.y, (float) y, MPFR_RNDN );
+       mpfr_init_set_d( rd.z, 8.0f, MPFR_RNDN );
+#else
+       rd.x = (float) x;
+       rd.y = (float) y;
+       rd.z = 8.0f;          // pinhole camera with screen at depth 8.0f
+#endif
+
+       lm_vec3_norm( &rd, rd );
+
+       // test rays against two objects P and Q :)
+       //t  = lm_rt_raytriint( ro, rd, p0, p1, p2 ) | lm_rt_raytriint( ro, rd, q0, q1, q2 );
+       hit = lm_rt_raytriint( scene->ro, rd, scene->p0, scene->p1, scene->p2, &beta, &gamma, &t);
+       buffer[ y * width + x ] = (hit == 1) ?  beta + gamma : 0.0f;
+
+       hit = lm_rt_raytriint( scene->ro, rd, scene->q0, scene->q1, scene->q2, &beta, &gamma, &t);
+       buffer[ y * width + x ] += (hit == 1) ?  beta + gamma : 0.0f;
+    }
+  }
+
+#ifdef MP
+  mpfr_clear( rd.x );
+  mpfr_clear( rd.y );
+  mpfr_clear( rd.z );
+#endif
+}
+
+float *lm_rt_primary_rays( int width, int height ) {
 
   float p0x, p0y, p0z, p1x, p1y, p1z, p2x, p2y, p2z;
   float q0x, q0y, q0z, q1x, q1y, q1z, q2x, q2y, q2z;
 
-  float beta, gamma, t;
+  lm_rt_scene scene;
 
   float *buffer = (float *) malloc(width * height * sizeof(float));
 
@@ -157,6 +210,9 @@ float *lm_rt_primary_rays( int width, int height ) {
     return NULL;
   }
 
+  scene.buffer = buffer;
+  scene.width  = width;
+
   // Set up single triangle
   //
   p0x = (float) width / 4.0f;
@@ -185,107 +241,87 @@ float *lm_rt_primary_rays( int width, int height ) {
   q2z = p2z * 6.0f;
 
 #ifdef MP
-  mpfr_init_set_d( p0.x, p0x, MPFR_RNDN );
-  mpfr_init_set_d( p0.y, p0y, MPFR_RNDN );
-  mpfr_init_set_d( p0.z, p0z, MPFR_RNDN );
-  mpfr_init_set_d( p1.x, p1x, MPFR_RNDN );
-  mpfr_init_set_d( p1.y, p1y, MPFR_RNDN );
-  mpfr_init_set_d( p1.z, p1z, MPFR_RNDN );
-  mpfr_init_set_d( p2.x, p2x, MPFR_RNDN );
-  mpfr_init_set_d( p2.y, p2y, MPFR_RNDN );
-  mpfr_init_set_d( p2.z, p2z, MPFR_RNDN );
-
-  mpfr_init_set_d( q0.x, q0x, MPFR_RNDN );
-  mpfr_init_set_d( q0.y, q0y, MPFR_RNDN );
-  mpfr_init_set_d( q0.z, q0z, MPFR_RNDN );
-  mpfr_init_set_d( q1.x, q1x, MPFR_RNDN );
-  mpfr_init_set_d( q1.y, q1y, MPFR_RNDN );
-  mpfr_init_set_d( q1.z, q1z, MPFR_RNDN );
-  mpfr_init_set_d( q2.x, q2x, MPFR_RNDN );
-  mpfr_init_set_d( q2.y, q2y, MPFR_RNDN );
-  mpfr_init_set_d( q2.z, q2z, MPFR_RNDN );
-
-  mpfr_init_set_d( ro.x, 0.0f, MPFR_RNDN );
-  mpfr_init_set_d( ro.y, 0.0f, MPFR_RNDN );
-  mpfr_init_set_d( ro.z, 0.0f, MPFR_RNDN );
+  mpfr_init_set_d( scene.p0.x, p0x, MPFR_RNDN );
+  mpfr_init_set_d( scene.p0.y, p0y, MPFR_RNDN );
+  mpfr_init_set_d( scene.p0.z, p0z, MPFR_RNDN );
+  mpfr_init_set_d( scene.p1.x, p1x, MPFR_RNDN );
+  mpfr_init_set_d( scene.p1.y, p1y, MPFR_RNDN );
+  mpfr_init_set_d( scene.p1.z, p1z, MPFR_RNDN );
+  mpfr_init_set_d( scene.p2.x, p2x, MPFR_RNDN );
+  mpfr_init_set_d( scene.p2.y, p2y, MPFR_RNDN );
+  mpfr_init_set_d( scene.p2.z, p2z, MPFR_RNDN );
+
+  mpfr_init_set_d( scene.q0.x, q0x, MPFR_RNDN );
+  mpfr_init_set_d( scene.q0.y, q0y, MPFR_RNDN );
+  mpfr_init_set_d( scene.q0.z, q0z, MPFR_RNDN );
+  mpfr_init_set_d( scene.q1.x, q1x, MPFR_RNDN );
+  mpfr_init_set_d( scene.q1.y, q1y, MPFR_RNDN );
+  mpfr_init_set_d( scene.q1.z, q1z, MPFR_RNDN );
+  mpfr_init_set_d( scene.q2.x, q2x, MPFR_RNDN );
+  mpfr_init_set_d( scene.q2.y, q2y, MPFR_RNDN );
+  mpfr_init_set_d( scene.q2.z, q2z, MPFR_RNDN );
+
+  mpfr_init_set_d( scene.ro.x, 0.0f, MPFR_RNDN );
+  mpfr_init_set_d( scene.ro.y, 0.0f, MPFR_RNDN );
+  mpfr_init_set_d( scene.ro.z, 0.0f, MPFR_RNDN );
 #else
-  p0.x = p0x;
-  p0.y = p0y;
-  p0.z = p0z;
-  p1.x = p1x;
-  p1.y = p1y;
-  p1.z = p1z;
-  p2.x = p2x;
-  p2.y = p2y;
-  p2.z = p2z;
-
-  q0.x = q0x;
-  q0.y = q0y;
-  q0.z = q0z;
-  q1.x = q1x;
-  q1.y = q1y;
-  q1.z = q1z;
-  q2.x = q2x;
-  q2.y = q2y;
-  q2.z = q2z;
+  scene.p0.x = p0x;
+  scene.p0.y = p0y;
+  scene.p0.z = p0z;
+  scene.p1.x = p1x;
+  scene.p1.y = p1y;
+  scene.p1.z = p1z;
+  scene.p2.x = p2x;
+  scene.p2.y = p2y;
+  scene.p2.z = p2z;
+
+  scene.q0.x = q0x;
+  scene.q0.y = q0y;
+  scene.q0.z = q0z;
+  scene.q1.x = q1x;
+  scene.q1.y = q1y;
+  scene.q1.z = q1z;
+  scene.q2.x = q2x;
+  scene.q2.y = q2y;
+  scene.q2.z = q2z;
 
   // All rays originate from 0,0,0 creating a frustum with one aligned axis
   //
-  ro.x = 0.0f;
-  ro.y = 0.0f;
-  ro.z = 0.0f;
+  scene.ro.x = 0.0f;
+  scene.ro.y = 0.0f;
+  scene.ro.z = 0.0f;
 #endif
 
-  for( y=0; y<height; y++ ) {
-    for( x=0; x<width; x++ ) {
-
+  // tiles spread over all the cores - a multiple of LM_PACKET wide so the
+  // packets cover the same pixels as a whole row would - mpfr runs on one
 #ifdef MP
-       mpfr_init_set_d( rd.x, (float) x, MPFR_RNDN );
-       mpfr_init_set_d( rd.y, (float) y, MPFR_RNDN );
-       mpfr_init_set_d( rd.z, 8.0f, MPFR_RNDN );
+  lm_render( 0, 0, width, height, 2 * LM_PACKET, lm_rt_tile, &scene, 1 );
 #else
-       rd.x = (float) x;
-       rd.y = (float) y;
-       rd.z = 8.0f;          // pinhole camera with screen at depth 8.0f
+  lm_render( 0, 0, width, height, 2 * LM_PACKET, lm_rt_tile, &scene, LM_RENDER_THREADS );
 #endif
 
-       lm_vec3_norm( &rd, rd );
-
-       // test rays against two objects P and Q :)
-       //t  = lm_rt_raytriint( ro, rd, p0, p1, p2 ) | lm_rt_raytriint( ro, rd, q0, q1, q2 );
-       hit = lm_rt_raytriint( ro, rd, p0, p1, p2, &beta, &gamma, &t);
-       buffer[ y * width + x ] = (hit == 1) ?  beta + gamma : 0.0f;
-
-       hit = lm_rt_raytriint( ro, rd, q0, q1, q2, &beta, &gamma, &t);
-       buffer[ y * width + x ] += (hit == 1) ?  beta + gamma : 0.0f;
-    }
-  }
-
 #ifdef MP
-  mpfr_clear( p0.x );
-  mpfr_clear( p0.y );
-  mpfr_clear( p0.z );
-  mpfr_clear( p1.x );
-  mpfr_clear( p1.y );
-  mpfr_clear( p1.z );
-  mpfr_clear( p2.x );
-  mpfr_clear( p2.y );
-  mpfr_clear( p2.z );
-  mpfr_clear( q0.x );
-  mpfr_clear( q0.y );
-  mpfr_clear( q0.z );
-  mpfr_clear( q1.x );
-  mpfr_clear( q1.y );
-  mpfr_clear( q1.z );
-  mpfr_clear( q2.x );
-  mpfr_clear( q2.y );
-  mpfr_clear( q2.z );
-  mpfr_clear( ro.x );
-  mpfr_clear( ro.y );
-  mpfr_clear( ro.z );
-  mpfr_clear( rd.x );
-  mpfr_clear( rd.y );
-  mpfr_clear( rd.z );
+  mpfr_clear( scene.p0.x );
+  mpfr_clear( scene.p0.y );
+  mpfr_clear( scene.p0.z );
+  mpfr_clear( scene.p1.x );
+  mpfr_clear( scene.p1.y );
+  mpfr_clear( scene.p1.z );
+  mpfr_clear( scene.p2.x );
+  mpfr_clear( scene.p2.y );
+  mpfr_clear( scene.p2.z );
+  mpfr_clear( scene.q0.x );
+  mpfr_clear( scene.q0.y );
+  mpfr_clear( scene.q0.z );
+  mpfr_clear( scene.q1.x );
+  mpfr_clear( scene.q1.y );
+  mpfr_clear( scene.q1.z );
+  mpfr_clear( scene.q2.x );
+  mpfr_clear( scene.q2.y );
+  mpfr_clear( scene.q2.z );
+  mpfr_clear( scene.ro.x );
+  mpfr_clear( scene.ro.y );
+  mpfr_clear( scene.ro.z );
 #endif
   return buffer;
 }